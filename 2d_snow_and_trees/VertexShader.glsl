@@ -6,11 +6,19 @@ layout(location = 1) in vec3 vertex_color;
 
 // Values that stay constant for the whole mesh.
 uniform mat4 MVP;
+#ifdef INSTANCED
+// One transform per snowflake, drawn with a single instanced call
+layout(location = 2) in mat4 instanceMVP;
+#endif
 
 out vec3 color;
 
 void main() {
 	color = vertex_color;
 	// Output position of the vertex, in clip space : MVP * position
+#ifdef INSTANCED
+	gl_Position = instanceMVP * vec4(vertexPosition_modelspace,1);
+#else
 	gl_Position = MVP * vec4(vertexPosition_modelspace,1);
+#endif
 }
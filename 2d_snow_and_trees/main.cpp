@@ -5,6 +5,7 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <vector>
 #include <random>
@@ -24,6 +25,16 @@ using namespace glm;
 
 // Shader library
 #include <common/shader.hpp>
+#include <common/frame_scheduler.hpp>
+#include <common/headless.hpp>
+#include <common/profiler.hpp>
+#include <common/input_log.hpp>
+#include <common/gl_counters.hpp>
+#include <common/gl_state.hpp>
+#include <common/ring_buffer.hpp>
+
+// Offscreen runs without a display, for benchmarks
+Headless headless;
 
 #define BUFFER_OFFSET( offset ) ((GLvoid*) (offset))
 
@@ -34,8 +45,12 @@ double windowRatio = (double)windowWidth / windowHeight;;
 
 GLuint programID;
 GLuint program2ID;
+// The snowflakes' program, VertexShader.glsl with per instance transforms
+GLuint flakeProgramID;
 GLuint sf_vertexArrayObject;
 GLuint sf_vertexBufferObject;
+// Holds the snowflake transforms only when they do not fit in dynamicRing
+GLuint sf_instanceBufferObject = 0;
 GLuint tree_vertexArrayObject;
 GLuint tree_vertexBufferObject;
 GLuint snow_vertexArrayObject;
@@ -52,10 +67,14 @@ std::vector<glm::vec3> snow_vertex_buffer_data;
 glm::mat4 Projection;
 glm::mat4 View;
 
-double startTime;
-double startTime2;
-double currentTime;
-bool isMoveTime = false;
+// The snow and trees move in steps of 50 ms, this frame's steps are moveSteps
+FrameScheduler frameScheduler;
+int moveSteps = 0;
+// --flakes N keeps at least N snowflakes falling, for benchmarks
+size_t minSnowflakes = 0;
+// Per frame uploads, the snowflake transforms
+RingBuffer dynamicRing;
+std::vector<glm::mat4> flakeTransforms;
 bool mouse_down = false;
 // Mouse positions
 double xpos, ypos;
@@ -225,6 +244,9 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	if (key == GLFW_KEY_R && action == GLFW_PRESS)
 		snowflakes.clear();
+	// Write the last frames' profile
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		profiler.write_trace("snow_trace.json");
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
@@ -297,11 +319,11 @@ void generate_array_and_buffer(GLuint& vao, GLuint& vbo, std::vector<glm::vec3>&
 	// Create a vertex array object that represents vertex attributes stored in a vertex buffer
 	// object.
 	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	glState.bind_vertex_array(vao);
 
 	// Create and initialize a buffer object, Generates our buffers in the GPUs memory
 	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glState.bind_buffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertex_buffer_data.size(),
 		&vertex_buffer_data[0], GL_STATIC_DRAW);
 }
@@ -395,23 +417,20 @@ void init_model(void)
 		1.0f, 1.0f,  0.4f
 	};
 	glGenBuffers(1, &bg_colors_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, bg_colors_vbo);
+	glState.bind_buffer(GL_ARRAY_BUFFER, bg_colors_vbo);
 	glBufferData(GL_ARRAY_BUFFER, 18 * sizeof(float), colors, GL_STATIC_DRAW);
 }
 
 // Draw model
 void draw_snowflakes()
 {
-	glUseProgram(programID);
-	glBindVertexArray(sf_vertexArrayObject);
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, sf_vertexBufferObject);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), BUFFER_OFFSET(0));
-
-	float colorVec[4] = { 0.94f, 0.95f, 0.9f, 1.0f };
-	GLint colorLoc = glGetUniformLocation(programID, "color");
-	glProgramUniform4fv(programID, colorLoc, 1, colorVec);
+	// The snowflakes move and are removed while they are drawn
+	ProfileScope cpuScope("Snowflakes");
+	GpuProfileScope gpuScope("Snowflakes");
+	if (snowflakes.empty())
+		return;
 
+	flakeTransforms.clear();
 	for (auto &flake : snowflakes) {
 		glm::mat4 Model = glm::mat4(1.0);
 
@@ -425,18 +444,39 @@ void draw_snowflakes()
 		glm::mat4 scale = glm::scale(glm::mat4(1.0f), glm::vec3(flake.scale, flake.scale, 0.0f));
 		//Apply to MVP matrix
 		glm::mat4 MVP = Projection * View * RBT * scale * Model;
+		flakeTransforms.push_back(MVP);
 
-		GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)sf_vertex_buffer_data.size());
-
-		if (isMoveTime) {
+		for (int i = 0; i < moveSteps; ++i) {
 			flake.move();
 		}
 	}
 
-	if (isMoveTime) {
+	// Into this frame's slice of the ring, or a buffer of its own when the ring is full
+	GLsizeiptr size = flakeTransforms.size() * sizeof(glm::mat4);
+	GLintptr offset = dynamicRing.upload(&flakeTransforms[0], size);
+	GLuint buffer = dynamicRing.buffer;
+	if (offset < 0)
+	{
+		if (sf_instanceBufferObject == 0)
+			glGenBuffers(1, &sf_instanceBufferObject);
+		glState.bind_buffer(GL_ARRAY_BUFFER, sf_instanceBufferObject);
+		glBufferData(GL_ARRAY_BUFFER, size, &flakeTransforms[0], GL_STREAM_DRAW);
+		buffer = sf_instanceBufferObject;
+		offset = 0;
+	}
+
+	glState.use_program(flakeProgramID);
+	glState.bind_vertex_array(sf_vertexArrayObject);
+	glState.vertex_attrib(0, sf_vertexBufferObject, 3, sizeof(glm::vec3), 0);
+	for (int c = 0; c < 4; ++c)
+		glState.vertex_attrib(2 + c, buffer, 4, sizeof(glm::mat4), offset + c * sizeof(glm::vec4), 1);
+
+	float colorVec[4] = { 0.94f, 0.95f, 0.9f, 1.0f };
+	GLint colorLoc = glGetUniformLocation(flakeProgramID, "color");
+	glProgramUniform4fv(flakeProgramID, colorLoc, 1, colorVec);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, (GLsizei)sf_vertex_buffer_data.size(), (GLsizei)flakeTransforms.size());
+
+	if (moveSteps > 0) {
 		// Remove a snowflake if it is outside the frame
 		snowflakes.erase(
 			std::remove_if(
@@ -444,17 +484,13 @@ void draw_snowflakes()
 				[](SnowFlake sf) { return sf.isOutOfBounds(); }),
 			snowflakes.end());
 	}
-
-	glDisableVertexAttribArray(0);
 }
 
 void draw_trees()
 {
-	glUseProgram(programID);
-	glBindVertexArray(tree_vertexArrayObject);
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, tree_vertexBufferObject);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), BUFFER_OFFSET(0));
+	glState.use_program(programID);
+	glState.bind_vertex_array(tree_vertexArrayObject);
+	glState.vertex_attrib(0, tree_vertexBufferObject, 3, sizeof(glm::vec3), 0);
 
 	float colorVec[4] = { 0.1f, 0.5f, 0.2f, 1.0f };
 	float colorVec2[4] = { 0.5f, 0.3f, 0.1f, 1.0f };
@@ -482,21 +518,17 @@ void draw_trees()
 		glProgramUniform4fv(programID, colorLoc, 1, colorVec2);
 		glDrawArrays(GL_TRIANGLES, 3, (GLsizei)tree_vertex_buffer_data.size());
 
-		if (isMoveTime) {
+		for (int i = 0; i < moveSteps; ++i) {
 			tree.move();
 		}
 	}
-
-	glDisableVertexAttribArray(0);
 }
 
 void draw_snow()
 {
-	glUseProgram(programID);
-	glBindVertexArray(snow_vertexArrayObject);
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, snow_vertexBufferObject);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), BUFFER_OFFSET(0));
+	glState.use_program(programID);
+	glState.bind_vertex_array(snow_vertexArrayObject);
+	glState.vertex_attrib(0, snow_vertexBufferObject, 3, sizeof(glm::vec3), 0);
 
 	// Color of the top of the tree
 	float colorVec[4] = { 0.85f, 0.85f, 0.9f, 1.0f };
@@ -520,20 +552,14 @@ void draw_snow()
 
 	glProgramUniform4fv(programID, colorLoc, 1, colorVec);
 	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)snow_vertex_buffer_data.size());
-
-	glDisableVertexAttribArray(0);
 }
 
 void draw_bg()
 {
-	glUseProgram(program2ID);
-	glBindVertexArray(bg_vertexArrayObject);
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, bg_vertexBufferObject);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), BUFFER_OFFSET(0));
-	glBindBuffer(GL_ARRAY_BUFFER, bg_colors_vbo);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+	glState.use_program(program2ID);
+	glState.bind_vertex_array(bg_vertexArrayObject);
+	glState.vertex_attrib(0, bg_vertexBufferObject, 3, sizeof(glm::vec3), 0);
+	glState.vertex_attrib(1, bg_colors_vbo, 3, 0, 0);
 
 	glm::mat4 Model = glm::mat4(1.0f);
 
@@ -554,13 +580,22 @@ void draw_bg()
 	glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
 
 	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)bg_vertex_buffer_data.size());
-
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
 }
 
 int main(int argc, char* argv[])
 {
+	// --headless renders a fixed number of frames offscreen and exits, see common/headless.hpp
+	headless.parse(argc, argv);
+	if (!headless.init_hints())
+	{
+		return -1;
+	}
+	// --record and --replay log the input, see common/input_log.hpp
+	inputLog.parse(argc, argv);
+	for (int i = 1; i + 1 < argc; ++i)
+		if (strcmp(argv[i], "--flakes") == 0)
+			minSnowflakes = (size_t)std::max(atoi(argv[++i]), 0);
+
 	// Step 1: Initialization
 	if (!glfwInit())
 	{
@@ -571,6 +606,7 @@ int main(int argc, char* argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	headless.window_hints();
 
 	// GLFW create window and context
 	window = glfwCreateWindow(windowWidth, windowHeight, "Homework #1 | Fredrik Berglund 20166029 | Snow Animation", NULL, NULL);
@@ -584,9 +620,15 @@ int main(int argc, char* argv[])
 	glfwSwapInterval(1);
 
 	// Callbacks
-	glfwSetKeyCallback(window, key_callback);
-	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	if (!inputLog.initialize())
+	{
+		return -1;
+	}
+	inputLog.set_callbacks(window, key_callback, mouse_button_callback, NULL);
 	glfwSetWindowSizeCallback(window, window_size_callback);
+	// A replay has to place the same trees and snowflakes as its recording
+	if (inputLog.active())
+		generator.seed(inputLog.seed);
 
 	// Initialize GLEW
 	glewExperimental = GL_TRUE;
@@ -594,6 +636,10 @@ int main(int argc, char* argv[])
 	{
 		return -1;
 	}
+	if (!headless.initialize(windowWidth, windowHeight))
+	{
+		return -1;
+	}
 	// END
 
 	Projection = glm::perspective(45.0f, (float)windowRatio, 0.1f, 100.0f);
@@ -605,16 +651,21 @@ int main(int argc, char* argv[])
 
 	// Initialize OpenGL and GLSL
 	glClearColor(0.05f, 0.25f, 0.4f, 0.0f);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
+	glState.enable(GL_DEPTH_TEST, true);
+	glState.depth_func(GL_LESS);
 
 	// For rendering the front side of the object only
-	glEnable(GL_CULL_FACE); // cull face
+	glState.enable(GL_CULL_FACE, true); // cull face
 	glCullFace(GL_BACK); // cull back face
 	glFrontFace(GL_CW); // GL_CCW for counter clock-wise
 
 	programID = LoadShaders("VertexShader.glsl", "FragmentShader.glsl");
 	program2ID = LoadShaders("VertexShader.glsl", "InterpolationFragmentShader.glsl");
+	flakeProgramID = LoadShaders("VertexShader.glsl", "FragmentShader.glsl", "#define INSTANCED\n");
+
+	// Room for twice the --flakes minimum before falling back to sf_instanceBufferObject
+	dynamicRing.initialize(std::max((size_t)64 * 1024, 2 * minSnowflakes * sizeof(glm::mat4)));
+	frameRing = &dynamicRing;
 
 	// Set viewport to window size
 	glViewport(0, 0, windowWidth, windowHeight);
@@ -638,48 +689,53 @@ int main(int argc, char* argv[])
 	}
 
 	// Step 2: Main event loop
-	startTime, startTime2 = glfwGetTime();
-	int tick = 0;
+	profiler.initialize();
+	frameScheduler.initialize(0.05);
+	// Logged input is replayed frame by frame, so the frames have to be the same length
+	if (headless.enabled || inputLog.active())
+		frameScheduler.set_fixed_frame(headless.frame_seconds(), !headless.enabled);
+	int tick = 0, snowTick = 0;
 	do {
+		moveSteps = frameScheduler.begin_frame();
+		inputLog.begin_frame(window);
+		profiler.begin_frame();
+		headless.begin_frame();
+		dynamicRing.begin_frame();
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glfwGetCursorPos(window, &xpos, &ypos);
-
-		currentTime = glfwGetTime();
+		inputLog.get_cursor_pos(window, &xpos, &ypos);
 
-		if (currentTime - startTime > 0.05)
-		{
-			++tick;
-		}
+		tick += moveSteps;
 		// Add snowflake if mouse is pressed
 		if (mouse_down && tick > 2) {
 			double xpos, ypos;
-			glfwGetCursorPos(window, &xpos, &ypos);
+			inputLog.get_cursor_pos(window, &xpos, &ypos);
 			add_snowflake(xpos, ypos);
 			tick = 0;
 		}
 
-		// Add snowflakes at fixed interval
-		if (currentTime - startTime2 > 0.3) {
-			startTime2 = currentTime;
+		// Add snowflakes at fixed interval, every 6 steps
+		snowTick += moveSteps;
+		if (snowTick >= 6) {
+			snowTick -= 6;
 			add_snowflake();
 		}
-
-		if (currentTime - startTime > 0.05) {
-			isMoveTime = true;
-			startTime = currentTime;
-		}
-		else {
-			isMoveTime = false;
-		}
+		while (snowflakes.size() < minSnowflakes)
+			add_snowflake();
 
 		draw_snowflakes();
 		draw_trees();
 		draw_snow();
 		draw_bg();
 
+		profiler.end_frame();
 		glfwSwapBuffers(window);
-		glfwPollEvents();
+		headless.end_frame(window);
+		inputLog.end_frame();
+		frameScheduler.report("Snow and trees");
+		dynamicRing.end_frame();
+		glState.end_frame();
+		glState.report("Snow and trees");
 	} while (!glfwWindowShouldClose(window));
 
 	// Step 3: Termination
@@ -693,12 +749,18 @@ int main(int argc, char* argv[])
 	glDeleteBuffers(1, &snow_vertexBufferObject);
 	glDeleteBuffers(1, &bg_vertexBufferObject);
 	glDeleteBuffers(1, &bg_colors_vbo);
-	glDeleteProgram(programID);
-	glDeleteProgram(program2ID);
+	if (sf_instanceBufferObject != 0)
+		glDeleteBuffers(1, &sf_instanceBufferObject);
+	dynamicRing.cleanup();
+	ReleaseShaders(programID);
+	ReleaseShaders(program2ID);
+	ReleaseShaders(flakeProgramID);
 	glDeleteVertexArrays(1, &sf_vertexArrayObject);
 	glDeleteVertexArrays(1, &tree_vertexArrayObject);
 	glDeleteVertexArrays(1, &snow_vertexArrayObject);
 	glDeleteVertexArrays(1, &bg_vertexArrayObject);
+	profiler.cleanup();
+	inputLog.cleanup();
 
 	glfwTerminate();
 
@@ -10,14 +10,17 @@ layout(location = 2) in vec3 vertexColor;
 // Output data; will be interpolated for each fragment.
 out vec3 fragmentPosition;
 out vec3 fragmentColor;
+#ifdef FLAT_SHADING
+flat out vec3 fragmentNormal;
+#else
 out vec3 fragmentNormal;
+#endif
 
 uniform mat4 ModelTransform;
 uniform mat4 Eye;
 uniform mat4 Projection;
 
 void main() {
-	// Phong shading
 	// Output position of the vertex, in clip space : MVP * position
 	mat4 MVM = inverse(Eye) * ModelTransform;
 	vec4 wPosition = MVM * vec4(vertexPosition_modelspace, 1);
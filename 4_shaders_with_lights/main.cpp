@@ -5,6 +5,7 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <sstream>
 
@@ -24,16 +25,33 @@ using namespace glm;
 
 #include <common/shader.hpp>
 #include <common/affine.hpp>
+#include <common/rbt.hpp>
 #include <common/geometry.hpp>
 #include <common/arcball.hpp>
+#include <common/culling.hpp>
+#include <common/frame_scheduler.hpp>
+#include <common/headless.hpp>
+#include <common/input_log.hpp>
+#include <common/gl_state.hpp>
+#include <common/ring_buffer.hpp>
+
+// Offscreen runs without a display, for benchmarks
+Headless headless;
 
 int const OBJ_COUNT = 3;
+// The animated lights; --lights N adds N - LIGHT_COUNT still ones, for benchmarks
 int const LIGHT_COUNT = 6;
+int lightCount = LIGHT_COUNT;
 
 float g_groundSize = 100.0f;
 float g_groundY = -2.5f;
 
-GLuint lightLocGround[LIGHT_COUNT*6], lightLocObjects[OBJ_COUNT][LIGHT_COUNT*6], numLightsLocs[1+OBJ_COUNT];
+// All programs read the lights from this uniform buffer, see LIGHT_BLOCK in common/lighting.glsl
+GLuint lightBuffer;
+const GLuint LIGHT_BLOCK_BINDING = 0;
+// Per frame uploads, the light block; lightBuffer is only the fallback when it is full
+RingBuffer dynamicRing;
+GLint uniformAlignment = 256;
 
 // View properties
 glm::mat4 Projection;
@@ -46,6 +64,9 @@ float fovy = fov;
 
 // Model properties
 Model ground, objects[3];
+// Frustum culling, the objects are entries 0 .. OBJ_COUNT-1
+CullList cullList;
+int groundCull;
 glm::mat4 skyRBT;
 glm::mat4 eyeRBT;
 const glm::mat4 worldRBT = glm::mat4(1.0f);
@@ -72,9 +93,8 @@ float arcBallScreenRadius = 0.25f * min(windowWidth, windowHeight);
 float arcBallScale = 0.01f; float ScreenToEyeScale = 0.01f;
 float prev_x = 0.0f; float prev_y = 0.0f;
 
-// Time
-double then = glfwGetTime();
-double now = then;
+// Animation steps of 20 ms, frames at most every 1/60 s
+FrameScheduler frameScheduler;
 
 // Lights
 // http://www.tomdalling.com/blog/modern-opengl/08-even-more-lighting-directional-lights-spotlights-multiple-lights/
@@ -87,7 +107,18 @@ struct Light {
 	glm::vec3 coneDirection;
 };
 std::vector<Light> lights;
-std::vector<std::string> lightProperties = {"position","color","falloff","ambientCoefficient","coneAngle","coneDirection"};
+// One light as LightBlock lays it out (std140): vec3s start on 16 bytes, 64 bytes per light
+struct LightBlockEntry {
+	glm::vec4 position;
+	glm::vec3 color;
+	float falloff;
+	float ambientCoefficient;
+	float coneAngle;
+	float padding[2];
+	glm::vec3 coneDirection;
+	float padding2;
+};
+std::vector<LightBlockEntry> lightBlock;
 float lightMove = 0;
 
 static bool non_ego_cube_manipulation()
@@ -183,7 +214,7 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 		if (use_arcball())
 		{
 			// 1. Get eye coordinate of arcball and compute its screen coordinate
-			glm::vec4 arcball_eyecoord = glm::inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			glm::vec4 arcball_eyecoord = affine_inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 			glm::vec2 arcballCenter = eye_to_screen(
 				glm::vec3(arcball_eyecoord),
 				Projection,
@@ -195,8 +226,8 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 			glm::vec2 p1 = glm::vec2(prev_x, prev_y) - arcballCenter;
 			glm::vec2 p2 = glm::vec2(xpos, ypos) - arcballCenter;
 
-			glm::vec3 v1 = glm::normalize(glm::vec3(p1.x, p1.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2) - pow(p1.x, 2) - pow(p1.y, 2)))));
-			glm::vec3 v2 = glm::normalize(glm::vec3(p2.x, p2.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2) - pow(p2.x, 2) - pow(p2.y, 2)))));
+			glm::vec3 v1 = glm::normalize(glm::vec3(p1.x, p1.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2.0f) - pow(p1.x, 2.0f) - pow(p1.y, 2.0f)))));
+			glm::vec3 v2 = glm::normalize(glm::vec3(p2.x, p2.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2.0f) - pow(p2.x, 2.0f) - pow(p2.y, 2.0f)))));
 
 			glm::quat w1, w2;
 			// 2. Compute arcball rotation (Chatper 8)
@@ -218,8 +249,8 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 
 		// Apply transformation with auxiliary frame
 		setWrtFrame();
-		if (object_index == 0) { skyRBT = aFrame * m * glm::inverse(aFrame) * skyRBT; }
-		else { objectRBTs[0] = aFrame * m * glm::inverse(aFrame) * objectRBTs[0]; }
+		if (object_index == 0) { skyRBT = aFrame * m * affine_inverse(aFrame) * skyRBT; }
+		else { objectRBTs[0] = aFrame * m * affine_inverse(aFrame) * objectRBTs[0]; }
 
 		prev_x = (float)xpos; prev_y = (float)ypos;
 	}
@@ -294,42 +325,64 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 	}
 }
 
-std::string lightUniformString(int index, std::string property)
+// Called again whenever a shader has been reloaded
+void initLightBlock()
 {
-	std::ostringstream oss;
-	oss << "lights[" << index << "]." << property;
-
-	return oss.str();
+	GLuint programs[1 + OBJ_COUNT] = { ground.GLSLProgramID, objects[0].GLSLProgramID, objects[1].GLSLProgramID, objects[2].GLSLProgramID };
+	for (int i = 0; i < 1 + OBJ_COUNT; ++i)
+	{
+		GLuint index = glGetUniformBlockIndex(programs[i], "LightBlock");
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(programs[i], index, LIGHT_BLOCK_BINDING);
+	}
 }
 
-void setLightUniformLocs(GLuint* uniformArray, Model& model)
+// One upload for every program instead of six uniforms per light and program
+void updateLightBlock()
 {
-	for (int i = 0; i < lights.size(); ++i)
+	lightBlock.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); ++i)
+	{
+		LightBlockEntry& entry = lightBlock[i];
+		entry.position = lights[i].position;
+		entry.color = lights[i].color;
+		entry.falloff = lights[i].falloff;
+		entry.ambientCoefficient = lights[i].ambientCoefficient;
+		entry.coneAngle = lights[i].coneAngle;
+		entry.coneDirection = lights[i].coneDirection;
+	}
+	GLsizeiptr size = lightBlock.size() * sizeof(LightBlockEntry);
+	GLintptr offset = dynamicRing.upload(&lightBlock[0], size, uniformAlignment);
+	if (offset >= 0)
 	{
-		uniformArray[i * 6] = glGetUniformLocation(model.GLSLProgramID, lightUniformString(i, "position").c_str());
-		uniformArray[i * 6 + 1] = glGetUniformLocation(model.GLSLProgramID, lightUniformString(i, "color").c_str());
-		uniformArray[i * 6 + 2] = glGetUniformLocation(model.GLSLProgramID, lightUniformString(i, "falloff").c_str());
-		uniformArray[i * 6 + 3] = glGetUniformLocation(model.GLSLProgramID, lightUniformString(i, "ambientCoefficient").c_str());
-		uniformArray[i * 6 + 4] = glGetUniformLocation(model.GLSLProgramID, lightUniformString(i, "coneAngle").c_str());
-		uniformArray[i * 6 + 5] = glGetUniformLocation(model.GLSLProgramID, lightUniformString(i, "coneDirection").c_str());
+		glState.bind_buffer_range(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, dynamicRing.buffer, offset, size);
+		return;
 	}
+	glState.bind_buffer(GL_UNIFORM_BUFFER, lightBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, &lightBlock[0]);
+	glState.bind_buffer_range(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, lightBuffer, 0, size);
 }
 
-void setLightUniforms(GLuint* uniformArray)
+int main(int argc, char* argv[])
 {
-	for (int i = 0; i < lights.size(); ++i)
+	// --headless renders a fixed number of frames offscreen and exits, see common/headless.hpp
+	headless.parse(argc, argv);
+	if (!headless.init_hints())
 	{
-		glUniform4fv(uniformArray[i * 6], 1, glm::value_ptr(lights[i].position));
-		glUniform3fv(uniformArray[i * 6 + 1], 1, glm::value_ptr(lights[i].color));
-		glUniform1f(uniformArray[i * 6 + 2], lights[i].falloff);
-		glUniform1f(uniformArray[i * 6 + 3], lights[i].ambientCoefficient);
-		glUniform1f(uniformArray[i * 6 + 4], lights[i].coneAngle);
-		glUniform3fv(uniformArray[i * 6 + 5], 1, glm::value_ptr(lights[i].coneDirection));
+		return -1;
+	}
+	// --record and --replay log the input, see common/input_log.hpp
+	inputLog.parse(argc, argv);
+	// --watch-shaders recompiles edited .glsl files while running
+	bool watchShaders = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+			lightCount = std::max(atoi(argv[++i]), LIGHT_COUNT);
+		else if (strcmp(argv[i], "--watch-shaders") == 0)
+			watchShaders = true;
 	}
-}
 
-int main(void)
-{
 	// Initialise GLFW
 	if (!glfwInit())
 	{
@@ -341,6 +394,7 @@ int main(void)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	headless.window_hints();
 
 	// Open a window and create its OpenGL context
 	window = glfwCreateWindow((int)windowWidth, (int)windowHeight, "Homework 4 | Fredrik Berglund 20166029", NULL, NULL);
@@ -359,19 +413,23 @@ int main(void)
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 	glfwSetWindowSizeCallback(window, window_size_callback);
-	glfwSetMouseButtonCallback(window, mouse_button_callback);
-	glfwSetCursorPosCallback(window, cursor_pos_callback);
-	glfwSetKeyCallback(window, keyboard_callback);
+	if (!inputLog.initialize()) {
+		return -1;
+	}
+	inputLog.set_callbacks(window, keyboard_callback, mouse_button_callback, cursor_pos_callback);
 
 	glfwGetFramebufferSize(window, &frameBufferWidth, &frameBufferHeight);
+	if (!headless.initialize(frameBufferWidth, frameBufferHeight)) {
+		return -1;
+	}
 
 	// Clear with sky color
 	glClearColor((GLclampf)(128. / 255.), (GLclampf)(200. / 255.), (GLclampf)(255. / 255.), (GLclampf) 0.);
 
 	// Enable depth test
-	glEnable(GL_DEPTH_TEST);
+	glState.enable(GL_DEPTH_TEST, true);
 	// Accept fragment if it closer to the camera than the former one
-	glDepthFunc(GL_LESS);	
+	glState.depth_func(GL_LESS);
 
 
 	Projection = glm::perspective(fov, windowWidth / windowHeight, 0.1f, 100.0f);
@@ -382,21 +440,25 @@ int main(void)
 	// initial eye frame = sky frame;
 	eyeRBT = skyRBT;
 
+	// Lights are ordered directional, point, spot (see the setup below), so every program
+	// gets a specialized loop per light type instead of testing the type per light
+	ShaderPermutation phong;
+	phong.numDirLights = 1;
+	phong.numPointLights = 2;
+	phong.numSpotLights = 3 + (lightCount - LIGHT_COUNT);
+	phong.lightBlock = true;
+
 	// Initialize Ground Model
 	ground = Model();
 	init_ground(ground);
-	ground.initialize(DRAW_TYPE::ARRAY, "PhongVertexShader.glsl", "PhongFragmentShader.glsl");
+	ground.initialize(DRAW_TYPE::ARRAY, LoadShaders("PhongVertexShader.glsl", "PhongFragmentShader.glsl", phong));
 	ground.set_projection(&Projection);
 	ground.set_eye(&eyeRBT);
 	glm::mat4 groundRBT = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, g_groundY, 0.0f)) * glm::scale(glm::mat4(1.0f), glm::vec3(g_groundSize, 1.0f, g_groundSize));
 	ground.set_model(&groundRBT);
 
 	//TODO: Initialize model by loading .obj file
-	std::vector<std::pair<std::string, std::string>> shaders = {
-		std::make_pair("PhongVertexShader.glsl", "PhongFragmentShader.glsl"),
-		std::make_pair("ToonVertexShader.glsl", "ToonFragmentShader.glsl"),
-		std::make_pair("FlatVertexShader.glsl", "FlatFragmentShader.glsl")
-	};
+	SHADING_MODEL shading[OBJ_COUNT] = { SHADING_PHONG, SHADING_TOON, SHADING_FLAT };
 
 	init_obj(objects[0], "cat.obj", glm::vec3(0.15, 0.15, 0.15));
 	init_obj(objects[1], "bunny.obj", glm::vec3(0.85, 0.85, 0.85));
@@ -404,7 +466,9 @@ int main(void)
 
 	for (int i = 0; i < OBJ_COUNT; ++i)
 	{
-		objects[i].initialize(DRAW_TYPE::ARRAY, shaders[i].first.c_str(), shaders[i].second.c_str());
+		ShaderPermutation permutation = phong;
+		permutation.shading = shading[i];
+		objects[i].initialize(DRAW_TYPE::ARRAY, LoadShaders("PhongVertexShader.glsl", "PhongFragmentShader.glsl", permutation));
 		objects[i].set_projection(&Projection);
 		objects[i].set_eye(&eyeRBT);
 		objects[i].set_model(&objectRBTs[i]);
@@ -412,12 +476,16 @@ int main(void)
 
 	arcBall = Model();
 	init_sphere(arcBall);
-	arcBall.initialize(DRAW_TYPE::INDEX, "PhongVertexShader.glsl", "PhongFragmentShader.glsl");
+	arcBall.initialize(DRAW_TYPE::INDEX, LoadShaders("PhongVertexShader.glsl", "PhongFragmentShader.glsl", phong));
 
 	arcBall.set_projection(&Projection);
 	arcBall.set_eye(&eyeRBT);
 	arcBall.set_model(&arcballRBT);
 
+	for (int i = 0; i < OBJ_COUNT; ++i)
+		cullList.add(&objects[i]);
+	groundCull = cullList.add(&ground);
+
 	// Setup of lights
 	Light dirLight;
 	dirLight.position = glm::vec4(15.0f, 20.0f, -45.0f, 0.0f);
@@ -472,25 +540,60 @@ int main(void)
 	if (lights.size() != LIGHT_COUNT)
 		std::cout << "Change LIGHT_COUNT." << std::endl;
 
-	// Setting lights
-	numLightsLocs[0] = glGetUniformLocation(ground.GLSLProgramID, "numLights");
-	setLightUniformLocs(lightLocGround, ground);
-	
-	for (int i = 0; i < OBJ_COUNT; ++i)
+	// The extra lights are point lights, spot lights with a 180 degree cone, spread over the
+	// ground on a golden angle spiral and dim enough that the scene does not wash out
+	for (int i = LIGHT_COUNT; i < lightCount; ++i)
 	{
-		numLightsLocs[1+i] = glGetUniformLocation(objects[i].GLSLProgramID, "numLights");
-		setLightUniformLocs(lightLocObjects[i], objects[i]);
+		int n = i - LIGHT_COUNT;
+		float angle = n * 137.5f;
+		float radius = 2.0f + 0.5f * sqrt((float)n);
+		Light light;
+		light.position = glm::vec4(radius * cos(glm::radians(angle)), g_groundY + 0.5f, radius * sin(glm::radians(angle)) - 8.0f, 1.0f);
+		light.color = glm::vec3(0.2f + 0.2f * (n % 5), 0.2f + 0.2f * (n % 3), 0.2f + 0.2f * (n % 7) / 2.0f) * (4.0f / (lightCount - LIGHT_COUNT + 4));
+		light.falloff = 0.5f;
+		light.ambientCoefficient = 0.0f;
+		light.coneAngle = 180.0f;
+		light.coneDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+		lights.push_back(light);
 	}
 
+	// Setting lights
+	GLint maxBlockSize = 0;
+	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+	if ((GLint)(lights.size() * sizeof(LightBlockEntry)) > maxBlockSize)
+		std::cout << lights.size() << " lights do not fit in a uniform block of " << maxBlockSize << " bytes." << std::endl;
+	glGenBuffers(1, &lightBuffer);
+	glState.bind_buffer(GL_UNIFORM_BUFFER, lightBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, lights.size() * sizeof(LightBlockEntry), NULL, GL_DYNAMIC_DRAW);
+	initLightBlock();
+	// glBindBufferRange offsets must be multiples of this
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	dynamicRing.initialize(std::max(64 * 1024, (int)(lights.size() * sizeof(LightBlockEntry)) + uniformAlignment));
+	frameRing = &dynamicRing;
+
+	// Never while benchmarking
+	WatchShaders(watchShaders && !headless.enabled);
+
+	frameScheduler.initialize(0.02, 1.0 / 60.0);
+	// Logged input is replayed frame by frame, so the frames have to be the same length
+	if (headless.enabled || inputLog.active())
+		frameScheduler.set_fixed_frame(headless.frame_seconds(), !headless.enabled);
+	const glm::mat4 startSkyRBT = skyRBT;
 	do {
-		// Clear the screen
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		headless.begin_frame();
+		dynamicRing.begin_frame();
+		if (headless.enabled)
+			skyRBT = headless.camera(startSkyRBT);
 
-		now = glfwGetTime();
+		if (UpdateShaders())
+			initLightBlock();
 
-		if (now - then > 0.02) {
-			then = now;
+		// Clear the screen
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		int steps = frameScheduler.begin_frame();
+		inputLog.begin_frame(window);
+		for (; steps > 0; --steps) {
 			lightMove += 0.02f;
 			// Animate lights
 			lights[0].position.x = cos(lightMove/20) * 50;
@@ -523,24 +626,24 @@ int main(void)
 
 		eyeRBT = (view_index == 0) ? skyRBT : objectRBTs[0];
 
-		// Pass light values to the shader
-		glUseProgram(ground.GLSLProgramID);
-		glUniform1i(numLightsLocs[0], (GLint)lights.size());
-		setLightUniforms(lightLocGround);
+		cullList.cull(Projection, eyeRBT);
+		cullList.report("Shaders with lights");
+
+		// Pass light values to the shaders
+		updateLightBlock();
 
 		for (int i = 0; i < OBJ_COUNT; ++i)
 		{
-			glUseProgram(objects[i].GLSLProgramID);
-			glUniform1i(numLightsLocs[1+i], (GLint)lights.size());
-			setLightUniforms(lightLocObjects[i]);
+			glState.use_program(objects[i].GLSLProgramID);
 
 			// Draw objects
-			objects[i].draw();
+			if (cullList.visible(i))
+				objects[i].draw();
 		}
 		
 
 		// Draw wireframe of arcBall with dynamic radius
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		glState.polygon_mode(GL_LINE);
 		switch (object_index)
 		{
 		case 0:
@@ -554,19 +657,25 @@ int main(void)
 		}
 
 		ScreenToEyeScale = compute_screen_eye_scale(
-			(glm::inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z,
+			(affine_inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z,
 			fovy,
 			frameBufferHeight
 			);
 		arcBallScale = ScreenToEyeScale * arcBallScreenRadius;
 		arcballRBT = arcballRBT * glm::scale(worldRBT, glm::vec3(arcBallScale, arcBallScale, arcBallScale));
 		//arcBall.draw();
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glState.polygon_mode(GL_FILL);
 
-		ground.draw();
+		if (cullList.visible(groundCull))
+			ground.draw();
 		// Swap buffers (Double buffering)
 		glfwSwapBuffers(window);
-		glfwPollEvents();
+		headless.end_frame(window);
+		inputLog.end_frame();
+		frameScheduler.report("Shaders with lights");
+		dynamicRing.end_frame();
+		glState.end_frame();
+		glState.report("Shaders with lights");
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
 		glfwWindowShouldClose(window) == 0);
@@ -578,6 +687,11 @@ int main(void)
 		objects[i].cleanup();
 	}
 
+	glDeleteBuffers(1, &lightBuffer);
+	dynamicRing.cleanup();
+	headless.cleanup();
+	inputLog.cleanup();
+
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
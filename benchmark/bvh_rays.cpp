@@ -0,0 +1,148 @@
+/*
+	Ray picking benchmark: builds a MeshBVH over an OBJ file and times random rays against it.
+	Run from this directory: bvh_rays [file.obj] [number of rays]
+	Only timings of the CMake target, built against GLM 0.9.4, are comparable; no reference
+	figures are kept, measure the build at hand.
+*/
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <cfloat>
+
+// Include GLM
+#include <glm/glm.hpp>
+
+#include <common/bvh.hpp>
+
+static bool load_obj_triangles(const char * path, std::vector<glm::vec3>& vertices, std::vector<unsigned int>& indices)
+{
+	std::ifstream in(path, std::ios::in);
+	if (!in)
+		return false;
+
+	std::string line;
+	while (std::getline(in, line))
+	{
+		if (line.substr(0, 2) == "v ")
+		{
+			std::istringstream s(line.substr(2));
+			glm::vec3 v; s >> v.x; s >> v.y; s >> v.z;
+			vertices.push_back(v);
+		}
+		else if (line.substr(0, 2) == "f ")
+		{
+			// "f a b c" or "f a/t/n b/t/n c/t/n", polygons are fanned
+			std::istringstream s(line.substr(2));
+			std::vector<unsigned int> face;
+			std::string corner;
+			while (s >> corner)
+				face.push_back((unsigned int)atoi(corner.c_str()) - 1);
+			for (size_t i = 2; i < face.size(); ++i)
+			{
+				indices.push_back(face[0]);
+				indices.push_back(face[i - 1]);
+				indices.push_back(face[i]);
+			}
+		}
+	}
+	return !indices.empty();
+}
+
+// Reference: every triangle
+static float brute_force(const std::vector<glm::vec3>& vertices, const std::vector<unsigned int>& indices, const glm::vec3& origin, const glm::vec3& direction)
+{
+	float best = FLT_MAX;
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		glm::vec3 v0 = vertices[indices[i]];
+		glm::vec3 e1 = vertices[indices[i + 1]] - v0;
+		glm::vec3 e2 = vertices[indices[i + 2]] - v0;
+		glm::vec3 p = glm::cross(direction, e2);
+		float det = glm::dot(e1, p);
+		if (fabs(det) < 1e-12f)
+			continue;
+		glm::vec3 s = origin - v0;
+		float u = glm::dot(s, p) / det;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(direction, q) / det;
+		float t = glm::dot(e2, q) / det;
+		if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 1e-6f && t < best)
+			best = t;
+	}
+	return best;
+}
+
+int main(int argc, char * argv[])
+{
+	const char * path = (argc > 1) ? argv[1] : "../4_shaders_with_lights/caroline.obj";
+	int numRays = (argc > 2) ? atoi(argv[2]) : 1000000;
+
+	std::vector<glm::vec3> vertices;
+	std::vector<unsigned int> indices;
+	if (!load_obj_triangles(path, vertices, indices))
+	{
+		printf("Impossible to load %s\n", path);
+		return 1;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	MeshBVH bvh;
+	bvh.build(vertices, indices);
+	double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("%s: %d triangles, %d nodes, built in %.2f ms\n", path, bvh.numTriangles(), bvh.numNodes(), buildMs);
+
+	// Rays from a sphere around the model towards random points inside its bounds
+	glm::vec3 boundsMin = bvh.boundsMin(), boundsMax = bvh.boundsMax();
+	glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+	float radius = glm::length(boundsMax - boundsMin);
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> gauss(0.0f, 1.0f);
+	std::vector<glm::vec3> origins(numRays), directions(numRays);
+	for (int i = 0; i < numRays; ++i)
+	{
+		glm::vec3 onSphere = glm::normalize(glm::vec3(gauss(rng), gauss(rng), gauss(rng)));
+		glm::vec3 target = boundsMin + glm::vec3(unit(rng), unit(rng), unit(rng)) * (boundsMax - boundsMin);
+		origins[i] = center + radius * onSphere;
+		directions[i] = glm::normalize(target - origins[i]);
+	}
+
+	int hits = 0;
+	double sumT = 0.0;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < numRays; ++i)
+	{
+		RayHit hit;
+		if (bvh.intersect(origins[i], directions[i], FLT_MAX, hit))
+		{
+			++hits;
+			sumT += hit.t;
+		}
+	}
+	double traceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("%d rays, %d hits (t sum %.3f) in %.2f ms: %.1f ns/ray, %.2f Mrays/s\n",
+		numRays, hits, sumT, traceMs, 1e6 * traceMs / numRays, numRays / (traceMs * 1e3));
+
+	// Check a few rays against testing every triangle
+	int checked = std::min(numRays, 1000), mismatches = 0;
+	for (int i = 0; i < checked; ++i)
+	{
+		RayHit hit;
+		float t = bvh.intersect(origins[i], directions[i], FLT_MAX, hit) ? hit.t : FLT_MAX;
+		float reference = brute_force(vertices, indices, origins[i], directions[i]);
+		if (fabs(t - reference) > 1e-3f * std::max(1.0f, reference) && !(t == FLT_MAX && reference == FLT_MAX))
+			++mismatches;
+	}
+	printf("%d of %d rays differ from the brute force result\n", mismatches, checked);
+
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+/*
+	Demo benchmark suite: runs each demo headless in named scenarios and collects the frame times
+	(mean, p95, p99) and the draw calls, uniform calls and uploaded bytes per frame that the demos'
+	--stats summary holds (see common/headless.hpp). The results go to a JSON file; with a baseline
+	from an earlier run every scenario is compared against it, and the suite fails when one got
+	slower or busier than the thresholds allow.
+
+	Run from this directory:
+		demo_suite [--bin DIR] [--source DIR] [--only NAME] [--frames N] [--out FILE]
+		           [--baseline FILE] [--update-baseline] [--time-threshold PCT] [--count-threshold PCT]
+		           [--osmesa] [--list]
+
+	--bin holds the demo executables (default: the directory of demo_suite), --source the demo
+	directories, which the demos run in to find their shaders and models (default ..). --only runs
+	the scenarios whose name contains NAME. --frames overrides every scenario's frame count.
+	--update-baseline writes the results to the baseline file instead of comparing. Frame times
+	may grow by --time-threshold percent (default 10), the counts by --count-threshold (default 5).
+
+	Exit status: 0 when every scenario ran and none regressed, 1 otherwise.
+*/
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
+
+struct Scenario {
+	const char* name;
+	const char* demo;       // directory and executable
+	const char* args;
+	int frames;
+};
+
+// The heavy ones run fewer frames, a million snowflakes are a million draw calls per frame
+static const Scenario scenarios[] = {
+	{ "snow-10k", "2d_snow_and_trees", "--flakes 10000", 120 },
+	{ "snow-100k", "2d_snow_and_trees", "--flakes 100000", 30 },
+	{ "snow-1m", "2d_snow_and_trees", "--flakes 1000000", 5 },
+	{ "lights-6", "4_shaders_with_lights", "--lights 6", 300 },
+	{ "lights-64", "4_shaders_with_lights", "--lights 64", 300 },
+	{ "lights-1024", "4_shaders_with_lights", "--lights 1024", 60 },
+	{ "final-program-0", "final", "--program 0 --motion-blur 0", 300 },
+	{ "final-program-0-blur", "final", "--program 0 --motion-blur 1", 300 },
+	{ "final-program-1", "final", "--program 1 --motion-blur 0", 300 },
+	{ "final-program-1-blur", "final", "--program 1 --motion-blur 1", 300 },
+	{ "final-program-2", "final", "--program 2 --motion-blur 0", 300 },
+	{ "final-program-2-blur", "final", "--program 2 --motion-blur 1", 300 },
+	{ "final-program-3", "final", "--program 3 --motion-blur 0", 300 },
+	{ "final-program-3-blur", "final", "--program 3 --motion-blur 1", 300 },
+	{ "floppy-picking", "floppy_cube_with_picking", "--pick-every-frame", 300 },
+};
+static const int NUM_SCENARIOS = sizeof(scenarios) / sizeof(scenarios[0]);
+
+// The metrics of a result, in the order of the JSON; times are compared with the time threshold
+static const char* metrics[] = { "mean_ms", "p95_ms", "p99_ms", "draw_calls", "uniform_calls", "upload_bytes" };
+static const int NUM_METRICS = sizeof(metrics) / sizeof(metrics[0]);
+static const int NUM_TIME_METRICS = 3;
+
+struct Result {
+	std::string name;
+	bool ok;
+	double values[NUM_METRICS];
+};
+
+static bool read_file(const std::string& path, std::string& text)
+{
+	std::ifstream in(path.c_str(), std::ios::in);
+	if (!in)
+		return false;
+	std::stringstream s;
+	s << in.rdbuf();
+	text = s.str();
+	return true;
+}
+
+// The number after "key": in text, which holds one flat JSON object
+static bool json_number(const std::string& text, const char* key, double& value)
+{
+	std::string quoted = std::string("\"") + key + "\"";
+	size_t at = text.find(quoted);
+	if (at == std::string::npos)
+		return false;
+	at = text.find(':', at + quoted.size());
+	if (at == std::string::npos)
+		return false;
+	const char* start = text.c_str() + at + 1;
+	char* end = NULL;
+	value = strtod(start, &end);
+	return end != start;
+}
+
+// The string after "key": in text
+static bool json_string(const std::string& text, const char* key, std::string& value)
+{
+	std::string quoted = std::string("\"") + key + "\"";
+	size_t at = text.find(quoted);
+	if (at == std::string::npos)
+		return false;
+	size_t open = text.find('"', text.find(':', at + quoted.size()));
+	size_t close = text.find('"', open + 1);
+	if (open == std::string::npos || close == std::string::npos)
+		return false;
+	value = text.substr(open + 1, close - open - 1);
+	return true;
+}
+
+// Results as demo_suite writes them: flat objects inside "scenarios"
+static bool read_results(const std::string& path, std::vector<Result>& results)
+{
+	std::string text;
+	if (!read_file(path, text))
+		return false;
+	size_t at = text.find("\"scenarios\"");
+	while (at != std::string::npos)
+	{
+		size_t open = text.find('{', at);
+		size_t close = text.find('}', open);
+		if (open == std::string::npos || close == std::string::npos)
+			break;
+		std::string object = text.substr(open, close - open + 1);
+		Result result;
+		std::string status;
+		if (json_string(object, "name", result.name))
+		{
+			result.ok = json_string(object, "status", status) && status == "ok";
+			for (int m = 0; m < NUM_METRICS; ++m)
+				if (!json_number(object, metrics[m], result.values[m]))
+					result.values[m] = 0.0;
+			results.push_back(result);
+		}
+		at = close + 1;
+	}
+	return true;
+}
+
+static bool write_results(const std::string& path, const std::vector<Result>& results)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		printf("%s could not be opened for writing.\n", path.c_str());
+		return false;
+	}
+	fprintf(file, "{\n\t\"scenarios\": [\n");
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& result = results[i];
+		fprintf(file, "\t\t{ \"name\": \"%s\", \"status\": \"%s\"", result.name.c_str(), result.ok ? "ok" : "failed");
+		if (result.ok)
+			for (int m = 0; m < NUM_METRICS; ++m)
+				fprintf(file, ", \"%s\": %.4f", metrics[m], result.values[m]);
+		fprintf(file, " }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "\t]\n}\n");
+	fclose(file);
+	return true;
+}
+
+static std::string absolute(const std::string& path)
+{
+	bool isAbsolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+	if (isAbsolute)
+		return path;
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		return path;
+	return std::string(cwd) + "/" + path;
+}
+
+static Result run(const Scenario& scenario, const std::string& bin, const std::string& source, int frames, bool osmesa)
+{
+	Result result;
+	result.name = scenario.name;
+	result.ok = false;
+
+	std::string stats = absolute(std::string("demo_suite_") + scenario.name + ".json");
+	std::string log = absolute(std::string("demo_suite_") + scenario.name + ".log");
+	remove(stats.c_str());
+
+	std::ostringstream command;
+#ifdef _WIN32
+	command << "cd /d \"" << source << "/" << scenario.demo << "\" && \"" << bin << "/" << scenario.demo << ".exe\"";
+#else
+	command << "cd \"" << source << "/" << scenario.demo << "\" && \"" << bin << "/" << scenario.demo << "\"";
+#endif
+	command << " --headless --frames " << frames << " --stats \"" << stats << "\"" << (osmesa ? " --osmesa " : " ")
+		<< scenario.args << " > \"" << log << "\" 2>&1";
+
+	printf("%-22s ", scenario.name);
+	fflush(stdout);
+	int status = system(command.str().c_str());
+	std::string text;
+	if (status != 0 || !read_file(stats, text))
+	{
+		printf("failed (exit status %d), see %s\n", status, log.c_str());
+		return result;
+	}
+	result.ok = true;
+	for (int m = 0; m < NUM_METRICS; ++m)
+		if (!json_number(text, metrics[m], result.values[m]))
+			result.values[m] = 0.0;
+	printf("mean %8.3f ms  p95 %8.3f ms  p99 %8.3f ms  %9.0f draws  %9.0f uniforms  %11.0f bytes\n",
+		result.values[0], result.values[1], result.values[2], result.values[3], result.values[4], result.values[5]);
+	remove(stats.c_str());
+	remove(log.c_str());
+	return result;
+}
+
+// Prints the changes against the baseline; true when nothing regressed
+static bool compare(const std::vector<Result>& results, const std::vector<Result>& baseline, double timeThreshold, double countThreshold)
+{
+	bool passed = true;
+	printf("\nAgainst the baseline (time +%.1f%%, counts +%.1f%% allowed):\n", timeThreshold, countThreshold);
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& result = results[i];
+		const Result* base = NULL;
+		for (size_t j = 0; j < baseline.size() && base == NULL; ++j)
+			if (baseline[j].name == result.name)
+				base = &baseline[j];
+
+		if (base == NULL || !base->ok)
+		{
+			printf("%-22s no baseline\n", result.name.c_str());
+			continue;
+		}
+		if (!result.ok)
+		{
+			printf("%-22s FAILED, ran in the baseline\n", result.name.c_str());
+			passed = false;
+			continue;
+		}
+
+		for (int m = 0; m < NUM_METRICS; ++m)
+		{
+			double before = base->values[m], after = result.values[m];
+			double change = before > 0.0 ? 100.0 * (after - before) / before : (after > 0.0 ? 100.0 : 0.0);
+			double threshold = m < NUM_TIME_METRICS ? timeThreshold : countThreshold;
+			bool regressed = change > threshold;
+			if (regressed || change < -threshold)
+				printf("%-22s %-14s %12.3f -> %12.3f  %+7.1f%%%s\n", result.name.c_str(), metrics[m], before, after, change,
+					regressed ? "  REGRESSION" : "");
+			passed = passed && !regressed;
+		}
+	}
+	printf(passed ? "No regressions.\n" : "Regressions found.\n");
+	return passed;
+}
+
+int main(int argc, char * argv[])
+{
+	std::string bin, source = "..", out = "demo_suite.json", baselinePath, only;
+	int frames = 0;
+	double timeThreshold = 10.0, countThreshold = 5.0;
+	bool updateBaseline = false, osmesa = false, list = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (strcmp(arg, "--bin") == 0 && hasValue)
+			bin = argv[++i];
+		else if (strcmp(arg, "--source") == 0 && hasValue)
+			source = argv[++i];
+		else if (strcmp(arg, "--only") == 0 && hasValue)
+			only = argv[++i];
+		else if (strcmp(arg, "--frames") == 0 && hasValue)
+			frames = atoi(argv[++i]);
+		else if (strcmp(arg, "--out") == 0 && hasValue)
+			out = argv[++i];
+		else if (strcmp(arg, "--baseline") == 0 && hasValue)
+			baselinePath = argv[++i];
+		else if (strcmp(arg, "--time-threshold") == 0 && hasValue)
+			timeThreshold = atof(argv[++i]);
+		else if (strcmp(arg, "--count-threshold") == 0 && hasValue)
+			countThreshold = atof(argv[++i]);
+		else if (strcmp(arg, "--update-baseline") == 0)
+			updateBaseline = true;
+		else if (strcmp(arg, "--osmesa") == 0)
+			osmesa = true;
+		else if (strcmp(arg, "--list") == 0)
+			list = true;
+		else
+		{
+			printf("Unknown option %s\n", arg);
+			return 1;
+		}
+	}
+
+	if (list)
+	{
+		for (int i = 0; i < NUM_SCENARIOS; ++i)
+			printf("%-22s %-26s %4d frames  %s\n", scenarios[i].name, scenarios[i].demo, scenarios[i].frames, scenarios[i].args);
+		return 0;
+	}
+
+	// The executables are next to demo_suite unless told otherwise
+	if (bin.empty())
+	{
+		std::string self = argv[0];
+		size_t slash = self.find_last_of("/\\");
+		bin = slash == std::string::npos ? "." : self.substr(0, slash);
+	}
+	bin = absolute(bin);
+	source = absolute(source);
+
+	std::vector<Result> results;
+	for (int i = 0; i < NUM_SCENARIOS; ++i)
+		if (only.empty() || strstr(scenarios[i].name, only.c_str()) != NULL)
+			results.push_back(run(scenarios[i], bin, source, frames > 0 ? frames : scenarios[i].frames, osmesa));
+	if (results.empty())
+	{
+		printf("No scenario matches %s\n", only.c_str());
+		return 1;
+	}
+	if (!write_results(out, results))
+		return 1;
+	printf("Results written to %s\n", out.c_str());
+
+	bool passed = true;
+	for (size_t i = 0; i < results.size(); ++i)
+		passed = passed && results[i].ok;
+
+	if (!baselinePath.empty())
+	{
+		std::vector<Result> baseline;
+		if (updateBaseline)
+		{
+			// Scenarios that were not run keep their old numbers
+			read_results(baselinePath, baseline);
+			for (size_t i = 0; i < results.size(); ++i)
+			{
+				size_t j = 0;
+				while (j < baseline.size() && baseline[j].name != results[i].name)
+					++j;
+				if (j == baseline.size())
+					baseline.push_back(results[i]);
+				else
+					baseline[j] = results[i];
+			}
+			if (!write_results(baselinePath, baseline))
+				return 1;
+			printf("Baseline written to %s\n", baselinePath.c_str());
+		}
+		else if (!read_results(baselinePath, baseline))
+		{
+			printf("%s could not be read.\n", baselinePath.c_str());
+			return 1;
+		}
+		else
+			passed = compare(results, baseline, timeThreshold, countThreshold) && passed;
+	}
+
+	return passed ? 0 : 1;
+}
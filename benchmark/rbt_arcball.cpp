@@ -0,0 +1,106 @@
+/*
+	Arcball transform benchmark: the math the floppy cube's cursor callback does per mouse event,
+	with general 4x4 inverses (transFact/linearFact and glm::inverse) and with RBTs.
+	Run: rbt_arcball [number of events]
+	Only timings of the CMake target, built against GLM 0.9.4, are comparable; no reference
+	figures are kept, measure the build at hand.
+*/
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <common/affine.hpp>
+#include <common/rbt.hpp>
+
+#define NUM_CUBES 9
+
+// Keeps the compiler from dropping the loops
+static float checksum(const glm::mat4* m, int count)
+{
+	float sum = 0.0f;
+	for (int i = 0; i < count; ++i)
+		sum += m[i][3][0] + m[i][3][1] + m[i][3][2] + m[i][0][0];
+	return sum;
+}
+
+int main(int argc, char * argv[])
+{
+	int numEvents = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+	glm::mat4 eyeRBT = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.25f, 6.0f)) * glm::rotate(glm::mat4(1.0f), -10.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+	glm::mat4 start[NUM_CUBES], cubes[NUM_CUBES];
+	for (int i = 0; i < NUM_CUBES; ++i)
+		start[i] = glm::translate(glm::mat4(1.0f), glm::vec3((i % 3) - 1.0f, 1.2f - (i / 3), -1.0f));
+
+	// Small rotations like one mouse move each
+	glm::quat q = glm::angleAxis(0.5f, glm::normalize(glm::vec3(0.3f, 1.0f, 0.1f)));
+
+	// General inverses, as the callbacks did before
+	for (int i = 0; i < NUM_CUBES; ++i)
+		cubes[i] = start[i];
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (int e = 0; e < numEvents; ++e)
+	{
+		glm::mat4 arcEye = glm::inverse(eyeRBT) * cubes[4];
+		glm::mat4 A = transFact(arcEye * cubes[4]) * linearFact(eyeRBT);
+		glm::mat4 Q = glm::toMat4(q);
+		for (int i = 0; i < 3; ++i)
+			cubes[i] = A * Q * glm::inverse(A) * cubes[i];
+	}
+	double generalNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / numEvents;
+	float generalSum = checksum(cubes, NUM_CUBES);
+
+	// RBTs
+	for (int i = 0; i < NUM_CUBES; ++i)
+		cubes[i] = start[i];
+	t0 = std::chrono::steady_clock::now();
+	for (int e = 0; e < numEvents; ++e)
+	{
+		glm::mat4 arcEye = rigid_inverse(eyeRBT) * cubes[4];
+		RBT A = rbt_frame(arcEye * cubes[4], eyeRBT);
+		glm::mat4 M = rbt_conjugate(RBT(q, glm::vec3(0.0f)), A);
+		for (int i = 0; i < 3; ++i)
+			cubes[i] = M * cubes[i];
+	}
+	double rbtNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / numEvents;
+	float rbtSum = checksum(cubes, NUM_CUBES);
+
+	printf("%d events\n", numEvents);
+	printf("glm::inverse:  %.1f ns/event (checksum %.3f)\n", generalNs, generalSum);
+	printf("RBT:           %.1f ns/event (checksum %.3f)\n", rbtNs, rbtSum);
+
+	// Single inverses
+	float acc = 0.0f;
+	t0 = std::chrono::steady_clock::now();
+	for (int e = 0; e < numEvents; ++e)
+	{
+		eyeRBT[3][0] += 1e-7f;
+		acc += glm::inverse(eyeRBT)[3][2];
+	}
+	double inverseNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / numEvents;
+	t0 = std::chrono::steady_clock::now();
+	for (int e = 0; e < numEvents; ++e)
+	{
+		eyeRBT[3][0] += 1e-7f;
+		acc += rigid_inverse(eyeRBT)[3][2];
+	}
+	double rigidNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / numEvents;
+	t0 = std::chrono::steady_clock::now();
+	for (int e = 0; e < numEvents; ++e)
+	{
+		eyeRBT[3][0] += 1e-7f;
+		acc += affine_inverse(eyeRBT)[3][2];
+	}
+	double affineNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / numEvents;
+	printf("inverse of eyeRBT: glm::inverse %.1f ns, rigid_inverse %.1f ns, affine_inverse %.1f ns (%.1f)\n",
+		inverseNs, rigidNs, affineNs, acc);
+
+	return 0;
+}
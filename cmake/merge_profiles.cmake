@@ -0,0 +1,12 @@
+# Merges Clang's raw profiles of the pgo-train run into the default.profdata the PGO build type reads.
+# cmake -DLLVM_PROFDATA=... -DPGO_PROFILE_DIR=... -P merge_profiles.cmake
+file(GLOB raw_profiles ${PGO_PROFILE_DIR}/*.profraw)
+if(NOT raw_profiles)
+	message(FATAL_ERROR "No profiles in ${PGO_PROFILE_DIR}, did the demos run?")
+endif()
+execute_process(
+	COMMAND ${LLVM_PROFDATA} merge -output=${PGO_PROFILE_DIR}/default.profdata ${raw_profiles}
+	RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "llvm-profdata merge failed")
+endif()
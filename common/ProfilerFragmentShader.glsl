@@ -0,0 +1,9 @@
+#version 330 core
+
+in vec3 fragmentColor;
+
+layout(location = 0) out vec4 color;
+
+void main() {
+	color = vec4(fragmentColor, 1);
+}
@@ -0,0 +1,13 @@
+#version 330 core
+
+// The profiler's overlay (common/profiler.hpp), bars already in clip space
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec3 barColor;
+
+out vec3 fragmentColor;
+
+void main() {
+	gl_Position = vec4(position, 0, 1);
+	fragmentColor = barColor;
+}
@@ -0,0 +1,27 @@
+#include <common/affine.hpp>
+
+// TODO: Fill up linearFact function
+glm::mat4 linearFact(glm::mat4 A)
+{
+	glm::mat4 L;
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			L[i][j] = A[i][j];
+		}
+	}
+	L[3][3] = 1.0f;
+	return L;
+}
+
+// TODO: Fill up transFact function
+glm::mat4 transFact(glm::mat4 M)
+{
+	glm::mat4 T = glm::mat4(1.0f);
+	for (int i = 0; i < 3; i++)
+	{
+		T[3][i] = M[3][i];
+	}
+	return T;
+}
@@ -7,8 +7,8 @@
 /*
  * eye_to_screen: mapping eye coordinate to screen coordinate
  */
-inline glm::vec2 eye_to_screen(glm::vec3& eye_coord,
-							   glm::mat4& Projection,
+inline glm::vec2 eye_to_screen(const glm::vec3& eye_coord,
+							   const glm::mat4& Projection,
 							   int frameBufferWidth, int frameBufferHeight)
 {
 	glm::vec2 center = glm::vec2((float)(frameBufferWidth - 1)/2.0f, (float)(frameBufferHeight - 1)/2.0f);
@@ -0,0 +1,430 @@
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <common/bvh.hpp>
+
+// Build parameters
+static const int SAH_BINS = 12;
+static const int MAX_LEAF_SIZE = 16;          // larger leaves are always split, above MAX_STACK_DEPTH
+static const float TRAVERSAL_COST = 1.0f;     // relative to one primitive test
+static const int MAX_STACK_DEPTH = 64;        // nodes this deep are not split, so traversal never overflows
+
+struct BuildPrimitive {
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	glm::vec3 centroid;
+};
+
+static float surface_area(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 d = boundsMax - boundsMin;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static void grow(glm::vec3& boundsMin, glm::vec3& boundsMax, const glm::vec3& pMin, const glm::vec3& pMax)
+{
+	boundsMin = glm::min(boundsMin, pMin);
+	boundsMax = glm::max(boundsMax, pMax);
+}
+
+// Binned SAH build over primitive boxes. order receives the primitives in leaf order.
+static void build_nodes(const std::vector<BuildPrimitive>& prims, std::vector<int>& order, std::vector<BVHNode>& nodes)
+{
+	int n = (int)prims.size();
+	order.resize(n);
+	for (int i = 0; i < n; ++i)
+		order[i] = i;
+
+	nodes.clear();
+	if (n == 0)
+		return;
+	nodes.reserve(2 * n);
+
+	BVHNode root;
+	root.first = 0;
+	root.count = n;
+	nodes.push_back(root);
+
+	// Node and its depth
+	std::vector<std::pair<int, int> > stack(1, std::make_pair(0, 0));
+	while (!stack.empty())
+	{
+		int nodeIndex = stack.back().first;
+		int depth = stack.back().second;
+		stack.pop_back();
+		int first = nodes[nodeIndex].first;
+		int count = nodes[nodeIndex].count;
+
+		glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+		glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+		for (int i = first; i < first + count; ++i)
+		{
+			const BuildPrimitive& prim = prims[order[i]];
+			grow(boundsMin, boundsMax, prim.boundsMin, prim.boundsMax);
+			grow(centroidMin, centroidMax, prim.centroid, prim.centroid);
+		}
+		nodes[nodeIndex].boundsMin = boundsMin;
+		nodes[nodeIndex].boundsMax = boundsMax;
+
+		// A traversal keeps at most one node per level, and one more at the root
+		if (count <= 2 || depth + 1 >= MAX_STACK_DEPTH)
+			continue;
+
+		// Find the cheapest bin boundary over all three axes
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestSplit = 0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.0f)
+				continue;
+			float scale = SAH_BINS / extent;
+
+			int binCount[SAH_BINS] = { 0 };
+			glm::vec3 binMin[SAH_BINS], binMax[SAH_BINS];
+			for (int b = 0; b < SAH_BINS; ++b)
+			{
+				binMin[b] = glm::vec3(FLT_MAX);
+				binMax[b] = glm::vec3(-FLT_MAX);
+			}
+			for (int i = first; i < first + count; ++i)
+			{
+				const BuildPrimitive& prim = prims[order[i]];
+				int b = std::min(SAH_BINS - 1, (int)((prim.centroid[axis] - centroidMin[axis]) * scale));
+				++binCount[b];
+				grow(binMin[b], binMax[b], prim.boundsMin, prim.boundsMax);
+			}
+
+			// Sweep from the right to get the cost of every right side, then from the left
+			float rightArea[SAH_BINS];
+			int rightCount[SAH_BINS];
+			glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+			int sweepCount = 0;
+			for (int b = SAH_BINS - 1; b > 0; --b)
+			{
+				sweepCount += binCount[b];
+				if (binCount[b])
+					grow(sweepMin, sweepMax, binMin[b], binMax[b]);
+				rightCount[b] = sweepCount;
+				rightArea[b] = sweepCount ? surface_area(sweepMin, sweepMax) : 0.0f;
+			}
+			sweepMin = glm::vec3(FLT_MAX);
+			sweepMax = glm::vec3(-FLT_MAX);
+			sweepCount = 0;
+			for (int b = 0; b < SAH_BINS - 1; ++b)
+			{
+				sweepCount += binCount[b];
+				if (binCount[b])
+					grow(sweepMin, sweepMax, binMin[b], binMax[b]);
+				if (sweepCount == 0 || rightCount[b + 1] == 0)
+					continue;
+				float cost = surface_area(sweepMin, sweepMax) * sweepCount + rightArea[b + 1] * rightCount[b + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b + 1;
+				}
+			}
+		}
+
+		// All centroids in one point, nothing to split
+		if (bestAxis < 0)
+			continue;
+
+		float leafCost = (float)count;
+		float splitCost = TRAVERSAL_COST + bestCost / surface_area(boundsMin, boundsMax);
+		if (splitCost >= leafCost && count <= MAX_LEAF_SIZE)
+			continue;
+
+		float scale = SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		float axisMin = centroidMin[bestAxis];
+		int* middle = std::partition(&order[first], &order[first] + count, [&](int index) {
+			int b = std::min(SAH_BINS - 1, (int)((prims[index].centroid[bestAxis] - axisMin) * scale));
+			return b < bestSplit;
+		});
+		int leftCount = (int)(middle - &order[first]);
+		if (leftCount == 0 || leftCount == count)
+			continue;
+
+		int left = (int)nodes.size();
+		BVHNode child;
+		child.first = first;
+		child.count = leftCount;
+		nodes.push_back(child);
+		child.first = first + leftCount;
+		child.count = count - leftCount;
+		nodes.push_back(child);
+
+		nodes[nodeIndex].first = left;
+		nodes[nodeIndex].count = 0;
+		stack.push_back(std::make_pair(left + 1, depth + 1));
+		stack.push_back(std::make_pair(left, depth + 1));
+	}
+}
+
+// Distance to the box along the ray, FLT_MAX when it is missed or farther than tMax
+static inline float intersect_box(const BVHNode& node, const glm::vec3& origin, const glm::vec3& invDirection, float tMax)
+{
+	float tx1 = (node.boundsMin.x - origin.x) * invDirection.x;
+	float tx2 = (node.boundsMax.x - origin.x) * invDirection.x;
+	float tNear = std::min(tx1, tx2), tFar = std::max(tx1, tx2);
+	float ty1 = (node.boundsMin.y - origin.y) * invDirection.y;
+	float ty2 = (node.boundsMax.y - origin.y) * invDirection.y;
+	tNear = std::max(tNear, std::min(ty1, ty2));
+	tFar = std::min(tFar, std::max(ty1, ty2));
+	float tz1 = (node.boundsMin.z - origin.z) * invDirection.z;
+	float tz2 = (node.boundsMax.z - origin.z) * invDirection.z;
+	tNear = std::max(tNear, std::min(tz1, tz2));
+	tFar = std::min(tFar, std::max(tz1, tz2));
+
+	if (tFar >= tNear && tFar > 0.0f && tNear < tMax)
+		return tNear;
+	return FLT_MAX;
+}
+
+void MeshBVH::build(const std::vector<glm::vec3>& vertices, const std::vector<unsigned int>& indices)
+{
+	int numTris = indices.empty() ? (int)vertices.size() / 3 : (int)indices.size() / 3;
+
+	std::vector<BuildPrimitive> prims(numTris);
+	for (int i = 0; i < numTris; ++i)
+	{
+		const glm::vec3& a = vertices[indices.empty() ? 3 * i : indices[3 * i]];
+		const glm::vec3& b = vertices[indices.empty() ? 3 * i + 1 : indices[3 * i + 1]];
+		const glm::vec3& c = vertices[indices.empty() ? 3 * i + 2 : indices[3 * i + 2]];
+		prims[i].boundsMin = glm::min(a, glm::min(b, c));
+		prims[i].boundsMax = glm::max(a, glm::max(b, c));
+		prims[i].centroid = (a + b + c) / 3.0f;
+	}
+
+	build_nodes(prims, triangleIndex, nodes);
+
+	// Store the triangles in leaf order, ready for the intersection test
+	v0.resize(numTris);
+	e1.resize(numTris);
+	e2.resize(numTris);
+	for (int i = 0; i < numTris; ++i)
+	{
+		int t = triangleIndex[i];
+		const glm::vec3& a = vertices[indices.empty() ? 3 * t : indices[3 * t]];
+		const glm::vec3& b = vertices[indices.empty() ? 3 * t + 1 : indices[3 * t + 1]];
+		const glm::vec3& c = vertices[indices.empty() ? 3 * t + 2 : indices[3 * t + 2]];
+		v0[i] = a;
+		e1[i] = b - a;
+		e2[i] = c - a;
+	}
+}
+
+bool MeshBVH::intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, RayHit& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	if (intersect_box(nodes[0], origin, invDirection, tMax) == FLT_MAX)
+		return false;
+
+	float best = tMax, bestU = 0.0f, bestV = 0.0f;
+	int bestTriangle = -1;
+
+	int stack[MAX_STACK_DEPTH];
+	float stackT[MAX_STACK_DEPTH];
+	int sp = 0;
+	int nodeIndex = 0;
+	for (;;)
+	{
+		const BVHNode& node = nodes[nodeIndex];
+		if (node.count > 0)
+		{
+			// Moller-Trumbore
+			for (int i = node.first; i < node.first + node.count; ++i)
+			{
+				glm::vec3 p = glm::cross(direction, e2[i]);
+				float det = glm::dot(e1[i], p);
+				if (std::fabs(det) < 1e-12f)
+					continue;
+				float invDet = 1.0f / det;
+				glm::vec3 s = origin - v0[i];
+				float u = glm::dot(s, p) * invDet;
+				if (u < 0.0f || u > 1.0f)
+					continue;
+				glm::vec3 q = glm::cross(s, e1[i]);
+				float v = glm::dot(direction, q) * invDet;
+				if (v < 0.0f || u + v > 1.0f)
+					continue;
+				float t = glm::dot(e2[i], q) * invDet;
+				if (t > 1e-6f && t < best)
+				{
+					best = t;
+					bestU = u;
+					bestV = v;
+					bestTriangle = i;
+				}
+			}
+		}
+		else
+		{
+			// Visit the nearer child first, keep the other one for later
+			int nearChild = node.first, farChild = node.first + 1;
+			float tNear = intersect_box(nodes[nearChild], origin, invDirection, best);
+			float tFar = intersect_box(nodes[farChild], origin, invDirection, best);
+			if (tFar < tNear)
+			{
+				std::swap(nearChild, farChild);
+				std::swap(tNear, tFar);
+			}
+			if (tNear != FLT_MAX)
+			{
+				if (tFar != FLT_MAX)
+				{
+					assert(sp < MAX_STACK_DEPTH);
+					stack[sp] = farChild;
+					stackT[sp] = tFar;
+					++sp;
+				}
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		// Skip nodes that are behind the nearest hit found since they were pushed
+		while (sp > 0 && stackT[sp - 1] >= best)
+			--sp;
+		if (sp == 0)
+			break;
+		nodeIndex = stack[--sp];
+	}
+
+	if (bestTriangle < 0)
+		return false;
+
+	hit.t = best;
+	hit.triangle = triangleIndex[bestTriangle];
+	hit.u = bestU;
+	hit.v = bestV;
+	hit.position = origin + best * direction;
+	hit.normal = glm::normalize(glm::cross(e1[bestTriangle], e2[bestTriangle]));
+	if (glm::dot(hit.normal, direction) > 0.0f)
+		hit.normal = -hit.normal;
+	hit.instance = -1;
+	hit.objectID = -1;
+	return true;
+}
+
+void SceneBVH::add_instance(const MeshBVH* mesh, const glm::mat4* transform, int objectID)
+{
+	Instance instance;
+	instance.mesh = mesh;
+	instance.transform = transform;
+	instance.objectID = objectID;
+	instances.push_back(instance);
+}
+
+void SceneBVH::clear(void)
+{
+	instances.clear();
+	nodes.clear();
+	instanceIndex.clear();
+}
+
+void SceneBVH::update(void)
+{
+	std::vector<BuildPrimitive> prims(instances.size());
+	for (size_t i = 0; i < instances.size(); ++i)
+	{
+		Instance& instance = instances[i];
+		const glm::mat4& m = *instance.transform;
+		instance.inverse = glm::inverse(m);
+		instance.normalMatrix = glm::transpose(glm::mat3(instance.inverse));
+
+		// World bounds of the transformed mesh bounds
+		glm::vec3 meshMin = instance.mesh->boundsMin(), meshMax = instance.mesh->boundsMax();
+		prims[i].boundsMin = glm::vec3(FLT_MAX);
+		prims[i].boundsMax = glm::vec3(-FLT_MAX);
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			glm::vec3 p((corner & 1) ? meshMax.x : meshMin.x, (corner & 2) ? meshMax.y : meshMin.y, (corner & 4) ? meshMax.z : meshMin.z);
+			glm::vec3 w = glm::vec3(m * glm::vec4(p, 1.0f));
+			grow(prims[i].boundsMin, prims[i].boundsMax, w, w);
+		}
+		prims[i].centroid = 0.5f * (prims[i].boundsMin + prims[i].boundsMax);
+	}
+
+	build_nodes(prims, instanceIndex, nodes);
+}
+
+bool SceneBVH::intersect(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	glm::vec3 invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	float best = FLT_MAX;
+	bool found = false;
+
+	int stack[MAX_STACK_DEPTH];
+	int sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0)
+	{
+		const BVHNode& node = nodes[stack[--sp]];
+		if (intersect_box(node, origin, invDirection, best) == FLT_MAX)
+			continue;
+
+		if (node.count == 0)
+		{
+			assert(sp + 2 <= MAX_STACK_DEPTH);
+			stack[sp++] = node.first + 1;
+			stack[sp++] = node.first;
+			continue;
+		}
+
+		for (int i = node.first; i < node.first + node.count; ++i)
+		{
+			const Instance& instance = instances[instanceIndex[i]];
+
+			// The mesh is tested in its own space; the direction is not normalized so t stays the same
+			glm::vec3 localOrigin = glm::vec3(instance.inverse * glm::vec4(origin, 1.0f));
+			glm::vec3 localDirection = glm::vec3(instance.inverse * glm::vec4(direction, 0.0f));
+
+			RayHit local;
+			if (!instance.mesh->intersect(localOrigin, localDirection, best, local))
+				continue;
+
+			best = local.t;
+			found = true;
+			hit = local;
+			hit.position = origin + local.t * direction;
+			hit.normal = glm::normalize(instance.normalMatrix * local.normal);
+			if (glm::dot(hit.normal, direction) > 0.0f)
+				hit.normal = -hit.normal;
+			hit.instance = instanceIndex[i];
+			hit.objectID = instance.objectID;
+		}
+	}
+	return found;
+}
+
+void screen_ray(double xpos, double ypos, int frameBufferWidth, int frameBufferHeight,
+	const glm::mat4& projection, const glm::mat4& eyeRBT, glm::vec3& origin, glm::vec3& direction)
+{
+	// Pixel center in normalized device coordinates, y points up
+	float x = (float)(2.0 * (xpos + 0.5) / frameBufferWidth - 1.0);
+	float y = (float)(1.0 - 2.0 * (ypos + 0.5) / frameBufferHeight);
+
+	glm::mat4 invProjection = glm::inverse(projection);
+	glm::vec4 nearPoint = invProjection * glm::vec4(x, y, -1.0f, 1.0f);
+	glm::vec4 farPoint = invProjection * glm::vec4(x, y, 1.0f, 1.0f);
+	nearPoint = nearPoint / nearPoint.w;
+	farPoint = farPoint / farPoint.w;
+
+	// Eye space to world space
+	origin = glm::vec3(eyeRBT * nearPoint);
+	direction = glm::normalize(glm::vec3(eyeRBT * farPoint) - origin);
+}
@@ -0,0 +1,72 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// CPU ray picking: a bounding volume hierarchy over a mesh's triangles (MeshBVH) and one over
+// the transformed instances of a scene (SceneBVH). Both are built with binned SAH splits and
+// stored as a flat array of 32 byte nodes, the two children of a node next to each other.
+
+struct RayHit {
+	float t;                // origin + t * direction
+	int triangle;           // index into the mesh's triangles, -1 for no hit
+	float u, v;             // barycentrics, the hit is (1-u-v)*v0 + u*v1 + v*v2
+	glm::vec3 position;     // world space for SceneBVH hits
+	glm::vec3 normal;       // geometric normal, facing the ray origin
+	int instance;           // SceneBVH only, index of the instance that was hit
+	int objectID;           // SceneBVH only, objectID of that instance
+};
+
+struct BVHNode {
+	glm::vec3 boundsMin;
+	int first;              // leaf: first primitive, inner node: left child (right child is first + 1)
+	glm::vec3 boundsMax;
+	int count;              // number of primitives, 0 for inner nodes
+};
+
+class MeshBVH {
+	std::vector<BVHNode> nodes;
+	// Triangles in leaf order
+	std::vector<glm::vec3> v0, e1, e2;
+	std::vector<int> triangleIndex;
+
+public:
+	// indices empty: every three vertices are a triangle (DRAW_TYPE::ARRAY)
+	void build(const std::vector<glm::vec3>& vertices, const std::vector<unsigned int>& indices);
+	// Nearest hit with t in (0, tMax); fills t, triangle, u, v, position and normal in mesh space
+	bool intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, RayHit& hit) const;
+
+	bool empty(void) const { return nodes.empty(); }
+	glm::vec3 boundsMin(void) const { return nodes[0].boundsMin; }
+	glm::vec3 boundsMax(void) const { return nodes[0].boundsMax; }
+	int numNodes(void) const { return (int)nodes.size(); }
+	int numTriangles(void) const { return (int)triangleIndex.size(); }
+};
+
+class SceneBVH {
+	struct Instance {
+		const MeshBVH* mesh;
+		const glm::mat4* transform;
+		int objectID;
+		glm::mat4 inverse;
+		glm::mat3 normalMatrix;
+	};
+	std::vector<Instance> instances;
+	std::vector<BVHNode> nodes;
+	std::vector<int> instanceIndex;
+
+public:
+	// transform is read again by every update(), like Model::set_model
+	void add_instance(const MeshBVH* mesh, const glm::mat4* transform, int objectID);
+	void clear(void);
+	// Call after the transforms changed, rebuilds the top level over the instances' world bounds
+	void update(void);
+	bool intersect(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit) const;
+};
+
+// World space ray through the cursor, (xpos, ypos) in pixels with the origin at the top left
+void screen_ray(double xpos, double ypos, int frameBufferWidth, int frameBufferHeight,
+	const glm::mat4& projection, const glm::mat4& eyeRBT, glm::vec3& origin, glm::vec3& direction);
+
+#endif
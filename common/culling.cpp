@@ -0,0 +1,186 @@
+#include <iostream>
+#include <cmath>
+#include <stdlib.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULL_SSE
+#endif
+
+#include <common/culling.hpp>
+
+Frustum extract_frustum(const glm::mat4& viewProjection)
+{
+	// Rows of the matrix, glm stores columns
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; ++i)
+		row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+	Frustum frustum;
+	frustum.planes[0] = row[3] + row[0];
+	frustum.planes[1] = row[3] - row[0];
+	frustum.planes[2] = row[3] + row[1];
+	frustum.planes[3] = row[3] - row[1];
+	frustum.planes[4] = row[3] + row[2];
+	frustum.planes[5] = row[3] - row[2];
+
+	// Normalized, so the plane equation gives distances
+	for (int i = 0; i < 6; ++i)
+		frustum.planes[i] = frustum.planes[i] * (1.0f / glm::length(glm::vec3(frustum.planes[i])));
+	return frustum;
+}
+
+void cull_bounds(const Frustum& frustum,
+	const float* centerX, const float* centerY, const float* centerZ,
+	const float* extentX, const float* extentY, const float* extentZ,
+	const float* radius, int count, int* visible)
+{
+#if defined(__AVX__)
+	for (int i = 0; i < count; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(centerX + i), cy = _mm256_loadu_ps(centerY + i), cz = _mm256_loadu_ps(centerZ + i);
+		__m256 ex = _mm256_loadu_ps(extentX + i), ey = _mm256_loadu_ps(extentY + i), ez = _mm256_loadu_ps(extentZ + i);
+		__m256 r = _mm256_loadu_ps(radius + i);
+		__m256 outside = _mm256_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+				_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+			__m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(fabs(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(fabs(plane.y)), ey)),
+				_mm256_mul_ps(_mm256_set1_ps(fabs(plane.z)), ez));
+			__m256 rMin = _mm256_min_ps(boxRadius, r);
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(d, rMin), _mm256_setzero_ps(), _CMP_LT_OQ));
+		}
+		int mask = _mm256_movemask_ps(outside);
+		for (int k = 0; k < 8; ++k)
+			visible[i + k] = !((mask >> k) & 1);
+	}
+#elif defined(CULL_SSE)
+	for (int i = 0; i < count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(centerX + i), cy = _mm_loadu_ps(centerY + i), cz = _mm_loadu_ps(centerZ + i);
+		__m128 ex = _mm_loadu_ps(extentX + i), ey = _mm_loadu_ps(extentY + i), ez = _mm_loadu_ps(extentZ + i);
+		__m128 r = _mm_loadu_ps(radius + i);
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+			__m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(fabs(plane.y)), ey)),
+				_mm_mul_ps(_mm_set1_ps(fabs(plane.z)), ez));
+			__m128 rMin = _mm_min_ps(boxRadius, r);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, rMin), _mm_setzero_ps()));
+		}
+		int mask = _mm_movemask_ps(outside);
+		for (int k = 0; k < 4; ++k)
+			visible[i + k] = !((mask >> k) & 1);
+	}
+#else
+	for (int i = 0; i < count; ++i)
+	{
+		visible[i] = 1;
+		for (int p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			float d = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+			float boxRadius = fabs(plane.x) * extentX[i] + fabs(plane.y) * extentY[i] + fabs(plane.z) * extentZ[i];
+			if (d + glm::min(boxRadius, radius[i]) < 0.0f)
+			{
+				visible[i] = 0;
+				break;
+			}
+		}
+	}
+#endif
+}
+
+CullList::CullList()
+{
+	drawn = culled = 0;
+	lastDrawn = lastCulled = -1;
+	verbose = getenv("CULL_VERBOSE") != NULL;
+}
+
+int CullList::add(Model* model)
+{
+	return add(model, NULL);
+}
+
+int CullList::add(Model* model, const glm::mat4* transform)
+{
+	models.push_back(model);
+	transforms.push_back(transform);
+
+	size_t padded = (models.size() + CULL_BATCH - 1) / CULL_BATCH * CULL_BATCH;
+	centerX.resize(padded, 0.0f); centerY.resize(padded, 0.0f); centerZ.resize(padded, 0.0f);
+	extentX.resize(padded, 0.0f); extentY.resize(padded, 0.0f); extentZ.resize(padded, 0.0f);
+	radius.resize(padded, 0.0f);
+	visibleFlags.resize(padded, 1);
+	return (int)models.size() - 1;
+}
+
+void CullList::clear()
+{
+	models.clear();
+	transforms.clear();
+	centerX.clear(); centerY.clear(); centerZ.clear();
+	extentX.clear(); extentY.clear(); extentZ.clear();
+	radius.clear();
+	visibleFlags.clear();
+}
+
+void CullList::cull(const glm::mat4& projection, const glm::mat4& eyeRBT)
+{
+	drawn = culled = 0;
+	if (models.empty())
+		return;
+
+	// Bounds into world space
+	for (size_t i = 0; i < models.size(); ++i)
+	{
+		const Model* model = models[i];
+		const glm::mat4* placement = transforms[i] ? transforms[i] : models[i]->get_model();
+		glm::mat4 transform = placement ? *placement : glm::mat4(1.0f);
+
+		glm::vec3 center = 0.5f * (model->get_bounds_min() + model->get_bounds_max());
+		glm::vec3 extent = 0.5f * (model->get_bounds_max() - model->get_bounds_min());
+		glm::vec4 worldCenter = transform * glm::vec4(center, 1.0f);
+		centerX[i] = worldCenter.x;
+		centerY[i] = worldCenter.y;
+		centerZ[i] = worldCenter.z;
+
+		// Box around the transformed box
+		extentX[i] = fabs(transform[0][0]) * extent.x + fabs(transform[1][0]) * extent.y + fabs(transform[2][0]) * extent.z;
+		extentY[i] = fabs(transform[0][1]) * extent.x + fabs(transform[1][1]) * extent.y + fabs(transform[2][1]) * extent.z;
+		extentZ[i] = fabs(transform[0][2]) * extent.x + fabs(transform[1][2]) * extent.y + fabs(transform[2][2]) * extent.z;
+
+		// Largest scale of the transform
+		float scale2 = glm::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+			glm::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))));
+		radius[i] = model->get_bounds_radius() * sqrt(scale2);
+	}
+
+	Frustum frustum = extract_frustum(projection * glm::inverse(eyeRBT));
+	cull_bounds(frustum, &centerX[0], &centerY[0], &centerZ[0], &extentX[0], &extentY[0], &extentZ[0],
+		&radius[0], (int)centerX.size(), &visibleFlags[0]);
+
+	drawn = 0;
+	for (size_t i = 0; i < models.size(); ++i)
+		drawn += visibleFlags[i];
+	culled = (int)models.size() - drawn;
+}
+
+void CullList::report(const char* name)
+{
+	if (!verbose)
+		return;
+	if (drawn == lastDrawn && culled == lastCulled)
+		return;
+	lastDrawn = drawn;
+	lastCulled = culled;
+	std::cout << name << ": " << drawn << " drawn, " << culled << " culled" << std::endl;
+}
@@ -0,0 +1,68 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include <common/model.hpp>
+
+// View frustum culling of whole models against their bounds (see Model::compute_bounds).
+// Each model is tested with its world space box and sphere at once: a model is culled when
+// it lies outside one of the planes by more than the smaller of the two radii. The tests run
+// four models per iteration with SSE, eight with AVX.
+
+struct Frustum {
+	// Left, right, bottom, top, near, far; xyz points inside, a point p is inside when dot(xyz, p) + w >= 0
+	glm::vec4 planes[6];
+};
+
+// Planes of Projection * inverse(eyeRBT), in world space
+Frustum extract_frustum(const glm::mat4& viewProjection);
+
+// Models to cull every frame. The transforms are read through Model::get_model() by cull(),
+// so the list is set up once:
+//
+//	int ground_i = cullList.add(&ground); ...
+//	cullList.cull(Projection, eyeRBT);
+//	if (cullList.visible(ground_i)) ground.draw();
+class CullList {
+	std::vector<Model*> models;
+	// NULL uses the model's own transform
+	std::vector<const glm::mat4*> transforms;
+	// World space bounds as a structure of arrays, padded to a multiple of the batch size
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+	std::vector<int> visibleFlags;
+	int lastDrawn, lastCulled;
+	bool verbose;
+
+public:
+	int drawn;
+	int culled;
+
+	CullList();
+	// Returns the index to ask visible() with
+	int add(Model* model);
+	// One instance of model, placed by transform instead of the model's own; instanced meshes
+	// add every instance this way rather than keeping a Model per instance
+	int add(Model* model, const glm::mat4* transform);
+	void clear(void);
+	void cull(const glm::mat4& projection, const glm::mat4& eyeRBT);
+	bool visible(int i) const { return visibleFlags[i] != 0; }
+	int size(void) const { return (int)models.size(); }
+	// Prints the drawn/culled counts of the last cull() when they differ from the frame before,
+	// only when verbose: off unless the CULL_VERBOSE environment variable is set or set_verbose(true)
+	void report(const char* name);
+	void set_verbose(bool verbose) { this->verbose = verbose; }
+};
+
+// The batched test: visible[i] = 1 if bounds i intersect the frustum, else 0.
+// count is a multiple of CULL_BATCH, the arrays are as long.
+#define CULL_BATCH 8
+void cull_bounds(const Frustum& frustum,
+	const float* centerX, const float* centerY, const float* centerZ,
+	const float* extentX, const float* extentY, const float* extentZ,
+	const float* radius, int count, int* visible);
+
+#endif
@@ -0,0 +1,107 @@
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include <common/dynamic_resolution.hpp>
+
+// Frames the average settles for after a change, before the next one
+static const int SETTLE_FRAMES = 15;
+
+DynamicResolution::DynamicResolution()
+	: frame(0), smoothedMs(0.0f), framesSinceChange(0), enabled(true), targetMs(16.0f),
+	minScale(0.5f), maxScale(1.0f), step(0.05f), scale(1.0f)
+{
+	for (int i = 0; i < NUM_QUERIES; ++i)
+	{
+		queries[i] = 0;
+		pending[i] = false;
+	}
+}
+
+void DynamicResolution::initialize(float targetMs, float minScale, float maxScale)
+{
+	this->targetMs = targetMs;
+	this->minScale = minScale;
+	this->maxScale = maxScale;
+	scale = maxScale;
+	glGenQueries(NUM_QUERIES, queries);
+}
+
+void DynamicResolution::begin_frame()
+{
+	int q = frame % NUM_QUERIES;
+	// The query is still in flight after NUM_QUERIES frames, skip this frame's measurement
+	if (pending[q])
+		return;
+	glBeginQuery(GL_TIME_ELAPSED, queries[q]);
+}
+
+void DynamicResolution::end_frame()
+{
+	int q = frame % NUM_QUERIES;
+	if (!pending[q])
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		pending[q] = true;
+	}
+	++frame;
+
+	// The oldest results, as far as they are in
+	for (int i = 0; i < NUM_QUERIES; ++i)
+	{
+		int oldest = (frame + i) % NUM_QUERIES;
+		if (!pending[oldest])
+			continue;
+		GLint available = 0;
+		glGetQueryObjectiv(queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[oldest], GL_QUERY_RESULT, &ns);
+		pending[oldest] = false;
+		update((float)ns / 1.0e6f);
+	}
+}
+
+void DynamicResolution::update(float gpuMs)
+{
+	smoothedMs = (smoothedMs <= 0.0f) ? gpuMs : smoothedMs * 0.9f + gpuMs * 0.1f;
+	if (!enabled || ++framesSinceChange < SETTLE_FRAMES)
+		return;
+
+	float next = scale;
+	if (smoothedMs > targetMs)
+		next = step * floorf(scale * sqrtf(targetMs / smoothedMs) / step);
+	else if (smoothedMs < 0.8f * targetMs)
+		next = scale + step;
+	next = (next < minScale) ? minScale : (next > maxScale) ? maxScale : next;
+
+	if (fabsf(next - scale) > 0.001f)
+	{
+		scale = next;
+		framesSinceChange = 0;
+	}
+}
+
+void DynamicResolution::cleanup()
+{
+	if (queries[0] != 0)
+		glDeleteQueries(NUM_QUERIES, queries);
+	for (int i = 0; i < NUM_QUERIES; ++i)
+	{
+		queries[i] = 0;
+		pending[i] = false;
+	}
+}
+
+int DynamicResolution::width(int fullWidth) const
+{
+	int w = (int)(fullWidth * (enabled ? scale : 1.0f) + 0.5f);
+	return w > 0 ? w : 1;
+}
+
+int DynamicResolution::height(int fullHeight) const
+{
+	int h = (int)(fullHeight * (enabled ? scale : 1.0f) + 0.5f);
+	return h > 0 ? h : 1;
+}
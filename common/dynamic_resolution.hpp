@@ -0,0 +1,48 @@
+#ifndef DYNAMIC_RESOLUTION_HPP
+#define DYNAMIC_RESOLUTION_HPP
+
+#include <GL/glew.h>
+
+// Scales the scene's render resolution to hold a GPU frame time budget. The time of each frame
+// is measured with a GL_TIME_ELAPSED query that is read a few frames later, so the controller
+// never waits for the GPU. The cost of a frame goes with its pixel count, the square of scale:
+// over the budget scale drops straight to the size that fits, under it scale grows one step at
+// a time. scale moves in steps, so the size does not change every frame.
+//
+//	dynamicResolution.initialize(12.0f);
+//	do {
+//		dynamicResolution.begin_frame();
+//		int w = dynamicResolution.width(frameBufferWidth); ...
+//		... render at w x h, upscale ...
+//		dynamicResolution.end_frame();
+//	} while (...);
+class DynamicResolution {
+	enum { NUM_QUERIES = 4 };
+	GLuint queries[NUM_QUERIES];
+	bool pending[NUM_QUERIES];
+	int frame;
+	float smoothedMs;
+	int framesSinceChange;
+
+	void update(float gpuMs);
+
+public:
+	bool enabled;
+	float targetMs;
+	float minScale, maxScale, step;
+	float scale;
+
+	DynamicResolution();
+
+	void initialize(float targetMs, float minScale = 0.5f, float maxScale = 1.0f);
+	void begin_frame(void);
+	void end_frame(void);
+	void cleanup(void);
+
+	// Size of the scene for a full size of size, at least 1
+	int width(int fullWidth) const;
+	int height(int fullHeight) const;
+	float frame_ms(void) const { return smoothedMs; }
+};
+
+#endif
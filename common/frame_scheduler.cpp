@@ -0,0 +1,83 @@
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glfw3.h>
+
+#include <common/frame_scheduler.hpp>
+
+FrameScheduler::FrameScheduler()
+	: step(1.0 / 60.0), frameInterval(0.0), fixedFrame(0.0), fixedRealTime(false), maxSteps(5), started(false), lastTime(0.0), nextFrame(0.0),
+	accumulator(0.0), alphaValue(0.0f), windowStart(0.0), idleSeconds(0.0), p50Ms(0.0f), p99Ms(0.0f), idlePercent(0.0f)
+{
+}
+
+void FrameScheduler::initialize(double step, double frameInterval, int maxSteps)
+{
+	this->step = step;
+	this->frameInterval = frameInterval;
+	this->maxSteps = maxSteps;
+	started = false;
+}
+
+int FrameScheduler::begin_frame()
+{
+	double now = glfwGetTime();
+	if (!started)
+	{
+		lastTime = nextFrame = windowStart = now;
+		accumulator = 0.0;
+		idleSeconds = 0.0;
+		frameMs.clear();
+		started = true;
+	}
+
+	// A fixed frame is paced to real time only when asked to, headless runs go flat out
+	double interval = (fixedFrame > 0.0) ? (fixedRealTime ? fixedFrame : 0.0) : frameInterval;
+	if (interval > 0.0)
+	{
+		double waitStart = now;
+		while (now < nextFrame)
+		{
+			glfwWaitEventsTimeout(nextFrame - now);
+			now = glfwGetTime();
+		}
+		idleSeconds += now - waitStart;
+		// More than a frame behind: start over from now rather than rushing to catch up
+		nextFrame = (now - nextFrame > interval) ? now + interval : nextFrame + interval;
+	}
+	glfwPollEvents();
+
+	double realElapsed = now - lastTime;
+	lastTime = now;
+	if (realElapsed > 0.0)
+		frameMs.push_back((float)(realElapsed * 1000.0));
+
+	double elapsed = (fixedFrame > 0.0) ? fixedFrame : realElapsed;
+	accumulator += elapsed;
+	if (accumulator > maxSteps * step)
+		accumulator = maxSteps * step;
+	int steps = (int)(accumulator / step);
+	accumulator -= steps * step;
+	alphaValue = (float)(accumulator / step);
+	return steps;
+}
+
+void FrameScheduler::report(const char* name, double interval)
+{
+	double now = glfwGetTime();
+	double window = now - windowStart;
+	if (window < interval || frameMs.empty())
+		return;
+
+	sortedMs = frameMs;
+	std::sort(sortedMs.begin(), sortedMs.end());
+	p50Ms = sortedMs[sortedMs.size() / 2];
+	p99Ms = sortedMs[std::min(sortedMs.size() - 1, sortedMs.size() * 99 / 100)];
+	idlePercent = (float)(100.0 * idleSeconds / window);
+	std::cout << name << ": frame p50 " << p50Ms << " ms, p99 " << p99Ms << " ms, idle " << (int)idlePercent << "%" << std::endl;
+
+	frameMs.clear();
+	idleSeconds = 0.0;
+	windowStart = now;
+}
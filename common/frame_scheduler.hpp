@@ -0,0 +1,56 @@
+#ifndef FRAME_SCHEDULER_HPP
+#define FRAME_SCHEDULER_HPP
+
+#include <vector>
+
+// Main loop timing: the simulation advances in fixed steps of real time, independent of the
+// frame rate, and frames are rendered between the last two steps (alpha). Until the next frame
+// is due the thread sleeps in glfwWaitEventsTimeout, which also handles the window events, so
+// the loop neither spins on glfwGetTime nor polls only while rendering.
+//
+//	scheduler.initialize(1.0 / 60.0, 1.0 / 120.0);
+//	do {
+//		for (int steps = scheduler.begin_frame(); steps > 0; --steps)
+//			{ previous = current; simulate(current); }
+//		render(mix(previous, current, scheduler.alpha()));
+//		glfwSwapBuffers(window);
+//		scheduler.report("Demo");
+//	} while (...);
+//
+// The statistics cover the frames since the last report: the median and 99th percentile of the
+// time between frames, and the share of it spent waiting.
+class FrameScheduler {
+	double step;
+	double frameInterval;
+	double fixedFrame;
+	bool fixedRealTime;
+	int maxSteps;
+	bool started;
+	double lastTime, nextFrame, accumulator;
+	float alphaValue;
+
+	double windowStart, idleSeconds;
+	std::vector<float> frameMs, sortedMs;
+
+public:
+	float p50Ms, p99Ms, idlePercent;
+
+	FrameScheduler();
+
+	// step: simulated seconds per step. frameInterval: shortest time between frames, 0 leaves
+	// the pace to the swap interval. After a stall at most maxSteps steps are caught up.
+	void initialize(double step, double frameInterval = 0.0, int maxSteps = 5);
+	// Every frame advances the simulation by seconds whatever the clock says, so runs are the
+	// same frame for frame (headless benchmarks, input replay). With realTime the frames are
+	// also paced one per seconds, else they do not wait. 0 follows the clock again.
+	void set_fixed_frame(double seconds, bool realTime = false) { fixedFrame = seconds; fixedRealTime = realTime; }
+	// Waits until the next frame is due, handling events meanwhile; returns the steps to run
+	int begin_frame(void);
+	// How far the frame is from the last step toward the next one, 0 to 1
+	float alpha(void) const { return alphaValue; }
+	double step_seconds(void) const { return step; }
+	// Prints the statistics every interval seconds
+	void report(const char* name, double interval = 5.0);
+};
+
+#endif
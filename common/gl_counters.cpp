@@ -0,0 +1,187 @@
+#include <stdio.h>
+
+#include <common/gl_counters.hpp>
+
+GLCounters glCounters;
+
+// GLEW's entry points from before install()
+static PFNGLDRAWARRAYSINSTANCEDPROC realDrawArraysInstanced;
+static PFNGLDRAWELEMENTSINSTANCEDPROC realDrawElementsInstanced;
+static PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC realDrawElementsInstancedBaseVertex;
+static PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEPROC realDrawElementsInstancedBaseVertexBaseInstance;
+static PFNGLMULTIDRAWELEMENTSINDIRECTPROC realMultiDrawElementsIndirect;
+static PFNGLUNIFORM1FPROC realUniform1f;
+static PFNGLUNIFORM1IPROC realUniform1i;
+static PFNGLUNIFORM1UIPROC realUniform1ui;
+static PFNGLUNIFORM2FPROC realUniform2f;
+static PFNGLUNIFORM3FPROC realUniform3f;
+static PFNGLUNIFORM3FVPROC realUniform3fv;
+static PFNGLUNIFORM4FVPROC realUniform4fv;
+static PFNGLUNIFORMMATRIX4FVPROC realUniformMatrix4fv;
+static PFNGLPROGRAMUNIFORM4FVPROC realProgramUniform4fv;
+static PFNGLVERTEXATTRIB4FVPROC realVertexAttrib4fv;
+static PFNGLBUFFERDATAPROC realBufferData;
+static PFNGLBUFFERSUBDATAPROC realBufferSubData;
+
+static void GLAPIENTRY counted_draw_arrays_instanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+	++glCounters.current.drawCalls;
+	realDrawArraysInstanced(mode, first, count, instances);
+}
+
+static void GLAPIENTRY counted_draw_elements_instanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances)
+{
+	++glCounters.current.drawCalls;
+	realDrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+static void GLAPIENTRY counted_draw_elements_instanced_base_vertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances, GLint baseVertex)
+{
+	++glCounters.current.drawCalls;
+	realDrawElementsInstancedBaseVertex(mode, count, type, indices, instances, baseVertex);
+}
+
+static void GLAPIENTRY counted_draw_elements_instanced_base_vertex_base_instance(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances, GLint baseVertex, GLuint baseInstance)
+{
+	++glCounters.current.drawCalls;
+	realDrawElementsInstancedBaseVertexBaseInstance(mode, count, type, indices, instances, baseVertex, baseInstance);
+}
+
+// One call, however many draws the indirect buffer holds: the count is of CPU side calls
+static void GLAPIENTRY counted_multi_draw_elements_indirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride)
+{
+	++glCounters.current.drawCalls;
+	realMultiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+}
+
+static void GLAPIENTRY counted_uniform1f(GLint location, GLfloat v0)
+{
+	++glCounters.current.uniformCalls;
+	realUniform1f(location, v0);
+}
+
+static void GLAPIENTRY counted_uniform1i(GLint location, GLint v0)
+{
+	++glCounters.current.uniformCalls;
+	realUniform1i(location, v0);
+}
+
+static void GLAPIENTRY counted_uniform1ui(GLint location, GLuint v0)
+{
+	++glCounters.current.uniformCalls;
+	realUniform1ui(location, v0);
+}
+
+static void GLAPIENTRY counted_uniform2f(GLint location, GLfloat v0, GLfloat v1)
+{
+	++glCounters.current.uniformCalls;
+	realUniform2f(location, v0, v1);
+}
+
+static void GLAPIENTRY counted_uniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+	++glCounters.current.uniformCalls;
+	realUniform3f(location, v0, v1, v2);
+}
+
+static void GLAPIENTRY counted_uniform3fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	++glCounters.current.uniformCalls;
+	realUniform3fv(location, count, value);
+}
+
+static void GLAPIENTRY counted_uniform4fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	++glCounters.current.uniformCalls;
+	realUniform4fv(location, count, value);
+}
+
+static void GLAPIENTRY counted_uniform_matrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	++glCounters.current.uniformCalls;
+	realUniformMatrix4fv(location, count, transpose, value);
+}
+
+static void GLAPIENTRY counted_program_uniform4fv(GLuint program, GLint location, GLsizei count, const GLfloat* value)
+{
+	++glCounters.current.uniformCalls;
+	realProgramUniform4fv(program, location, count, value);
+}
+
+// Constant vertex attributes stand in for per draw uniforms, see Model::bind_single_instance
+static void GLAPIENTRY counted_vertex_attrib4fv(GLuint index, const GLfloat* value)
+{
+	++glCounters.current.uniformCalls;
+	realVertexAttrib4fv(index, value);
+}
+
+static void GLAPIENTRY counted_buffer_data(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+	// Allocations without data upload nothing
+	if (data != NULL)
+		glCounters.current.uploadBytes += size;
+	realBufferData(target, size, data, usage);
+}
+
+static void GLAPIENTRY counted_buffer_sub_data(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	glCounters.current.uploadBytes += size;
+	realBufferSubData(target, offset, size, data);
+}
+
+// Puts wrapper in place of the entry point GLEW loaded into pointer, keeping the original in real.
+// Entry points the driver does not have stay NULL.
+template <typename Proc>
+static void wrap(Proc& pointer, Proc& real, Proc wrapper)
+{
+	if (pointer == NULL || pointer == wrapper)
+		return;
+	real = pointer;
+	pointer = wrapper;
+}
+
+GLCounters::GLCounters() : isInstalled(false)
+{
+	current.drawCalls = 0;
+	current.uniformCalls = 0;
+	current.uploadBytes = 0;
+}
+
+bool GLCounters::install()
+{
+	if (isInstalled)
+		return true;
+	if (__glewUniform1f == NULL || __glewBufferData == NULL)
+	{
+		printf("GLCounters: GLEW is not initialized\n");
+		return false;
+	}
+	wrap(__glewDrawArraysInstanced, realDrawArraysInstanced, counted_draw_arrays_instanced);
+	wrap(__glewDrawElementsInstanced, realDrawElementsInstanced, counted_draw_elements_instanced);
+	wrap(__glewDrawElementsInstancedBaseVertex, realDrawElementsInstancedBaseVertex, counted_draw_elements_instanced_base_vertex);
+	wrap(__glewDrawElementsInstancedBaseVertexBaseInstance, realDrawElementsInstancedBaseVertexBaseInstance, counted_draw_elements_instanced_base_vertex_base_instance);
+	wrap(__glewMultiDrawElementsIndirect, realMultiDrawElementsIndirect, counted_multi_draw_elements_indirect);
+	wrap(__glewUniform1f, realUniform1f, counted_uniform1f);
+	wrap(__glewUniform1i, realUniform1i, counted_uniform1i);
+	wrap(__glewUniform1ui, realUniform1ui, counted_uniform1ui);
+	wrap(__glewUniform2f, realUniform2f, counted_uniform2f);
+	wrap(__glewUniform3f, realUniform3f, counted_uniform3f);
+	wrap(__glewUniform3fv, realUniform3fv, counted_uniform3fv);
+	wrap(__glewUniform4fv, realUniform4fv, counted_uniform4fv);
+	wrap(__glewUniformMatrix4fv, realUniformMatrix4fv, counted_uniform_matrix4fv);
+	wrap(__glewProgramUniform4fv, realProgramUniform4fv, counted_program_uniform4fv);
+	wrap(__glewVertexAttrib4fv, realVertexAttrib4fv, counted_vertex_attrib4fv);
+	wrap(__glewBufferData, realBufferData, counted_buffer_data);
+	wrap(__glewBufferSubData, realBufferSubData, counted_buffer_sub_data);
+	isInstalled = true;
+	return true;
+}
+
+GLCounters::Counts GLCounters::end_frame()
+{
+	Counts counts = current;
+	current.drawCalls = 0;
+	current.uniformCalls = 0;
+	current.uploadBytes = 0;
+	return counts;
+}
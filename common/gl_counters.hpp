@@ -0,0 +1,43 @@
+#ifndef GL_COUNTERS_HPP
+#define GL_COUNTERS_HPP
+
+#include <GL/glew.h>
+
+// Per frame counts of the GL calls that cost CPU time in the demos: draw calls, uniform calls and
+// bytes uploaded to buffers. install() puts counting wrappers in place of GLEW's entry points of
+// the instanced and indirect draws, the glUniform* the demos use, glVertexAttrib4fv (per draw
+// constants like uniforms) and glBufferData/SubData, so the call sites stay as they are. It is
+// meant for benchmark runs (Headless --stats); without it only the calls below and the
+// persistent RingBuffer copies are counted.
+//
+// glDrawArrays and glDrawElements are GL 1.1 and linked directly rather than loaded by GLEW, so
+// they cannot be wrapped; files that call them include this header, whose macros count them.
+class GLCounters {
+public:
+	struct Counts {
+		int drawCalls;
+		int uniformCalls;
+		long long uploadBytes;
+	};
+
+	// The frame so far
+	Counts current;
+
+	GLCounters();
+
+	// After glewInit; false when GLEW did not load one of the wrapped functions
+	bool install(void);
+	bool installed(void) const { return isInstalled; }
+	// The counts of the frame that ends, and starts the next one from 0
+	Counts end_frame(void);
+
+private:
+	bool isInstalled;
+};
+
+extern GLCounters glCounters;
+
+#define glDrawArrays(mode, first, count) (++glCounters.current.drawCalls, glDrawArrays(mode, first, count))
+#define glDrawElements(mode, count, type, indices) (++glCounters.current.drawCalls, glDrawElements(mode, count, type, indices))
+
+#endif
@@ -0,0 +1,359 @@
+#include <iostream>
+#include <stdlib.h>
+
+#include <GL/glew.h>
+
+#include <common/gl_state.hpp>
+
+GLStateCache glState;
+
+// Marks a cached value as not known
+static const GLuint UNKNOWN = ~0u;
+
+GLStateCache::GLStateCache()
+	: issuedCount(0), elidedCount(0), lastIssued(0), lastElided(0), reportedIssued(-1), reportedElided(-1), verbose(getenv("GL_STATE_VERBOSE") != NULL)
+{
+	invalidate();
+}
+
+void GLStateCache::invalidate()
+{
+	vertexArrays.clear();
+	for (int i = 0; i < MAX_ATTRIBS; ++i)
+		attribValueKnown[i] = false;
+	program = UNKNOWN;
+	vertexArray = UNKNOWN;
+	arrayBuffer = pixelPackBuffer = drawIndirectBuffer = uniformBuffer = UNKNOWN;
+	drawFramebuffer = readFramebuffer = UNKNOWN;
+	activeUnit = UNKNOWN;
+	for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+		textures2D[i] = texturesCube[i] = UNKNOWN;
+	for (int i = 0; i < 4; ++i)
+		caps[i] = -1;
+	blendSrc = blendDst = depthFunc = polygonMode = UNKNOWN;
+	depthMask = -1;
+}
+
+GLStateCache::VertexArray* GLStateCache::current_vertex_array()
+{
+	if (vertexArray == UNKNOWN)
+		return NULL;
+	if (vertexArray >= vertexArrays.size())
+	{
+		VertexArray unknown;
+		unknown.known = false;
+		vertexArrays.resize(vertexArray + 1, unknown);
+	}
+	VertexArray& va = vertexArrays[vertexArray];
+	if (!va.known)
+	{
+		for (int i = 0; i < MAX_ATTRIBS; ++i)
+		{
+			va.attribs[i].known = false;
+			va.attribs[i].enabled = -1;
+			va.attribs[i].divisor = UNKNOWN;
+		}
+		va.elementBuffer = UNKNOWN;
+		va.known = true;
+	}
+	return &va;
+}
+
+GLuint* GLStateCache::buffer_slot(GLenum target)
+{
+	switch (target)
+	{
+	case GL_ARRAY_BUFFER: return &arrayBuffer;
+	case GL_PIXEL_PACK_BUFFER: return &pixelPackBuffer;
+	case GL_DRAW_INDIRECT_BUFFER: return &drawIndirectBuffer;
+	case GL_UNIFORM_BUFFER: return &uniformBuffer;
+	case GL_ELEMENT_ARRAY_BUFFER:
+	{
+		VertexArray* va = current_vertex_array();
+		return va ? &va->elementBuffer : NULL;
+	}
+	default: return NULL;
+	}
+}
+
+void GLStateCache::use_program(GLuint program)
+{
+	if (check(this->program != program))
+	{
+		glUseProgram(program);
+		this->program = program;
+	}
+}
+
+GLuint GLStateCache::current_program()
+{
+	if (program == UNKNOWN)
+	{
+		GLint current = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+		program = (GLuint)current;
+	}
+	return program;
+}
+
+void GLStateCache::bind_vertex_array(GLuint vertexArray)
+{
+	if (check(this->vertexArray != vertexArray))
+	{
+		glBindVertexArray(vertexArray);
+		this->vertexArray = vertexArray;
+	}
+}
+
+void GLStateCache::bind_buffer(GLenum target, GLuint buffer)
+{
+	GLuint* slot = buffer_slot(target);
+	if (check(slot == NULL || *slot != buffer))
+	{
+		glBindBuffer(target, buffer);
+		if (slot != NULL)
+			*slot = buffer;
+	}
+}
+
+void GLStateCache::bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	check(true);
+	glBindBufferRange(target, index, buffer, offset, size);
+	GLuint* slot = buffer_slot(target);
+	if (slot != NULL)
+		*slot = buffer;
+}
+
+void GLStateCache::vertex_attrib(GLuint index, GLuint buffer, GLint size, GLsizei stride, GLintptr offset, GLuint divisor)
+{
+	VertexArray* va = current_vertex_array();
+	if (va == NULL || index >= MAX_ATTRIBS)
+	{
+		issuedCount += 4;
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		arrayBuffer = buffer;
+		glEnableVertexAttribArray(index);
+		glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, stride, (GLvoid*)offset);
+		glVertexAttribDivisor(index, divisor);
+		return;
+	}
+
+	Attrib& a = va->attribs[index];
+	if (check(a.enabled != 1))
+	{
+		glEnableVertexAttribArray(index);
+		a.enabled = 1;
+	}
+	if (check(!a.known || a.buffer != buffer || a.size != size || a.stride != stride || a.offset != offset))
+	{
+		bind_buffer(GL_ARRAY_BUFFER, buffer);
+		glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, stride, (GLvoid*)offset);
+		a.buffer = buffer;
+		a.size = size;
+		a.stride = stride;
+		a.offset = offset;
+		a.known = true;
+	}
+	if (check(a.divisor != divisor))
+	{
+		glVertexAttribDivisor(index, divisor);
+		a.divisor = divisor;
+	}
+}
+
+void GLStateCache::disable_vertex_attrib(GLuint index)
+{
+	VertexArray* va = current_vertex_array();
+	if (va == NULL || index >= MAX_ATTRIBS)
+	{
+		++issuedCount;
+		glDisableVertexAttribArray(index);
+		return;
+	}
+	Attrib& a = va->attribs[index];
+	if (check(a.enabled != 0))
+	{
+		glDisableVertexAttribArray(index);
+		a.enabled = 0;
+	}
+}
+
+void GLStateCache::vertex_attrib_value(GLuint index, const GLfloat* value)
+{
+	if (index >= MAX_ATTRIBS)
+	{
+		++issuedCount;
+		glVertexAttrib4fv(index, value);
+		return;
+	}
+	GLfloat* current = attribValues[index];
+	if (check(!attribValueKnown[index] || current[0] != value[0] || current[1] != value[1] || current[2] != value[2] || current[3] != value[3]))
+	{
+		glVertexAttrib4fv(index, value);
+		for (int i = 0; i < 4; ++i)
+			current[i] = value[i];
+		attribValueKnown[index] = true;
+	}
+}
+
+void GLStateCache::active_texture(GLuint unit)
+{
+	if (check(activeUnit != unit))
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		activeUnit = unit;
+	}
+}
+
+void GLStateCache::bind_texture(GLuint unit, GLenum target, GLuint texture)
+{
+	GLuint* slot = NULL;
+	if (unit < MAX_TEXTURE_UNITS)
+	{
+		if (target == GL_TEXTURE_2D)
+			slot = &textures2D[unit];
+		else if (target == GL_TEXTURE_CUBE_MAP)
+			slot = &texturesCube[unit];
+	}
+	if (check(slot == NULL || *slot != texture))
+	{
+		active_texture(unit);
+		glBindTexture(target, texture);
+		if (slot != NULL)
+			*slot = texture;
+	}
+}
+
+int* GLStateCache::cap_slot(GLenum cap)
+{
+	switch (cap)
+	{
+	case GL_BLEND: return &caps[0];
+	case GL_DEPTH_TEST: return &caps[1];
+	case GL_CULL_FACE: return &caps[2];
+	case GL_SCISSOR_TEST: return &caps[3];
+	}
+	return NULL;
+}
+
+void GLStateCache::enable(GLenum cap, bool enabled)
+{
+	int* slot = cap_slot(cap);
+	if (check(slot == NULL || *slot != (int)enabled))
+	{
+		if (enabled)
+			glEnable(cap);
+		else
+			glDisable(cap);
+		if (slot != NULL)
+			*slot = enabled;
+	}
+}
+
+bool GLStateCache::is_enabled(GLenum cap)
+{
+	int* slot = cap_slot(cap);
+	if (slot == NULL)
+		return glIsEnabled(cap) == GL_TRUE;
+	if (*slot < 0)
+		*slot = glIsEnabled(cap) == GL_TRUE;
+	return *slot == 1;
+}
+
+void GLStateCache::blend_func(GLenum src, GLenum dst)
+{
+	if (check(blendSrc != src || blendDst != dst))
+	{
+		glBlendFunc(src, dst);
+		blendSrc = src;
+		blendDst = dst;
+	}
+}
+
+void GLStateCache::depth_func(GLenum func)
+{
+	if (check(depthFunc != func))
+	{
+		glDepthFunc(func);
+		depthFunc = func;
+	}
+}
+
+void GLStateCache::depth_mask(bool enabled)
+{
+	if (check(depthMask != (int)enabled))
+	{
+		glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+		depthMask = enabled;
+	}
+}
+
+void GLStateCache::polygon_mode(GLenum mode)
+{
+	if (check(polygonMode != mode))
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+		polygonMode = mode;
+	}
+}
+
+void GLStateCache::bind_framebuffer(GLenum target, GLuint framebuffer)
+{
+	bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+	bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+	if (check((draw && drawFramebuffer != framebuffer) || (read && readFramebuffer != framebuffer)))
+	{
+		glBindFramebuffer(target, framebuffer);
+		if (draw)
+			drawFramebuffer = framebuffer;
+		if (read)
+			readFramebuffer = framebuffer;
+	}
+}
+
+void GLStateCache::delete_vertex_array(GLuint vertexArray)
+{
+	if (vertexArray < vertexArrays.size())
+		vertexArrays[vertexArray].known = false;
+	if (this->vertexArray == vertexArray)
+		this->vertexArray = 0;
+}
+
+void GLStateCache::delete_buffer(GLuint buffer)
+{
+	// GL unbinds a deleted buffer from the current bindings only
+	GLuint* slots[] = { &arrayBuffer, &pixelPackBuffer, &drawIndirectBuffer, &uniformBuffer };
+	for (int i = 0; i < 4; ++i)
+		if (*slots[i] == buffer)
+			*slots[i] = 0;
+	for (size_t v = 0; v < vertexArrays.size(); ++v)
+	{
+		VertexArray& va = vertexArrays[v];
+		if (!va.known)
+			continue;
+		if (va.elementBuffer == buffer)
+			va.elementBuffer = (v == vertexArray) ? 0 : UNKNOWN;
+		for (int i = 0; i < MAX_ATTRIBS; ++i)
+			if (va.attribs[i].known && va.attribs[i].buffer == buffer)
+				va.attribs[i].known = false;
+	}
+}
+
+void GLStateCache::end_frame()
+{
+	lastIssued = issuedCount;
+	lastElided = elidedCount;
+	issuedCount = elidedCount = 0;
+}
+
+void GLStateCache::report(const char* name)
+{
+	if (!verbose)
+		return;
+	if (lastIssued == reportedIssued && lastElided == reportedElided)
+		return;
+	reportedIssued = lastIssued;
+	reportedElided = lastElided;
+	std::cout << name << ": " << lastIssued << " state changes issued, " << lastElided << " elided" << std::endl;
+}
@@ -0,0 +1,106 @@
+#ifndef GL_STATE_HPP
+#define GL_STATE_HPP
+
+#include <vector>
+#include <GL/glew.h>
+
+// Shadow copy of the GL state the demos change while drawing: program, vertex array and its
+// attributes, buffer bindings, texture units, blend/depth/cull/scissor, polygon mode and the
+// framebuffer. Every call compares against the copy and only reaches GL when the value
+// changes; issued and elided calls are counted per frame.
+//
+// The copy is only right while all changes of that state go through glState. Call invalidate()
+// after code that bypasses it (texture loading, third party code), which makes the next call
+// of every kind reach GL again.
+class GLStateCache {
+public:
+	enum { MAX_ATTRIBS = 16, MAX_TEXTURE_UNITS = 16 };
+
+private:
+	struct Attrib {
+		GLuint buffer;
+		GLint size;
+		GLsizei stride;
+		GLintptr offset;
+		bool known;             // buffer, size, stride and offset
+		int enabled;            // -1 unknown
+		GLuint divisor;
+	};
+	struct VertexArray {
+		Attrib attribs[MAX_ATTRIBS];
+		GLuint elementBuffer;
+		bool known;
+	};
+	std::vector<VertexArray> vertexArrays;  // by name, 0 included
+	// Current generic attribute values, context state like GL keeps them, not per vertex array
+	GLfloat attribValues[MAX_ATTRIBS][4];
+	bool attribValueKnown[MAX_ATTRIBS];
+
+	GLuint program;
+	GLuint vertexArray;
+	GLuint arrayBuffer, pixelPackBuffer, drawIndirectBuffer, uniformBuffer;
+	GLuint drawFramebuffer, readFramebuffer;
+	GLuint activeUnit;
+	GLuint textures2D[MAX_TEXTURE_UNITS], texturesCube[MAX_TEXTURE_UNITS];
+	int caps[4];                            // GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_SCISSOR_TEST; -1 unknown
+	GLenum blendSrc, blendDst, depthFunc, polygonMode;
+	int depthMask;
+
+	int issuedCount, elidedCount;
+	int lastIssued, lastElided;
+	int reportedIssued, reportedElided;
+	bool verbose;
+
+	VertexArray* current_vertex_array(void);   // NULL when the bound one is not known
+	GLuint* buffer_slot(GLenum target);
+	int* cap_slot(GLenum cap);                 // NULL for the caps that are not tracked
+	void active_texture(GLuint unit);
+	bool check(bool changed) { if (changed) ++issuedCount; else ++elidedCount; return changed; }
+
+public:
+	GLStateCache();
+
+	void use_program(GLuint program);
+	// The bound program, asking GL only when it was bound around the cache
+	GLuint current_program(void);
+	void bind_vertex_array(GLuint vertexArray);
+	// GL_ELEMENT_ARRAY_BUFFER is tracked per vertex array, like GL does
+	void bind_buffer(GLenum target, GLuint buffer);
+	// glBindBufferRange; only the generic binding it also changes is tracked, it is always issued
+	void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	// Enables the attribute and points it at buffer, always float data, not normalized
+	void vertex_attrib(GLuint index, GLuint buffer, GLint size, GLsizei stride, GLintptr offset, GLuint divisor = 0);
+	void disable_vertex_attrib(GLuint index);
+	// The constant value (glVertexAttrib4fv) an attribute has while its array is disabled
+	void vertex_attrib_value(GLuint index, const GLfloat* value);
+	void bind_texture(GLuint unit, GLenum target, GLuint texture);
+	void enable(GLenum cap, bool enabled);
+	// Whether cap is enabled, asking GL only when it is not known
+	bool is_enabled(GLenum cap);
+	void blend_func(GLenum src, GLenum dst);
+	void depth_func(GLenum func);
+	void depth_mask(bool enabled);
+	// GL_FRONT_AND_BACK
+	void polygon_mode(GLenum mode);
+	// GL_FRAMEBUFFER binds both the draw and the read framebuffer
+	void bind_framebuffer(GLenum target, GLuint framebuffer);
+
+	// Forgets everything; GL is not touched
+	void invalidate(void);
+	// Names are reused after glDelete*, so deleting must forget them
+	void delete_vertex_array(GLuint vertexArray);
+	void delete_buffer(GLuint buffer);
+
+	// Ends the counting for one frame
+	void end_frame(void);
+	int issued(void) const { return lastIssued; }
+	int elided(void) const { return lastElided; }
+	// Prints the counts of the last frame when they changed, only when verbose: off unless the
+	// GL_STATE_VERBOSE environment variable is set or set_verbose(true) was called
+	void report(const char* name);
+	void set_verbose(bool verbose) { this->verbose = verbose; }
+};
+
+extern GLStateCache glState;
+
+#endif
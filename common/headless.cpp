@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+#include <common/headless.hpp>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+Headless::Headless()
+	: fbo(0), colorBuffer(0), depthBuffer(0), width(0), height(0), frame(0), frameStart(0.0),
+	enabled(false), osmesa(false), frames(300), captureEvery(0)
+{
+}
+
+void Headless::parse(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (strcmp(arg, "--headless") == 0)
+			enabled = true;
+		else if (strcmp(arg, "--osmesa") == 0)
+			osmesa = true;
+		else if (strcmp(arg, "--frames") == 0 && hasValue)
+			frames = std::max(atoi(argv[++i]), 1);
+		else if (strcmp(arg, "--timings") == 0 && hasValue)
+			timingsPath = argv[++i];
+		else if (strcmp(arg, "--stats") == 0 && hasValue)
+			statsPath = argv[++i];
+		else if (strcmp(arg, "--capture") == 0 && hasValue)
+			capturePrefix = argv[++i];
+		else if (strcmp(arg, "--capture-every") == 0 && hasValue)
+			captureEvery = std::max(atoi(argv[++i]), 0);
+		// Anything else belongs to another parser (InputLog)
+	}
+}
+
+bool Headless::init_hints()
+{
+	if (!enabled)
+		return true;
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 4)
+	// No display server at all; the context comes from EGL or OSMesa below
+	glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+#if GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR < 3
+	if (osmesa)
+	{
+		printf("--osmesa needs GLFW 3.3, this is %d.%d\n", GLFW_VERSION_MAJOR, GLFW_VERSION_MINOR);
+		return false;
+	}
+#endif
+#ifdef __linux__
+	// Older GLFW only hides the window, which still needs a display server
+	if (getenv("DISPLAY") == NULL && getenv("WAYLAND_DISPLAY") == NULL)
+	{
+		printf("--headless needs GLFW 3.4 to run without a display server, this is %d.%d\n", GLFW_VERSION_MAJOR, GLFW_VERSION_MINOR);
+		return false;
+	}
+#endif
+#endif
+	return true;
+}
+
+void Headless::window_hints()
+{
+	if (!enabled)
+		return;
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 3)
+	glfwWindowHint(GLFW_CONTEXT_CREATION_API, osmesa ? GLFW_OSMESA_CONTEXT_API : GLFW_EGL_CONTEXT_API);
+#endif
+}
+
+bool Headless::initialize(int width, int height)
+{
+	if (!enabled)
+		return true;
+	this->width = width > 0 ? width : 1;
+	this->height = height > 0 ? height : 1;
+
+	glGenRenderbuffers(1, &colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, this->width, this->height);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, this->width, this->height);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Headless framebuffer is incomplete\n");
+		return false;
+	}
+	glViewport(0, 0, this->width, this->height);
+
+	// Frames as fast as they render, the swap only ends them
+	glfwSwapInterval(0);
+	if (!statsPath.empty())
+		glCounters.install();
+	std::cout << "Headless: " << frames << " frames at " << this->width << "x" << this->height
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 3)
+		<< (osmesa ? " (OSMesa)" : " (EGL)")
+#else
+		<< " (hidden window, the platform's context)"
+#endif
+		<< std::endl;
+	frameStart = glfwGetTime();
+	return true;
+}
+
+void Headless::cleanup()
+{
+	if (fbo != 0)
+	{
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(1, &colorBuffer);
+		glDeleteRenderbuffers(1, &depthBuffer);
+	}
+	fbo = colorBuffer = depthBuffer = 0;
+}
+
+void Headless::begin_frame()
+{
+	if (enabled)
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void Headless::end_frame(GLFWwindow* window)
+{
+	if (!enabled)
+		return;
+
+	// The frame's time includes the GPU's work, which is what a benchmark should compare
+	glFinish();
+	double now = glfwGetTime();
+	frameMs.push_back((float)((now - frameStart) * 1000.0));
+	frameCounts.push_back(glCounters.end_frame());
+
+	bool last = frame + 1 >= frames;
+	if (!capturePrefix.empty() && (last || (captureEvery > 0 && frame % captureEvery == 0)))
+		capture();
+	++frame;
+
+	if (last)
+	{
+		write_timings();
+		write_stats();
+		glfwSetWindowShouldClose(window, GL_TRUE);
+	}
+	// Captures and file writes are left out of the next frame's time
+	frameStart = glfwGetTime();
+}
+
+glm::mat4 Headless::camera(const glm::mat4& start) const
+{
+	float degrees = 360.0f * (float)frame / (float)frames;
+	return glm::rotate(glm::mat4(1.0f), degrees, glm::vec3(0.0f, 1.0f, 0.0f)) * start;
+}
+
+void Headless::capture()
+{
+	std::vector<unsigned char> pixels(width * height * 3);
+	GLint readFramebuffer = 0, packAlignment = 4;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+	glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+	glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s_%04d.ppm", capturePrefix.c_str(), frame);
+	FILE* file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("%s could not be opened for writing.\n", path);
+		return;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	// GL's rows start at the bottom, the image's at the top
+	for (int y = height - 1; y >= 0; --y)
+		fwrite(&pixels[y * width * 3], 1, width * 3, file);
+	fclose(file);
+}
+
+void Headless::write_timings()
+{
+	if (frameMs.empty())
+		return;
+
+	std::vector<float> sorted = frameMs;
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0.0;
+	for (size_t i = 0; i < sorted.size(); ++i)
+		total += sorted[i];
+	std::cout << "Headless: " << sorted.size() << " frames, mean " << total / sorted.size()
+		<< " ms, p50 " << sorted[sorted.size() / 2]
+		<< " ms, p99 " << sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)] << " ms" << std::endl;
+
+	if (timingsPath.empty())
+		return;
+	FILE* file = fopen(timingsPath.c_str(), "w");
+	if (!file)
+	{
+		printf("%s could not be opened for writing.\n", timingsPath.c_str());
+		return;
+	}
+	for (size_t i = 0; i < frameMs.size(); ++i)
+		fprintf(file, "%.3f\n", frameMs[i]);
+	fclose(file);
+}
+
+void Headless::write_stats()
+{
+	if (statsPath.empty())
+		return;
+
+	// Without the first frame, unless it is the only one
+	size_t first = frameMs.size() > 1 ? 1 : 0;
+	std::vector<float> sorted(frameMs.begin() + first, frameMs.end());
+	std::sort(sorted.begin(), sorted.end());
+	double totalMs = 0.0, draws = 0.0, uniforms = 0.0, bytes = 0.0;
+	for (size_t i = first; i < frameMs.size(); ++i)
+	{
+		totalMs += frameMs[i];
+		draws += frameCounts[i].drawCalls;
+		uniforms += frameCounts[i].uniformCalls;
+		bytes += (double)frameCounts[i].uploadBytes;
+	}
+	size_t n = sorted.size();
+	if (n == 0)
+		return;
+
+	FILE* file = fopen(statsPath.c_str(), "w");
+	if (!file)
+	{
+		printf("%s could not be opened for writing.\n", statsPath.c_str());
+		return;
+	}
+	fprintf(file, "{\n");
+	fprintf(file, "\t\"frames\": %d,\n", (int)n);
+	fprintf(file, "\t\"width\": %d,\n", width);
+	fprintf(file, "\t\"height\": %d,\n", height);
+	fprintf(file, "\t\"mean_ms\": %.4f,\n", totalMs / n);
+	fprintf(file, "\t\"p50_ms\": %.4f,\n", sorted[n / 2]);
+	fprintf(file, "\t\"p95_ms\": %.4f,\n", sorted[std::min(n - 1, n * 95 / 100)]);
+	fprintf(file, "\t\"p99_ms\": %.4f,\n", sorted[std::min(n - 1, n * 99 / 100)]);
+	fprintf(file, "\t\"draw_calls\": %.2f,\n", draws / n);
+	fprintf(file, "\t\"uniform_calls\": %.2f,\n", uniforms / n);
+	fprintf(file, "\t\"upload_bytes\": %.0f\n", bytes / n);
+	fprintf(file, "}\n");
+	fclose(file);
+}
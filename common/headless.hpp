@@ -0,0 +1,86 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glfw3.h>
+#include <glm/glm.hpp>
+
+#include <common/gl_counters.hpp>
+
+// Runs a demo without a display, for benchmarks on machines without a GPU (Mesa llvmpipe).
+// The window is hidden and, with GLFW 3.4, made on the null platform with an EGL or OSMesa
+// context, so no X server is needed. Older GLFW can only hide a window on the display server
+// (with GLFW 3.3 still with an EGL or OSMesa context); without one init_hints fails. The frames go to an offscreen framebuffer of the window's
+// size. The eye follows a scripted path, one orbit around the world's y axis over the run, and
+// after the last frame the window is closed.
+//
+//	headless.parse(argc, argv);
+//	if (!headless.init_hints()) return -1;
+//	glfwInit(); headless.window_hints(); window = glfwCreateWindow(...); glewInit();
+//	headless.initialize(frameBufferWidth, frameBufferHeight);
+//	do {
+//		headless.begin_frame();
+//		if (headless.enabled) skyRBT = headless.camera(startRBT);
+//		... draw to headless.framebuffer() where the window's framebuffer was used ...
+//		glfwSwapBuffers(window);
+//		headless.end_frame(window);
+//	} while (!glfwWindowShouldClose(window));
+//	headless.cleanup();
+//
+// Command line: --headless, --osmesa (OSMesa instead of EGL), --frames N (default 300),
+// --timings FILE (frame times in ms, one per line), --stats FILE (JSON summary below), --capture
+// PREFIX (PREFIX_NNNN.ppm of the last frame) and --capture-every N (also every Nth frame).
+//
+// The summary has the mean, p50, p95 and p99 frame time in ms and the mean draw calls, uniform
+// calls and uploaded bytes per frame (GLCounters, installed for --stats). The first frame is
+// left out of it, it carries the loading's uploads and the first use of every program.
+// benchmark/demo_suite runs the demos with it.
+class Headless {
+	GLuint fbo, colorBuffer, depthBuffer;
+	int width, height;
+	int frame;
+	double frameStart;
+	std::vector<float> frameMs;
+	std::vector<GLCounters::Counts> frameCounts;
+
+	void capture(void);
+	void write_timings(void);
+	void write_stats(void);
+
+public:
+	bool enabled;
+	bool osmesa;
+	int frames;
+	int captureEvery;
+	std::string capturePrefix;
+	std::string timingsPath;
+	std::string statsPath;
+
+	Headless();
+
+	// Reads the options above; without --headless the other calls do nothing
+	void parse(int argc, char* argv[]);
+	// Before glfwInit. False when the GLFW it was built with cannot run it here.
+	bool init_hints(void);
+	// After glfwInit, before glfwCreateWindow
+	void window_hints(void);
+	// After glewInit: the offscreen framebuffer. False when it is incomplete.
+	bool initialize(int width, int height);
+	void cleanup(void);
+
+	// The framebuffer that stands in for the window's, 0 when not headless
+	GLuint framebuffer(void) const { return fbo; }
+	// Binds it, for demos that draw to the window's framebuffer without binding it
+	void begin_frame(void);
+	// Times the frame, captures it when due, and closes the window after the last one
+	void end_frame(GLFWwindow* window);
+	// The eye on the path for this frame, start turned around the world's y axis
+	glm::mat4 camera(const glm::mat4& start) const;
+	// Simulated seconds per frame, for schedulers that should not follow the clock
+	double frame_seconds(void) const { return 1.0 / 60.0; }
+};
+
+#endif
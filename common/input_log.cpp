@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/input_log.hpp>
+
+InputLog inputLog;
+
+static const char MAGIC[4] = { 'I', 'N', 'P', 'L' };
+static const unsigned VERSION = 1;
+
+// Little helpers for the packed log, in the machine's byte order
+template <typename T>
+static void put(std::vector<unsigned char>& data, T value)
+{
+	size_t size = data.size();
+	data.resize(size + sizeof(T));
+	memcpy(&data[size], &value, sizeof(T));
+}
+
+template <typename T>
+static bool get(const std::vector<unsigned char>& data, size_t& offset, T& value)
+{
+	if (offset + sizeof(T) > data.size())
+		return false;
+	memcpy(&value, &data[offset], sizeof(T));
+	offset += sizeof(T);
+	return true;
+}
+
+InputLog::InputLog()
+	: next(0), frame(0), startTime(0.0), cursorX(0.0), cursorY(0.0),
+	keyCallback(NULL), buttonCallback(NULL), cursorCallback(NULL), mode(OFF), seed(1)
+{
+}
+
+void InputLog::parse(int argc, char* argv[])
+{
+	for (int i = 1; i + 1 < argc; ++i)
+	{
+		if (strcmp(argv[i], "--record") == 0)
+		{
+			mode = RECORD;
+			path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--replay") == 0)
+		{
+			mode = REPLAY;
+			path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--seed") == 0)
+			seed = (unsigned)strtoul(argv[++i], NULL, 10);
+	}
+}
+
+bool InputLog::initialize()
+{
+	events.clear();
+	next = 0;
+	frame = 0;
+	startTime = glfwGetTime();
+	if (mode == REPLAY && !read())
+	{
+		mode = OFF;
+		return false;
+	}
+	if (mode != OFF)
+		printf("%s %s, seed %u\n", mode == RECORD ? "Recording input to" : "Replaying input from", path.c_str(), seed);
+	return true;
+}
+
+void InputLog::set_callbacks(GLFWwindow* window, GLFWkeyfun key, GLFWmousebuttonfun button, GLFWcursorposfun cursor)
+{
+	keyCallback = key;
+	buttonCallback = button;
+	cursorCallback = cursor;
+	if (mode == OFF)
+	{
+		glfwSetKeyCallback(window, key);
+		glfwSetMouseButtonCallback(window, button);
+		glfwSetCursorPosCallback(window, cursor);
+		return;
+	}
+	// Replays still take the live events, only to drop them
+	glfwSetKeyCallback(window, on_key);
+	glfwSetMouseButtonCallback(window, on_button);
+	glfwSetCursorPosCallback(window, on_cursor);
+}
+
+void InputLog::on_key(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	if (inputLog.mode != RECORD)
+		return;
+	Event event;
+	event.type = KEY;
+	event.key = key;
+	event.scancode = scancode;
+	event.action = action;
+	event.mods = mods;
+	event.x = event.y = 0.0;
+	event.frame = inputLog.frame;
+	event.time = (float)(glfwGetTime() - inputLog.startTime);
+	inputLog.events.push_back(event);
+	inputLog.dispatch(window, event);
+}
+
+void InputLog::on_button(GLFWwindow* window, int button, int action, int mods)
+{
+	if (inputLog.mode != RECORD)
+		return;
+	Event event;
+	event.type = BUTTON;
+	event.key = button;
+	event.scancode = 0;
+	event.action = action;
+	event.mods = mods;
+	event.x = event.y = 0.0;
+	event.frame = inputLog.frame;
+	event.time = (float)(glfwGetTime() - inputLog.startTime);
+	inputLog.events.push_back(event);
+	inputLog.dispatch(window, event);
+}
+
+void InputLog::on_cursor(GLFWwindow* window, double x, double y)
+{
+	if (inputLog.mode != RECORD)
+		return;
+	Event event;
+	event.type = CURSOR;
+	event.key = event.scancode = event.action = event.mods = 0;
+	event.x = x;
+	event.y = y;
+	event.frame = inputLog.frame;
+	event.time = (float)(glfwGetTime() - inputLog.startTime);
+	inputLog.events.push_back(event);
+	inputLog.dispatch(window, event);
+}
+
+void InputLog::dispatch(GLFWwindow* window, const Event& event)
+{
+	switch (event.type)
+	{
+	case KEY:
+		if (keyCallback)
+			keyCallback(window, event.key, event.scancode, event.action, event.mods);
+		break;
+	case BUTTON:
+		if (buttonCallback)
+			buttonCallback(window, event.key, event.action, event.mods);
+		break;
+	case CURSOR:
+		cursorX = event.x;
+		cursorY = event.y;
+		if (cursorCallback)
+			cursorCallback(window, event.x, event.y);
+		break;
+	default:
+		break;
+	}
+}
+
+void InputLog::begin_frame(GLFWwindow* window)
+{
+	if (mode != REPLAY)
+		return;
+	for (; next < events.size() && events[next].frame <= frame; ++next)
+	{
+		if (events[next].type == END)
+		{
+			printf("Replay of %s finished after %u frames\n", path.c_str(), frame);
+			glfwSetWindowShouldClose(window, GL_TRUE);
+		}
+		else
+			dispatch(window, events[next]);
+	}
+}
+
+void InputLog::end_frame()
+{
+	++frame;
+}
+
+void InputLog::get_cursor_pos(GLFWwindow* window, double* x, double* y)
+{
+	if (mode == OFF)
+	{
+		glfwGetCursorPos(window, x, y);
+		return;
+	}
+	*x = cursorX;
+	*y = cursorY;
+}
+
+void InputLog::cleanup()
+{
+	if (mode == RECORD)
+	{
+		Event end;
+		memset(&end, 0, sizeof(end));
+		end.type = END;
+		end.frame = frame;
+		end.time = (float)(glfwGetTime() - startTime);
+		events.push_back(end);
+		if (write())
+			printf("%u frames of input recorded to %s\n", frame, path.c_str());
+	}
+	mode = OFF;
+	events.clear();
+}
+
+bool InputLog::write()
+{
+	std::vector<unsigned char> data;
+	data.insert(data.end(), MAGIC, MAGIC + 4);
+	put(data, (unsigned)VERSION);
+	put(data, seed);
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const Event& event = events[i];
+		put(data, event.frame);
+		put(data, event.time);
+		put(data, event.type);
+		if (event.type == KEY)
+		{
+			put(data, (short)event.key);
+			put(data, (short)event.scancode);
+			put(data, (signed char)event.action);
+			put(data, (signed char)event.mods);
+		}
+		else if (event.type == BUTTON)
+		{
+			put(data, (signed char)event.key);
+			put(data, (signed char)event.action);
+			put(data, (signed char)event.mods);
+		}
+		else if (event.type == CURSOR)
+		{
+			put(data, event.x);
+			put(data, event.y);
+		}
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		printf("%s could not be opened for writing.\n", path.c_str());
+		return false;
+	}
+	fwrite(&data[0], 1, data.size(), file);
+	fclose(file);
+	return true;
+}
+
+bool InputLog::read()
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		printf("%s could not be opened.\n", path.c_str());
+		return false;
+	}
+	std::vector<unsigned char> data;
+	unsigned char buffer[4096];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + count);
+	fclose(file);
+
+	size_t offset = 4;
+	unsigned version = 0;
+	if (data.size() < 4 || memcmp(&data[0], MAGIC, 4) != 0 || !get(data, offset, version) || version != VERSION
+		|| !get(data, offset, seed))
+	{
+		printf("%s is not an input log.\n", path.c_str());
+		return false;
+	}
+
+	while (offset < data.size())
+	{
+		Event event;
+		memset(&event, 0, sizeof(event));
+		bool ok = get(data, offset, event.frame) && get(data, offset, event.time) && get(data, offset, event.type);
+		if (ok && event.type == KEY)
+		{
+			short key = 0, scancode = 0;
+			signed char action = 0, mods = 0;
+			ok = get(data, offset, key) && get(data, offset, scancode) && get(data, offset, action) && get(data, offset, mods);
+			event.key = key;
+			event.scancode = scancode;
+			event.action = action;
+			event.mods = mods;
+		}
+		else if (ok && event.type == BUTTON)
+		{
+			signed char button = 0, action = 0, mods = 0;
+			ok = get(data, offset, button) && get(data, offset, action) && get(data, offset, mods);
+			event.key = button;
+			event.action = action;
+			event.mods = mods;
+		}
+		else if (ok && event.type == CURSOR)
+			ok = get(data, offset, event.x) && get(data, offset, event.y);
+		if (!ok || event.type > END)
+		{
+			printf("%s is cut off after %u events.\n", path.c_str(), (unsigned)events.size());
+			break;
+		}
+		events.push_back(event);
+	}
+	return true;
+}
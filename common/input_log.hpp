@@ -0,0 +1,90 @@
+#ifndef INPUT_LOG_HPP
+#define INPUT_LOG_HPP
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glfw3.h>
+
+// Records the keyboard, mouse button and cursor callbacks of a session to a binary log, and
+// replays it: the events go back to the same callbacks at the start of the frame they arrived
+// in, and live input is ignored. Events are keyed by frame, not time, so a replay does the
+// same whatever its frame rate; the demos step their animation by a fixed time per frame while
+// a log is open (FrameScheduler::set_fixed_frame) and seed their random numbers with seed.
+// After the last recorded frame the replay closes the window.
+//
+//	inputLog.parse(argc, argv);
+//	... create the window ...
+//	inputLog.initialize();
+//	inputLog.set_callbacks(window, keyboard_callback, mouse_button_callback, cursor_pos_callback);
+//	do {
+//		inputLog.begin_frame(window);
+//		...
+//		inputLog.end_frame();
+//	} while (...);
+//	inputLog.cleanup();         // writes the recording
+//
+// Command line: --record FILE, --replay FILE, --seed N (the seed of a recording, else 1).
+// Code that asks for the cursor has to use get_cursor_pos, which returns the logged position.
+//
+// Log: "INPL", version and seed (uint32), then per event its frame (uint32), time since the
+// start in seconds (float), type (uint8) and the type's data: key (int16 key, int16 scancode,
+// int8 action, int8 mods), button (int8 button, action, mods) or cursor (two doubles). The
+// last event is an END in the frame after the last one.
+class InputLog {
+public:
+	enum Mode { OFF, RECORD, REPLAY };
+
+private:
+	enum Type { KEY, BUTTON, CURSOR, END };
+	struct Event {
+		unsigned frame;
+		float time;
+		unsigned char type;
+		int key, scancode, action, mods;   // button in key
+		double x, y;
+	};
+
+	std::string path;
+	std::vector<Event> events;
+	size_t next;
+	unsigned frame;
+	double startTime;
+	double cursorX, cursorY;
+	GLFWkeyfun keyCallback;
+	GLFWmousebuttonfun buttonCallback;
+	GLFWcursorposfun cursorCallback;
+
+	void dispatch(GLFWwindow* window, const Event& event);
+	bool read(void);
+	bool write(void);
+
+	static void on_key(GLFWwindow* window, int key, int scancode, int action, int mods);
+	static void on_button(GLFWwindow* window, int button, int action, int mods);
+	static void on_cursor(GLFWwindow* window, double x, double y);
+
+public:
+	Mode mode;
+	unsigned seed;
+
+	InputLog();
+
+	void parse(int argc, char* argv[]);
+	// Reads the log to replay; false when it cannot be read
+	bool initialize(void);
+	// In place of glfwSet*Callback; any callback may be NULL
+	void set_callbacks(GLFWwindow* window, GLFWkeyfun key, GLFWmousebuttonfun button, GLFWcursorposfun cursor);
+	// Replays the events of this frame
+	void begin_frame(GLFWwindow* window);
+	void end_frame(void);
+	// glfwGetCursorPos, the logged position while recording or replaying
+	void get_cursor_pos(GLFWwindow* window, double* x, double* y);
+	bool active(void) const { return mode != OFF; }
+	// Writes the recording
+	void cleanup(void);
+};
+
+extern InputLog inputLog;
+
+#endif
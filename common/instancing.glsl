@@ -0,0 +1,33 @@
+// Model transform of a vertex shader, pulled in with #include "../common/instancing.glsl".
+//
+// Without INSTANCED ModelTransform is the usual uniform. With it (ShaderPermutation::instanced)
+// ModelTransform and instanceOpacity are per instance attributes filled by Model::drawInstanced;
+// Model::draw sets the same attributes to constant values, so the program also draws single models.
+//
+// With VELOCITY (ShaderPermutation::velocity) the previous frame's transforms come along too, and
+// the shader ends with write_clip_positions(Projection, position) for the fragment side in velocity.glsl.
+
+#ifdef INSTANCED
+layout(location = 5) in mat4 ModelTransform;
+layout(location = 9) in float instanceOpacity;
+#else
+uniform mat4 ModelTransform;
+#endif
+
+#ifdef VELOCITY
+#ifdef INSTANCED
+layout(location = 10) in mat4 PreviousModelTransform;
+#else
+uniform mat4 PreviousModelTransform;
+#endif
+uniform mat4 PreviousEye;
+
+smooth out vec4 currentClipPosition;
+smooth out vec4 previousClipPosition;
+
+// position in model space, after gl_Position is written
+void write_clip_positions(mat4 projection, vec4 position) {
+	currentClipPosition = gl_Position;
+	previousClipPosition = projection * inverse(PreviousEye) * PreviousModelTransform * position;
+}
+#endif
@@ -0,0 +1,144 @@
+// Shared lighting for the fragment shaders, pulled in with #include "../common/lighting.glsl".
+// http://www.tomdalling.com/blog/modern-opengl/08-even-more-lighting-directional-lights-spotlights-multiple-lights/
+//
+// The includer declares `in vec3 fragmentPosition;` before including this file.
+//
+// Permutation defines (see ShaderPermutation in shader.hpp):
+//   NUM_DIR_LIGHTS, NUM_POINT_LIGHTS, NUM_SPOT_LIGHTS
+//     The lights array is ordered directional, point, spot and each light type gets its own
+//     loop without the runtime type test. Without them numLights and light.position.w are used.
+//   TOON_SHADING
+//     toonShade() quantizes the intensity into bands.
+//   LIGHT_BLOCK
+//     The lights come from the std140 uniform block LightBlock, one buffer update per frame
+//     instead of six uniforms per light and program, and MAX_LIGHTS is the number of lights.
+
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 10
+#endif
+
+uniform int numLights;
+struct Light {
+	vec4 position;
+	vec3 color;
+	float falloff;
+	float ambientCoefficient;
+	float coneAngle;
+	vec3 coneDirection;
+};
+#ifdef LIGHT_BLOCK
+// 64 bytes per light, coneDirection starts at byte 48
+layout(std140) uniform LightBlock {
+	Light lights[MAX_LIGHTS];
+};
+#else
+uniform Light lights[MAX_LIGHTS];
+#endif
+
+uniform mat4 Eye;
+
+vec3 shadeLight(Light light, vec3 toLight, float attenuation, vec3 toV, vec3 normal, vec3 fragmentColor) {
+	vec3 h = normalize(toV + toLight);
+
+	vec3 ambient = light.ambientCoefficient * fragmentColor * light.color;
+
+	float specularCoefficient = pow(max(0.0, dot(h, normal)), 128.0);
+	vec3 specular = specularCoefficient * light.color;
+
+	float diffuseCoefficient = max(0.0, dot(normal, toLight));
+	vec3 diffuse = diffuseCoefficient * light.color * fragmentColor;
+
+	return ambient + attenuation*(diffuse + specular);
+}
+
+vec3 applyDirectionalLight(Light light, vec3 toV, vec3 normal, vec3 fragmentColor) {
+	// Direction in view space
+	vec3 toLight = normalize(vec3(inverse(Eye) * vec4(light.position.xyz, 1)));
+	return shadeLight(light, toLight, 1.0, toV, normal, fragmentColor);
+}
+
+float pointAttenuation(Light light, vec3 lightPosition) {
+	float distanceToLight = length(lightPosition - fragmentPosition);
+	float radius = sqrt(1.0 / (light.falloff * 0.001));
+
+	// Cut off light at radius
+	if(distanceToLight >= radius)
+		return 0.0;
+	return 1.0 / (1.0 + light.falloff * pow(distanceToLight, 2));
+}
+
+vec3 applyPointLight(Light light, vec3 toV, vec3 normal, vec3 fragmentColor) {
+	// Position in view space
+	vec3 lightPosition = vec3(inverse(Eye) * vec4(light.position.xyz, 1));
+	vec3 toLight = normalize(lightPosition - fragmentPosition);
+	return shadeLight(light, toLight, pointAttenuation(light, lightPosition), toV, normal, fragmentColor);
+}
+
+vec3 applySpotLight(Light light, vec3 toV, vec3 normal, vec3 fragmentColor) {
+	// Position in view space
+	vec3 lightPosition = vec3(inverse(Eye) * vec4(light.position.xyz, 1));
+	vec3 toLight = normalize(lightPosition - fragmentPosition);
+	float attenuation = pointAttenuation(light, lightPosition);
+
+	// Check if inside spot light cone
+	vec3 coneDirection = vec3(inverse(Eye) * vec4(light.coneDirection, 1));
+	float lightToSurfaceAngle = degrees(acos(dot(-toLight, normalize(coneDirection - lightPosition))));
+	if(lightToSurfaceAngle > light.coneAngle) {
+		attenuation = 0.0;
+	}
+
+	return shadeLight(light, toLight, attenuation, toV, normal, fragmentColor);
+}
+
+// Runtime type test, point lights are spot lights with a 180 degree cone
+vec3 applyLight(Light light, vec3 toV, vec3 normal, vec3 fragmentColor) {
+	if(light.position.w == 0.0)
+		return applyDirectionalLight(light, toV, normal, fragmentColor);
+	return applySpotLight(light, toV, normal, fragmentColor);
+}
+
+vec3 applyLights(vec3 toV, vec3 normal, vec3 fragmentColor) {
+	vec3 intensity = vec3(0.0);
+#if defined(NUM_DIR_LIGHTS) && defined(NUM_POINT_LIGHTS) && defined(NUM_SPOT_LIGHTS)
+	for(int i = 0; i < NUM_DIR_LIGHTS; ++i) {
+		intensity += applyDirectionalLight(lights[i], toV, normal, fragmentColor);
+	}
+	for(int i = 0; i < NUM_POINT_LIGHTS; ++i) {
+		intensity += applyPointLight(lights[NUM_DIR_LIGHTS + i], toV, normal, fragmentColor);
+	}
+	for(int i = 0; i < NUM_SPOT_LIGHTS; ++i) {
+		intensity += applySpotLight(lights[NUM_DIR_LIGHTS + NUM_POINT_LIGHTS + i], toV, normal, fragmentColor);
+	}
+#else
+	for(int i = 0; i < numLights; ++i) {
+		intensity += applyLight(lights[i], toV, normal, fragmentColor);
+	}
+#endif
+	return intensity;
+}
+
+#ifdef TOON_SHADING
+float getColorValue(float intensity) {
+	if (intensity > 0.90)
+		intensity = 1;
+	else if (intensity > 0.65)
+		intensity = 0.75;
+	else if (intensity > 0.35)
+		intensity = 0.45;
+	else if (intensity > 0.10)
+		intensity = 0.20;
+	else
+		intensity = 0.0;
+
+	return intensity;
+}
+#endif
+
+vec3 toonShade(vec3 intensity) {
+#ifdef TOON_SHADING
+	intensity.r = getColorValue(intensity.r);
+	intensity.g = getColorValue(intensity.g);
+	intensity.b = getColorValue(intensity.b);
+#endif
+	return intensity;
+}
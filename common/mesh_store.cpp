@@ -0,0 +1,209 @@
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <common/mesh_store.hpp>
+#include <common/shader.hpp>
+#include <common/gl_state.hpp>
+#include <common/ring_buffer.hpp>
+
+MeshStore::MeshStore()
+	: InstanceBufferID(0), IndirectBufferID(0), multiDrawIndirect(false), baseInstance(false),
+	VertexArrayID(0), VertexBufferID(0), NormalBufferID(0), ColorBufferID(0), TexBufferID(0), TangentID(0), IndexBufferID(0)
+{
+}
+
+template <typename T>
+static void append_attribute(std::vector<T>& to, const std::vector<T>& from, size_t vertexCount)
+{
+	if (from.size() >= vertexCount)
+		to.insert(to.end(), from.begin(), from.begin() + vertexCount);
+	else
+		to.resize(to.size() + vertexCount, T(0.0f));
+}
+
+int MeshStore::add(const Model* model)
+{
+	const std::vector<glm::vec3>& vertices = model->get_vertices();
+	const std::vector<unsigned int>& modelIndices = model->get_indices();
+
+	MeshRange range;
+	range.firstIndex = (GLuint)indices.size();
+	range.baseVertex = (GLint)positions.size();
+
+	positions.insert(positions.end(), vertices.begin(), vertices.end());
+	append_attribute(normals, model->get_normals(), vertices.size());
+	append_attribute(colors, model->get_colors(), vertices.size());
+	append_attribute(texcoords, model->get_texcoords(), vertices.size());
+	append_attribute(tangents, model->get_tangents(), vertices.size());
+
+	// DRAW_TYPE::ARRAY meshes get the indices 0, 1, 2, ...
+	if (modelIndices.empty())
+		for (size_t i = 0; i < vertices.size(); ++i)
+			indices.push_back((unsigned int)i);
+	else
+		indices.insert(indices.end(), modelIndices.begin(), modelIndices.end());
+	range.indexCount = (GLuint)indices.size() - range.firstIndex;
+
+	models.push_back(model);
+	meshes.push_back(range);
+	return (int)meshes.size() - 1;
+}
+
+int MeshStore::find(const Model* model) const
+{
+	for (size_t i = 0; i < models.size(); ++i)
+		if (models[i] == model)
+			return (int)i;
+	return -1;
+}
+
+void MeshStore::upload()
+{
+	multiDrawIndirect = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+	baseInstance = multiDrawIndirect || GLEW_ARB_base_instance;
+
+	glGenVertexArrays(1, &VertexArrayID);
+	glState.bind_vertex_array(VertexArrayID);
+
+	glGenBuffers(1, &VertexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, VertexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * positions.size(), &positions[0], GL_STATIC_DRAW);
+	glState.vertex_attrib(0, VertexBufferID, 3, sizeof(glm::vec3), 0);
+
+	glGenBuffers(1, &NormalBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, NormalBufferID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * normals.size(), &normals[0], GL_STATIC_DRAW);
+	glState.vertex_attrib(1, NormalBufferID, 3, sizeof(glm::vec3), 0);
+
+	glGenBuffers(1, &ColorBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, ColorBufferID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * colors.size(), &colors[0], GL_STATIC_DRAW);
+	glState.vertex_attrib(2, ColorBufferID, 3, sizeof(glm::vec3), 0);
+
+	glGenBuffers(1, &TexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, TexBufferID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * texcoords.size(), &texcoords[0], GL_STATIC_DRAW);
+	glState.vertex_attrib(3, TexBufferID, 2, sizeof(glm::vec2), 0);
+
+	glGenBuffers(1, &TangentID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, TangentID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * tangents.size(), &tangents[0], GL_STATIC_DRAW);
+	glState.vertex_attrib(4, TangentID, 3, sizeof(glm::vec3), 0);
+
+	glGenBuffers(1, &IndexBufferID);
+	glState.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, IndexBufferID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), &indices[0], GL_STATIC_DRAW);
+
+	// Only the ranges are needed from here on
+	positions.clear(); positions.shrink_to_fit();
+	normals.clear(); normals.shrink_to_fit();
+	colors.clear(); colors.shrink_to_fit();
+	texcoords.clear(); texcoords.shrink_to_fit();
+	tangents.clear(); tangents.shrink_to_fit();
+	indices.clear(); indices.shrink_to_fit();
+}
+
+void MeshStore::draw(const glm::mat4& projection, const glm::mat4& eye, const MeshDraw* draws, int count,
+	const glm::mat4* transforms, const float* opacities, const glm::mat4* previousTransforms, int numInstances)
+{
+	if (count <= 0 || numInstances <= 0 || VertexArrayID == 0)
+		return;
+
+	GLuint program = glState.current_program();
+	glUniformMatrix4fv(GetUniformLocation(program, "Projection"), 1, GL_FALSE, &projection[0][0]);
+	glUniformMatrix4fv(GetUniformLocation(program, "Eye"), 1, GL_FALSE, &eye[0][0]);
+
+	pack_instances(instanceData, transforms, opacities, previousTransforms, numInstances);
+
+	// Instance data into this frame's slice of the ring, or the store's own buffer without one
+	GLsizeiptr size = sizeof(float) * instanceData.size();
+	GLintptr offset = (frameRing != NULL) ? frameRing->upload(&instanceData[0], size) : -1;
+	GLuint buffer;
+	if (offset >= 0)
+		buffer = frameRing->buffer;
+	else
+	{
+		if (InstanceBufferID == 0)
+			glGenBuffers(1, &InstanceBufferID);
+		glState.bind_buffer(GL_ARRAY_BUFFER, InstanceBufferID);
+		glBufferData(GL_ARRAY_BUFFER, size, &instanceData[0], GL_STREAM_DRAW);
+		buffer = InstanceBufferID;
+		offset = 0;
+	}
+
+	glState.bind_vertex_array(VertexArrayID);
+	GLsizei stride = FLOATS_PER_INSTANCE * sizeof(float);
+
+	if (!baseInstance)
+	{
+		// GL 3.3: each draw points the instance attributes at its own instances
+		for (int d = 0; d < count; ++d)
+		{
+			const MeshRange& range = meshes[draws[d].mesh];
+			bind_instance_attributes(buffer, offset + draws[d].firstInstance * stride);
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+				(GLvoid*)(range.firstIndex * sizeof(unsigned int)), draws[d].instanceCount, range.baseVertex);
+		}
+		return;
+	}
+
+	// The base instance of each command selects its instances
+	bind_instance_attributes(buffer, offset);
+
+	if (!multiDrawIndirect)
+	{
+		for (int d = 0; d < count; ++d)
+		{
+			const MeshRange& range = meshes[draws[d].mesh];
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+				(GLvoid*)(range.firstIndex * sizeof(unsigned int)), draws[d].instanceCount, range.baseVertex, draws[d].firstInstance);
+		}
+		return;
+	}
+
+	// DrawElementsIndirectCommand: count, instanceCount, firstIndex, baseVertex, baseInstance
+	commands.resize(count * 5);
+	for (int d = 0; d < count; ++d)
+	{
+		const MeshRange& range = meshes[draws[d].mesh];
+		GLuint* command = &commands[d * 5];
+		command[0] = range.indexCount;
+		command[1] = (GLuint)draws[d].instanceCount;
+		command[2] = range.firstIndex;
+		command[3] = (GLuint)range.baseVertex;
+		command[4] = (GLuint)draws[d].firstInstance;
+	}
+	GLsizeiptr commandSize = sizeof(GLuint) * commands.size();
+	GLintptr commandOffset = (frameRing != NULL) ? frameRing->upload(&commands[0], commandSize, 4) : -1;
+	if (commandOffset >= 0)
+		glState.bind_buffer(GL_DRAW_INDIRECT_BUFFER, frameRing->buffer);
+	else
+	{
+		if (IndirectBufferID == 0)
+			glGenBuffers(1, &IndirectBufferID);
+		glState.bind_buffer(GL_DRAW_INDIRECT_BUFFER, IndirectBufferID);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commandSize, &commands[0], GL_STREAM_DRAW);
+		commandOffset = 0;
+	}
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)commandOffset, count, 0);
+}
+
+void MeshStore::cleanup()
+{
+	GLuint buffers[] = { VertexBufferID, NormalBufferID, ColorBufferID, TexBufferID, TangentID, IndexBufferID, InstanceBufferID, IndirectBufferID };
+	for (int i = 0; i < 8; ++i)
+	{
+		if (buffers[i] == 0)
+			continue;
+		glState.delete_buffer(buffers[i]);
+		glDeleteBuffers(1, &buffers[i]);
+	}
+	if (VertexArrayID != 0)
+	{
+		glState.delete_vertex_array(VertexArrayID);
+		glDeleteVertexArrays(1, &VertexArrayID);
+	}
+	VertexArrayID = 0;
+	models.clear();
+	meshes.clear();
+}
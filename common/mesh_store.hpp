@@ -0,0 +1,73 @@
+#ifndef MESH_STORE_HPP
+#define MESH_STORE_HPP
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <common/model.hpp>
+
+// The static meshes of a demo packed into one set of vertex buffers and one index buffer,
+// behind a single vertex array, so any number of them are drawn with one multi-draw:
+//
+//	meshStore.add(&cubes[0]); meshStore.add(&deer);
+//	meshStore.upload();
+//	...
+//	MeshDraw draws[2] = { { cubeMesh, 0, 9 }, { deerMesh, 9, 1 } };
+//	meshStore.draw(Projection, eyeRBT, draws, 2, transforms, opacities, NULL, 10);
+//
+// The per draw data (see FLOATS_PER_INSTANCE) are instance attributes, as for
+// Model::drawInstanced, so the programs must be built with ShaderPermutation::instanced.
+// Each draw reads its instances from firstInstance on through the base instance of an
+// indirect command.
+//
+// glMultiDrawElementsIndirect (GL 4.3 / ARB_multi_draw_indirect) submits all draws at once.
+// With only ARB_base_instance the commands are issued one by one, and on plain GL 3.3 the
+// instance attributes are re-pointed per draw; the single vertex array is kept either way.
+
+struct MeshRange {
+	GLuint firstIndex;
+	GLuint indexCount;
+	GLint baseVertex;
+};
+
+struct MeshDraw {
+	int mesh;
+	int firstInstance;      // into the transforms passed to draw()
+	int instanceCount;
+};
+
+class MeshStore {
+	std::vector<const Model*> models;
+	std::vector<MeshRange> meshes;
+	std::vector<glm::vec3> positions, normals, colors, tangents;
+	std::vector<glm::vec2> texcoords;
+	std::vector<unsigned int> indices;
+
+	std::vector<float> instanceData;
+	std::vector<GLuint> commands;   // DrawElementsIndirectCommand, 5 uints each
+	GLuint InstanceBufferID, IndirectBufferID;
+	bool multiDrawIndirect, baseInstance;
+
+public:
+	GLuint VertexArrayID;
+	GLuint VertexBufferID, NormalBufferID, ColorBufferID, TexBufferID, TangentID, IndexBufferID;
+
+	MeshStore();
+
+	// Appends model's mesh, returns its index. Attributes the model lacks are zero.
+	int add(const Model* model);
+	// Index of model's mesh, -1 if it was not added
+	int find(const Model* model) const;
+	const MeshRange& mesh(int i) const { return meshes[i]; }
+	int size(void) const { return (int)meshes.size(); }
+
+	// Creates the buffers, call once after the last add()
+	void upload(void);
+	// The bound program (glState) draws every entry of draws with one submission
+	void draw(const glm::mat4& projection, const glm::mat4& eye, const MeshDraw* draws, int count,
+		const glm::mat4* transforms, const float* opacities, const glm::mat4* previousTransforms, int numInstances);
+	void cleanup(void);
+};
+
+#endif
@@ -6,6 +6,10 @@
 
 #include "model.hpp"
 #include "shader.hpp"
+#include "ring_buffer.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+#include "gl_counters.hpp"
 
 using namespace std;
 
@@ -16,6 +20,8 @@ Model::Model()
 	indices = std::vector<unsigned int>();
 	normals = std::vector<glm::vec3>();
 	colors = std::vector<glm::vec3>();	
+	boundsMin = boundsMax = glm::vec3(0.0f);
+	boundsRadius = 0.0f;
 }
 
 void Model::add_vertex(float x, float y, float z)
@@ -76,49 +82,131 @@ void Model::set_model(glm::mat4* model)
 	this->ModelTransform = model;
 }
 
+glm::mat4* Model::get_projection()
+{
+	return this->Projection;
+}
+
+glm::mat4* Model::get_eye()
+{
+	return this->Eye;
+}
+
 glm::mat4* Model::get_model()
 {
 	return this->ModelTransform;
 }
 
+const std::vector<glm::vec3>& Model::get_vertices() const
+{
+	return this->vertices;
+}
+
+// Empty for DRAW_TYPE::ARRAY models
+const std::vector<unsigned int>& Model::get_indices() const
+{
+	return this->indices;
+}
+
+const std::vector<glm::vec3>& Model::get_normals() const
+{
+	return this->normals;
+}
+
+const std::vector<glm::vec3>& Model::get_colors() const
+{
+	return this->colors;
+}
+
+const std::vector<glm::vec2>& Model::get_texcoords() const
+{
+	return this->texcoords;
+}
+
+const std::vector<glm::vec3>& Model::get_tangents() const
+{
+	return this->tangents;
+}
+
+glm::vec3 Model::get_bounds_min() const
+{
+	return this->boundsMin;
+}
+
+glm::vec3 Model::get_bounds_max() const
+{
+	return this->boundsMax;
+}
+
+float Model::get_bounds_radius() const
+{
+	return this->boundsRadius;
+}
+
+void Model::compute_bounds()
+{
+	this->boundsMin = glm::vec3(0.0f);
+	this->boundsMax = glm::vec3(0.0f);
+	this->boundsRadius = 0.0f;
+	if (this->vertices.empty())
+		return;
+
+	this->boundsMin = this->boundsMax = this->vertices[0];
+	for (size_t i = 1; i < this->vertices.size(); ++i)
+	{
+		this->boundsMin = glm::min(this->boundsMin, this->vertices[i]);
+		this->boundsMax = glm::max(this->boundsMax, this->vertices[i]);
+	}
+
+	glm::vec3 center = 0.5f * (this->boundsMin + this->boundsMax);
+	float radius2 = 0.0f;
+	for (size_t i = 0; i < this->vertices.size(); ++i)
+	{
+		glm::vec3 d = this->vertices[i] - center;
+		radius2 = glm::max(radius2, glm::dot(d, d));
+	}
+	this->boundsRadius = sqrt(radius2);
+}
+
 void Model::initialize(DRAW_TYPE type, const char * vertexShader_path, const char * fragmentShader_path)
 {
 	this->GLSLProgramID = LoadShaders(vertexShader_path, fragmentShader_path);
 	this->type = type;
+	this->compute_bounds();
 	
 	glGenVertexArrays(1, &this->VertexArrayID);
-	glBindVertexArray(this->VertexArrayID);
+	glState.bind_vertex_array(this->VertexArrayID);
 
 	glGenBuffers(1, &this->VertexBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->VertexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->VertexBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->vertices.size(), &this->vertices[0], GL_STATIC_DRAW);
 
 	if (this->type == DRAW_TYPE::INDEX)
 	{
 		glGenBuffers(1, &this->IndexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
+		glState.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*this->indices.size(), &this->indices[0], GL_STATIC_DRAW);
 	}
 
 	//TODO: generate/bind buffer for colors and store the color values
 	glGenBuffers(1, &this->ColorBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->ColorBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->ColorBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->colors.size(), &this->colors[0], GL_STATIC_DRAW);
 
 	//TODO: generate/bind buffer for normals and store the normal values
 	glGenBuffers(1, &this->NormalBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->NormalBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->NormalBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->normals.size(), &this->normals[0], GL_STATIC_DRAW);
 
 	//texture
 	glGenBuffers(1, &this->TexBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->TexBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2)*this->texcoords.size(), &this->texcoords[0], GL_STATIC_DRAW);
 	//cout << texcoords.size() << endl;
 
 	//tangent bitangent
 	glGenBuffers(1, &this->TangentID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TangentID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->TangentID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->tangents.size(), &this->tangents[0], GL_STATIC_DRAW);		
 }
 
@@ -126,72 +214,76 @@ void Model::initialize(DRAW_TYPE type,  GLuint program)
 {
 	this->GLSLProgramID = program;
 	this->type = type;
+	this->compute_bounds();
 
 	glGenVertexArrays(1, &this->VertexArrayID);
-	glBindVertexArray(this->VertexArrayID);
+	glState.bind_vertex_array(this->VertexArrayID);
 
 	glGenBuffers(1, &this->VertexBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->VertexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->VertexBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->vertices.size(), &this->vertices[0], GL_STATIC_DRAW);
 
 	if (this->type == DRAW_TYPE::INDEX)
 	{
 		glGenBuffers(1, &this->IndexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
+		glState.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*this->indices.size(), &this->indices[0], GL_STATIC_DRAW);
 	}
 
 	//TODO: generate/bind buffer for colors and store the color values
 	glGenBuffers(1, &this->ColorBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->ColorBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->ColorBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->colors.size(), &this->colors[0], GL_STATIC_DRAW);
 
 	//TODO: generate/bind buffer for normals and store the normal values
 	glGenBuffers(1, &this->NormalBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->NormalBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->NormalBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->normals.size(), &this->normals[0], GL_STATIC_DRAW);
 
 	//texture
 	glGenBuffers(1, &this->TexBufferID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->TexBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2)*this->texcoords.size(), &this->texcoords[0], GL_STATIC_DRAW);	
 
 	//tangent bitangent
 	glGenBuffers(1, &this->TangentID);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TangentID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->TangentID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*this->tangents.size(), &this->tangents[0], GL_STATIC_DRAW);		
 }
 void Model::initialize(DRAW_TYPE type, Model model){
 	this->GLSLProgramID = model.GLSLProgramID;
 	this->type = type;
+	this->boundsMin = model.boundsMin;
+	this->boundsMax = model.boundsMax;
+	this->boundsRadius = model.boundsRadius;
 	
 	this->VertexArrayID = model.VertexArrayID;
-	glBindVertexArray(this->VertexArrayID);
+	glState.bind_vertex_array(this->VertexArrayID);
 	
 	
 	this->VertexBufferID = model.VertexBufferID;
-	glBindBuffer(GL_ARRAY_BUFFER, this->VertexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->VertexBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*model.vertices.size(), &model.vertices[0], GL_STATIC_DRAW);
 
 	//TODO: generate/bind buffer for colors and store the color values	
 	this->ColorBufferID = model.ColorBufferID;
-	glBindBuffer(GL_ARRAY_BUFFER, this->ColorBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->ColorBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*model.colors.size(), &model.colors[0], GL_STATIC_DRAW);
 
 	//TODO: generate/bind buffer for normals and store the normal values	
 	this->NormalBufferID = model.ColorBufferID;
-	glBindBuffer(GL_ARRAY_BUFFER, this->NormalBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->NormalBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*model.normals.size(), &model.normals[0], GL_STATIC_DRAW);
 	
 	//TODO: texture coordinate
 	this->TexBufferID = model.TexBufferID;	
-	glBindBuffer(GL_ARRAY_BUFFER, this->TexBufferID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->TexBufferID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2)*model.texcoords.size(), &model.texcoords[0], GL_STATIC_DRAW);	
 
 	//tangent
 	this->TangentID = model.TangentID;
 	
-	glBindBuffer(GL_ARRAY_BUFFER, this->TangentID);
+	glState.bind_buffer(GL_ARRAY_BUFFER, this->TangentID);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*model.tangents.size(), &model.tangents[0], GL_STATIC_DRAW);		
 }
 void Model::initialize_picking(const char* picking_vertex_shader, const char* picking_fragment_shader)
@@ -199,6 +291,11 @@ void Model::initialize_picking(const char* picking_vertex_shader, const char* pi
 	this->PickingProgramID = LoadShaders(picking_vertex_shader, picking_fragment_shader);
 }
 
+void Model::initialize_picking(const char* picking_vertex_shader, const char* picking_fragment_shader, const ShaderPermutation& permutation)
+{
+	this->PickingProgramID = LoadShaders(picking_vertex_shader, picking_fragment_shader, permutation);
+}
+
 bool Model::loadOBJ(const char * path,	glm::vec3 color){
 	cout << "Loading OBJ file " << path << "..." << endl;
 	vector<GLushort> elements;
@@ -439,85 +536,70 @@ bool Model::loadOBJ2(const char * path){
 
 void Model::draw()
 {	
-	GLuint ProjectionID = glGetUniformLocation(this->GLSLProgramID, "Projection");
-	GLuint EyeID = glGetUniformLocation(this->GLSLProgramID, "Eye");
-	GLuint ModelTransformID = glGetUniformLocation(this->GLSLProgramID, "ModelTransform");
+	ProfileScope cpuScope("Model::draw");
+	GpuProfileScope gpuScope("Model::draw");
+	GLint ProjectionID = GetUniformLocation(this->GLSLProgramID, "Projection");
+	GLint EyeID = GetUniformLocation(this->GLSLProgramID, "Eye");
+	GLint ModelTransformID = GetUniformLocation(this->GLSLProgramID, "ModelTransform");
 
 	glUniformMatrix4fv(ProjectionID, 1, GL_FALSE, &(*(this->Projection))[0][0]);
 	glUniformMatrix4fv(EyeID, 1, GL_FALSE, &(*(this->Eye))[0][0]);
 	glUniformMatrix4fv(ModelTransformID, 1, GL_FALSE, &(*(this->ModelTransform))[0][0]);
 
-	glBindVertexArray(this->VertexArrayID);
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, this->VertexBufferID);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), ((GLvoid*)(0)));
+	glState.bind_vertex_array(this->VertexArrayID);
+	glState.vertex_attrib(0, this->VertexBufferID, 3, sizeof(glm::vec3), 0);
 
 	//TODO: pass the color values to vertex shader
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, this->ColorBufferID);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), ((GLvoid*)(0)));
+	glState.vertex_attrib(2, this->ColorBufferID, 3, sizeof(glm::vec3), 0);
 
 	//TODO: pass the normal values to vertex shader
-	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, this->NormalBufferID);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), ((GLvoid*)(0)));
+	glState.vertex_attrib(1, this->NormalBufferID, 3, sizeof(glm::vec3), 0);
 	
 	//texture
-	glEnableVertexAttribArray(3);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TexBufferID);
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glState.vertex_attrib(3, this->TexBufferID, 2, 0, 0);
 
 
 	//tangent bitangent	
-	glEnableVertexAttribArray(4);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TangentID);
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glState.vertex_attrib(4, this->TangentID, 3, 0, 0);
+
+	this->bind_single_instance(this->GLSLProgramID, *(this->ModelTransform));
 		
 	if (this->type == DRAW_TYPE::ARRAY)
 	{
 		glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
 	}
 	else {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
+		glState.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
 		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, ((GLvoid *)0));
 	}	
 }
 
 void Model::draw2(Model model)
 {	
-	GLuint ProjectionID = glGetUniformLocation(this->GLSLProgramID, "Projection");
-	GLuint EyeID = glGetUniformLocation(this->GLSLProgramID, "Eye");
-	GLuint ModelTransformID = glGetUniformLocation(this->GLSLProgramID, "ModelTransform");
+	GLint ProjectionID = GetUniformLocation(this->GLSLProgramID, "Projection");
+	GLint EyeID = GetUniformLocation(this->GLSLProgramID, "Eye");
+	GLint ModelTransformID = GetUniformLocation(this->GLSLProgramID, "ModelTransform");
 
 	glUniformMatrix4fv(ProjectionID, 1, GL_FALSE, &(*(this->Projection))[0][0]);
 	glUniformMatrix4fv(EyeID, 1, GL_FALSE, &(*(this->Eye))[0][0]);
 	glUniformMatrix4fv(ModelTransformID, 1, GL_FALSE, &(*(this->ModelTransform))[0][0]);
 
-	glBindVertexArray(this->VertexArrayID);
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, this->VertexBufferID);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), ((GLvoid*)(0)));
+	glState.bind_vertex_array(this->VertexArrayID);
+	glState.vertex_attrib(0, this->VertexBufferID, 3, sizeof(glm::vec3), 0);
 
 	//TODO: pass the color values to vertex shader
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, this->ColorBufferID);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), ((GLvoid*)(0)));
+	glState.vertex_attrib(2, this->ColorBufferID, 3, sizeof(glm::vec3), 0);
 
 	//TODO: pass the normal values to vertex shader
-	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, this->NormalBufferID);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), ((GLvoid*)(0)));
+	glState.vertex_attrib(1, this->NormalBufferID, 3, sizeof(glm::vec3), 0);
 
 	//texture
-	glEnableVertexAttribArray(3);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TexBufferID);
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glState.vertex_attrib(3, this->TexBufferID, 2, 0, 0);
 
 	//tangent bitangent	
-	glEnableVertexAttribArray(4);
-	glBindBuffer(GL_ARRAY_BUFFER, this->TangentID);
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-	
+	glState.vertex_attrib(4, this->TangentID, 3, 0, 0);
+
+	this->bind_single_instance(this->GLSLProgramID, *(this->ModelTransform));
 
 	if (this->type == DRAW_TYPE::ARRAY)
 	{
@@ -525,43 +607,182 @@ void Model::draw2(Model model)
 	}	
 }
 
+void Model::drawInstanced(const glm::mat4* transforms, int count, const float* opacities, const glm::mat4* previousTransforms)
+{
+	if (count <= 0)
+		return;
+	ProfileScope cpuScope("Model::drawInstanced");
+	GpuProfileScope gpuScope("Model::drawInstanced");
+
+	// The caller binds the program, like for draw(), through glState
+	GLuint program = glState.current_program();
+	glUniformMatrix4fv(GetUniformLocation(program, "Projection"), 1, GL_FALSE, &(*(this->Projection))[0][0]);
+	glUniformMatrix4fv(GetUniformLocation(program, "Eye"), 1, GL_FALSE, &(*(this->Eye))[0][0]);
+
+	glState.bind_vertex_array(this->VertexArrayID);
+	glState.vertex_attrib(0, this->VertexBufferID, 3, sizeof(glm::vec3), 0);
+
+	//TODO: pass the color values to vertex shader
+	glState.vertex_attrib(2, this->ColorBufferID, 3, sizeof(glm::vec3), 0);
+
+	//TODO: pass the normal values to vertex shader
+	glState.vertex_attrib(1, this->NormalBufferID, 3, sizeof(glm::vec3), 0);
+
+	glState.vertex_attrib(3, this->TexBufferID, 2, 0, 0);
+
+	glState.vertex_attrib(4, this->TangentID, 3, 0, 0);
+
+	this->bind_instances(transforms, opacities, previousTransforms, count);
+
+	if (this->type == DRAW_TYPE::ARRAY)
+	{
+		glDrawArraysInstanced(GL_TRIANGLES, 0, this->vertices.size(), count);
+	}
+	else {
+		glState.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
+		glDrawElementsInstanced(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, ((GLvoid *)0), count);
+	}
+}
+
+void pack_instances(std::vector<float>& data, const glm::mat4* transforms, const float* opacities,
+	const glm::mat4* previousTransforms, int count)
+{
+	data.resize(count * FLOATS_PER_INSTANCE);
+	for (int i = 0; i < count; ++i)
+	{
+		float* instance = &data[i * FLOATS_PER_INSTANCE];
+		const glm::mat4& previous = previousTransforms ? previousTransforms[i] : transforms[i];
+		for (int c = 0; c < 4; ++c)
+			for (int r = 0; r < 4; ++r)
+			{
+				instance[c * 4 + r] = transforms[i][c][r];
+				instance[17 + c * 4 + r] = previous[c][r];
+			}
+		instance[16] = opacities ? opacities[i] : 1.0f;
+	}
+}
+
+void bind_instance_attributes(GLuint buffer, GLintptr offset)
+{
+	GLsizei stride = FLOATS_PER_INSTANCE * sizeof(float);
+	for (int c = 0; c < 4; ++c)
+	{
+		glState.vertex_attrib(5 + c, buffer, 4, stride, offset + c * 4 * sizeof(float), 1);
+		glState.vertex_attrib(10 + c, buffer, 4, stride, offset + (17 + c * 4) * sizeof(float), 1);
+	}
+	glState.vertex_attrib(9, buffer, 1, stride, offset + 16 * sizeof(float), 1);
+}
+
+// Per instance attributes from a buffer, advancing once per instance
+void Model::bind_instances(const glm::mat4* transforms, const float* opacities, const glm::mat4* previousTransforms, int count)
+{
+	pack_instances(this->instanceData, transforms, opacities, previousTransforms, count);
+
+	// Into this frame's slice of the ring, or the model's own buffer without one
+	GLsizeiptr size = sizeof(float) * this->instanceData.size();
+	GLintptr offset = (frameRing != NULL) ? frameRing->upload(&this->instanceData[0], size) : -1;
+	GLuint buffer;
+	if (offset >= 0)
+		buffer = frameRing->buffer;
+	else
+	{
+		if (this->InstanceBufferID == 0)
+			glGenBuffers(1, &this->InstanceBufferID);
+		glState.bind_buffer(GL_ARRAY_BUFFER, this->InstanceBufferID);
+		glBufferData(GL_ARRAY_BUFFER, size, &this->instanceData[0], GL_STREAM_DRAW);
+		buffer = this->InstanceBufferID;
+		offset = 0;
+	}
+	bind_instance_attributes(buffer, offset);
+}
+
+// Constant instance attributes, so programs built with INSTANCED also draw single models.
+// Other programs take ModelTransform as a uniform and need none of this. The arrays are disabled
+// in the bound vertex array, which may be shared with instanced draws. A single model has not
+// moved as far as the velocity output goes.
+void Model::bind_single_instance(GLuint program, const glm::mat4& transform)
+{
+	if (GetAttribLocation(program, "ModelTransform") < 0)
+		return;
+	bool velocity = GetAttribLocation(program, "PreviousModelTransform") >= 0;
+
+	for (int c = 0; c < 4; ++c)
+	{
+		glState.disable_vertex_attrib(5 + c);
+		glState.vertex_attrib_value(5 + c, &transform[c][0]);
+		if (velocity)
+		{
+			glState.disable_vertex_attrib(10 + c);
+			glState.vertex_attrib_value(10 + c, &transform[c][0]);
+		}
+	}
+	const GLfloat opaque[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+	glState.disable_vertex_attrib(9);
+	glState.vertex_attrib_value(9, opaque);
+}
+
 void Model::drawPicking()
+{
+	this->drawPicking(*(this->Projection));
+}
+
+// projection is usually the pick_projection around the cursor
+void Model::drawPicking(const glm::mat4& projection)
 {
 	if (this->objectID >= 0) 
 	{
-		glUseProgram(this->PickingProgramID);
-		GLuint ProjectionID = glGetUniformLocation(this->PickingProgramID, "Projection");
-		GLuint EyeID = glGetUniformLocation(this->PickingProgramID, "Eye");
-		GLuint ModelTransformID = glGetUniformLocation(this->PickingProgramID, "ModelTransform");
-		GLuint objectIDLoc = glGetUniformLocation(this->PickingProgramID, "objectID");
+		glState.use_program(this->PickingProgramID);
+		GLint ProjectionID = GetUniformLocation(this->PickingProgramID, "Projection");
+		GLint EyeID = GetUniformLocation(this->PickingProgramID, "Eye");
+		GLint ModelTransformID = GetUniformLocation(this->PickingProgramID, "ModelTransform");
+		GLint objectIDLoc = GetUniformLocation(this->PickingProgramID, "objectID");
 
-		glUniformMatrix4fv(ProjectionID, 1, GL_FALSE, &(*(this->Projection))[0][0]);
+		glUniformMatrix4fv(ProjectionID, 1, GL_FALSE, &projection[0][0]);
 		glUniformMatrix4fv(EyeID, 1, GL_FALSE, &(*(this->Eye))[0][0]);
 		glUniformMatrix4fv(ModelTransformID, 1, GL_FALSE, &(*(this->ModelTransform))[0][0]);
-		
-		float r = ((objectID >> 16) & 0xFF) / 255.0f;
-		float g = ((objectID >> 8) & 0xFF) / 255.0f;
-		float b = (objectID & 0xFF) / 255.0f;
 
-		glm::vec3 objectIDVector = glm::vec3(r,g,b);
-		glUniform3f(objectIDLoc, objectIDVector.x, objectIDVector.y, objectIDVector.z);
+		// Written as is into the GL_R32UI picking target
+		glUniform1ui(objectIDLoc, (GLuint)this->objectID);
 
-		glBindVertexArray(this->VertexArrayID);
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, this->VertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), ((GLvoid*)(0)));
+		glState.bind_vertex_array(this->VertexArrayID);
+		glState.vertex_attrib(0, this->VertexBufferID, 3, sizeof(glm::vec3), 0);
+		this->bind_single_instance(this->PickingProgramID, *(this->ModelTransform));
 
 		if (this->type == DRAW_TYPE::ARRAY)
 		{
 			glDrawArrays(GL_TRIANGLES, 0, this->vertices.size());
 		}
 		else {
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
+			glState.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
 			glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, ((GLvoid *)0));
 		}
 	}
 }
 
+void Model::drawPickingInstanced(const glm::mat4& projection, const glm::mat4* transforms, int count)
+{
+	if (this->objectID < 0 || count <= 0)
+		return;
+
+	glState.use_program(this->PickingProgramID);
+	glUniformMatrix4fv(GetUniformLocation(this->PickingProgramID, "Projection"), 1, GL_FALSE, &projection[0][0]);
+	glUniformMatrix4fv(GetUniformLocation(this->PickingProgramID, "Eye"), 1, GL_FALSE, &(*(this->Eye))[0][0]);
+	glUniform1ui(GetUniformLocation(this->PickingProgramID, "objectID"), (GLuint)this->objectID);
+
+	glState.bind_vertex_array(this->VertexArrayID);
+	glState.vertex_attrib(0, this->VertexBufferID, 3, sizeof(glm::vec3), 0);
+	this->bind_instances(transforms, NULL, NULL, count);
+
+	if (this->type == DRAW_TYPE::ARRAY)
+	{
+		glDrawArraysInstanced(GL_TRIANGLES, 0, this->vertices.size(), count);
+	}
+	else {
+		glState.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, this->IndexBufferID);
+		glDrawElementsInstanced(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, ((GLvoid *)0), count);
+	}
+}
+
 void Model::cleanup()
 {
 	// Clean up data structures
@@ -578,22 +799,28 @@ void Model::cleanup()
 	this->colors.shrink_to_fit();
 
 	// Cleanup VBO and shader
-	glDisableVertexAttribArray(0);
+	glState.disable_vertex_attrib(0);
+	glState.delete_buffer(this->VertexBufferID);
 	glDeleteBuffers(1, &this->VertexBufferID);
 	
 	//TODO: delete color buffer
-	glDisableVertexAttribArray(2);
+	glState.disable_vertex_attrib(2);
+	glState.delete_buffer(this->ColorBufferID);
 	glDeleteBuffers(1, &this->ColorBufferID);
 	
 	//TODO: delete normal buffer
-	glDisableVertexAttribArray(1);
+	glState.disable_vertex_attrib(1);
+	glState.delete_buffer(this->NormalBufferID);
 	glDeleteBuffers(1, &this->NormalBufferID);
 	
-	glDisableVertexAttribArray(3);
+	glState.disable_vertex_attrib(3);
+	glState.delete_buffer(this->TexBufferID);
 	glDeleteBuffers(1, &this->TexBufferID);
 
 		
-	if (this->type == DRAW_TYPE::INDEX) glDeleteBuffers(1, &this->IndexBufferID);
-	glDeleteProgram(this->GLSLProgramID);
+	if (this->type == DRAW_TYPE::INDEX) { glState.delete_buffer(this->IndexBufferID); glDeleteBuffers(1, &this->IndexBufferID); }
+	if (this->InstanceBufferID != 0) { glState.delete_buffer(this->InstanceBufferID); glDeleteBuffers(1, &this->InstanceBufferID); }
+	ReleaseShaders(this->GLSLProgramID);
+	glState.delete_vertex_array(this->VertexArrayID);
 	glDeleteVertexArrays(1, &this->VertexArrayID);	
 }
\ No newline at end of file
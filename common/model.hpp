@@ -5,11 +5,23 @@
 #include <vector>
 #include <glm/glm.hpp>
 
+struct ShaderPermutation;
+
 enum DRAW_TYPE {
 	ARRAY,
 	INDEX
 };
 
+// Per instance attributes of ShaderPermutation::instanced programs (common/instancing.glsl):
+// ModelTransform at locations 5-8, opacity at 9 and PreviousModelTransform at 10-13
+#define FLOATS_PER_INSTANCE 33
+
+// previousTransforms may be NULL when nothing moved, opacities NULL for all 1
+void pack_instances(std::vector<float>& data, const glm::mat4* transforms, const float* opacities,
+	const glm::mat4* previousTransforms, int count);
+// Points the instance attributes of the bound vertex array at packed instances in buffer
+void bind_instance_attributes(GLuint buffer, GLintptr offset);
+
 class Model {
 	std::vector<glm::vec3> vertices;
 	std::vector<unsigned int> indices;
@@ -24,6 +36,17 @@ class Model {
 	
 	DRAW_TYPE type;	
 
+	// Model space bounds, computed by initialize(); the sphere is centered on the box
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	float boundsRadius;
+	void compute_bounds(void);
+
+	// Instanced draws, see FLOATS_PER_INSTANCE
+	std::vector<float> instanceData;
+	void bind_instances(const glm::mat4* transforms, const float* opacities, const glm::mat4* previousTransforms, int count);
+	void bind_single_instance(GLuint program, const glm::mat4& transform);
+
 public:
 	GLuint GLSLProgramID;
 	GLuint PickingProgramID;
@@ -34,6 +57,7 @@ public:
 	GLuint ColorBufferID;
 	GLuint TexBufferID;
 	GLuint TangentID;	
+	GLuint InstanceBufferID = 0;
 	int objectID = -1;	
 
 	Model();
@@ -51,15 +75,34 @@ public:
 	void add_tangent(glm::vec3);
 	void set_projection(glm::mat4*);
 	void set_eye(glm::mat4*);
+	glm::mat4* get_projection(void);
+	glm::mat4* get_eye(void);
 	glm::mat4* get_model(void);
+	const std::vector<glm::vec3>& get_vertices(void) const;
+	const std::vector<unsigned int>& get_indices(void) const;
+	const std::vector<glm::vec3>& get_normals(void) const;
+	const std::vector<glm::vec3>& get_colors(void) const;
+	const std::vector<glm::vec2>& get_texcoords(void) const;
+	const std::vector<glm::vec3>& get_tangents(void) const;
+	glm::vec3 get_bounds_min(void) const;
+	glm::vec3 get_bounds_max(void) const;
+	float get_bounds_radius(void) const;
 	void set_model(glm::mat4*);
 	void initialize(DRAW_TYPE, const char *, const char *);
 	void initialize(DRAW_TYPE, GLuint);
 	void initialize(DRAW_TYPE, Model);
 	void initialize_picking(const char *, const char *);
+	void initialize_picking(const char *, const char *, const ShaderPermutation&);
 	void draw(void);
 	void draw2(Model );
 	void drawPicking(void);
+	void drawPicking(const glm::mat4&);
+	// One draw call for count copies of this model. The program bound with glState.use_program
+	// must be built with ShaderPermutation::instanced; opacities may be NULL for all 1.
+	// previousTransforms are last frame's, for ShaderPermutation::velocity; NULL when unchanged.
+	void drawInstanced(const glm::mat4* transforms, int count, const float* opacities = NULL, const glm::mat4* previousTransforms = NULL);
+	// Instance i gets the picking ID objectID + i
+	void drawPickingInstanced(const glm::mat4& projection, const glm::mat4* transforms, int count);
 	void cleanup(void);			
 };
 
@@ -0,0 +1,361 @@
+#include <iostream>
+#include <exception>
+
+#include <common/picking.hpp>
+
+GLuint picking_fbo;
+GLuint picking_tex;
+GLuint picking_depth;
+
+GLuint picking_query_fbo = 0;
+GLuint picking_query_depth = 0;
+int picking_query_width = 0, picking_query_height = 0;
+
+PickRequest pick_requests[MAX_PICK_REQUESTS];
+PickRequest* current_pick = NULL;
+
+void picking_initialize()
+{
+	glGenFramebuffers(1, &picking_fbo);
+	glState.bind_framebuffer(GL_FRAMEBUFFER, picking_fbo);
+
+	// Object IDs, 0 is the background
+	glGenTextures(1, &picking_tex);
+	glState.bind_texture(0, GL_TEXTURE_2D, picking_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, PICKING_FBO_SIZE, PICKING_FBO_SIZE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, picking_tex, 0);
+
+	// The nearest object has to win
+	glGenRenderbuffers(1, &picking_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, picking_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, PICKING_FBO_SIZE, PICKING_FBO_SIZE);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, picking_depth);
+
+	glReadBuffer(GL_NONE);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "ERROR: Framebuffer is not complete" << std::endl;
+		std::cin.get();
+		std::terminate();
+	}
+
+	// Unbind this framebuffer
+	glState.bind_texture(0, GL_TEXTURE_2D, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glState.bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+glm::mat4 pick_projection(const glm::mat4& projection, int x, int y, int width, int height, int frameBufferWidth, int frameBufferHeight)
+{
+	float sx = (float)frameBufferWidth / (float)width;
+	float sy = (float)frameBufferHeight / (float)height;
+
+	// Region center in normalized device coordinates
+	float cx = 2.0f * (x + 0.5f * width) / frameBufferWidth - 1.0f;
+	float cy = 2.0f * (y + 0.5f * height) / frameBufferHeight - 1.0f;
+
+	return glm::translate(-cx * sx, -cy * sy, 0.0f) * glm::scale(sx, sy, 1.0f) * projection;
+}
+
+PickRequest* free_pick_request()
+{
+	for (int i = 0; i < MAX_PICK_REQUESTS; ++i)
+		if (!pick_requests[i].queued && pick_requests[i].fence == 0)
+			return &pick_requests[i];
+	return NULL;
+}
+
+bool request_pick(int xpos, int ypos, int frameBufferWidth, int frameBufferHeight, pick_callback callback)
+{
+	PickRequest* request = free_pick_request();
+	if (request == NULL)
+		return false;
+
+	request->x = glm::clamp(xpos, 0, frameBufferWidth - 1);
+	request->y = frameBufferHeight - glm::clamp(ypos, 0, frameBufferHeight - 1) - 1;
+	request->width = 1;
+	request->height = 1;
+	request->mode = PICK_HISTOGRAM;
+	request->pass = 0;
+	request->callback = callback;
+	request->regionCallback = NULL;
+	request->queued = true;
+	return true;
+}
+
+bool request_pick_region(int x0, int y0, int x1, int y1, int frameBufferWidth, int frameBufferHeight, pick_region_callback callback)
+{
+	int left = glm::clamp(glm::min(x0, x1), 0, frameBufferWidth - 1);
+	int right = glm::clamp(glm::max(x0, x1), 0, frameBufferWidth - 1);
+	int top = glm::clamp(glm::min(y0, y1), 0, frameBufferHeight - 1);
+	int bottom = glm::clamp(glm::max(y0, y1), 0, frameBufferHeight - 1);
+
+	PickRequest* request = free_pick_request();
+	if (request == NULL)
+		return false;
+
+	request->x = left;
+	request->y = frameBufferHeight - bottom - 1;
+	request->width = right - left + 1;
+	request->height = bottom - top + 1;
+	request->mode = (request->width <= PICKING_FBO_SIZE && request->height <= PICKING_FBO_SIZE) ? PICK_HISTOGRAM : PICK_QUERIES;
+	request->pass = 0;
+	request->callback = NULL;
+	request->regionCallback = callback;
+	request->numQueries = 0;
+	request->queued = true;
+	return true;
+}
+
+void picking_query_target(int width, int height)
+{
+	if (picking_query_fbo != 0 && width <= picking_query_width && height <= picking_query_height)
+		return;
+
+	if (picking_query_fbo == 0)
+	{
+		glGenFramebuffers(1, &picking_query_fbo);
+		glGenRenderbuffers(1, &picking_query_depth);
+	}
+	picking_query_width = glm::max(width, picking_query_width);
+	picking_query_height = glm::max(height, picking_query_height);
+
+	glState.bind_framebuffer(GL_FRAMEBUFFER, picking_query_fbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, picking_query_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, picking_query_width, picking_query_height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, picking_query_depth);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR: Picking query framebuffer is not complete" << std::endl;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glState.bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool next_picking_pass(const glm::mat4& projection, int frameBufferWidth, int frameBufferHeight, glm::mat4& pickProjection)
+{
+	current_pick = NULL;
+	for (int i = 0; i < MAX_PICK_REQUESTS && current_pick == NULL; ++i)
+		if (pick_requests[i].queued)
+			current_pick = &pick_requests[i];
+	if (current_pick == NULL)
+		return false;
+
+	int width = current_pick->width, height = current_pick->height;
+	pickProjection = pick_projection(projection, current_pick->x, current_pick->y, width, height, frameBufferWidth, frameBufferHeight);
+
+	if (current_pick->mode == PICK_QUERIES)
+	{
+		picking_query_target(width, height);
+		glState.bind_framebuffer(GL_FRAMEBUFFER, picking_query_fbo);
+		glViewport(0, 0, width, height);
+		glState.enable(GL_SCISSOR_TEST, true);
+		glScissor(0, 0, width, height);
+
+		if (current_pick->pass == 0)
+			glClear(GL_DEPTH_BUFFER_BIT);
+		else
+		{
+			// Only the front most surfaces pass against the depth of the first pass
+			glState.depth_func(GL_LEQUAL);
+			glState.depth_mask(false);
+			current_pick->numQueries = 0;
+		}
+		return true;
+	}
+
+	glState.bind_framebuffer(GL_FRAMEBUFFER, picking_fbo);
+	glViewport(0, 0, width, height);
+	glState.enable(GL_SCISSOR_TEST, true);
+	glScissor(0, 0, width, height);
+
+	// Background: objectID 0
+	const GLuint background[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, background);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	return true;
+}
+
+void pick_draw(Model& model, const glm::mat4& pickProjection)
+{
+	PickRequest* request = current_pick;
+	if (request == NULL || request->mode != PICK_QUERIES || request->pass != 1)
+	{
+		model.drawPicking(pickProjection);
+		return;
+	}
+
+	if (request->numQueries == (int)request->queries.size())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		request->queries.push_back(query);
+		request->queryIDs.push_back(0);
+	}
+	int n = request->numQueries++;
+	request->queryIDs[n] = model.objectID;
+
+	glBeginQuery(GL_SAMPLES_PASSED, request->queries[n]);
+	model.drawPicking(pickProjection);
+	glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void pick_draw_instanced(Model& model, const glm::mat4& pickProjection, const glm::mat4* transforms, int count)
+{
+	PickRequest* request = current_pick;
+	if (request == NULL || request->mode != PICK_QUERIES || request->pass != 1)
+	{
+		model.drawPickingInstanced(pickProjection, transforms, count);
+		return;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (request->numQueries == (int)request->queries.size())
+		{
+			GLuint query;
+			glGenQueries(1, &query);
+			request->queries.push_back(query);
+			request->queryIDs.push_back(0);
+		}
+		int n = request->numQueries++;
+		request->queryIDs[n] = model.objectID + i;
+
+		glBeginQuery(GL_SAMPLES_PASSED, request->queries[n]);
+		model.drawPickingInstanced(pickProjection, &transforms[i], 1);
+		glEndQuery(GL_SAMPLES_PASSED);
+	}
+}
+
+void end_picking_pass(int frameBufferWidth, int frameBufferHeight)
+{
+	PickRequest* request = current_pick;
+	current_pick = NULL;
+
+	if (request->mode == PICK_QUERIES)
+	{
+		if (request->pass == 0)
+			request->pass = 1; // stays queued for the query pass
+		else
+		{
+			// The query results are available once this fence has passed
+			glState.depth_func(GL_LESS);
+			glState.depth_mask(true);
+			request->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			request->queued = false;
+			request->pass = 0;
+		}
+
+		glState.enable(GL_SCISSOR_TEST, false);
+		glState.bind_framebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, frameBufferWidth, frameBufferHeight);
+		return;
+	}
+
+	if (request->pbo == 0)
+	{
+		glGenBuffers(1, &request->pbo);
+		glState.bind_buffer(GL_PIXEL_PACK_BUFFER, request->pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, PICKING_FBO_SIZE * PICKING_FBO_SIZE * sizeof(GLuint), NULL, GL_STREAM_READ);
+	}
+
+	glState.bind_framebuffer(GL_READ_FRAMEBUFFER, picking_fbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glState.bind_buffer(GL_PIXEL_PACK_BUFFER, request->pbo);
+
+	// With a pack buffer bound this only queues the copy
+	glReadPixels(0, 0, request->width, request->height, GL_RED_INTEGER, GL_UNSIGNED_INT, (GLvoid*)0);
+	request->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	request->queued = false;
+
+	glState.bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+	glReadBuffer(GL_NONE);
+	glState.enable(GL_SCISSOR_TEST, false);
+	glState.bind_framebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, frameBufferWidth, frameBufferHeight);
+}
+
+void poll_picks(bool wait)
+{
+	for (int i = 0; i < MAX_PICK_REQUESTS; ++i)
+	{
+		PickRequest& request = pick_requests[i];
+		if (request.fence == 0)
+			continue;
+
+		GLenum status = glClientWaitSync(request.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+
+		glDeleteSync(request.fence);
+		request.fence = 0;
+
+		std::map<int, int> histogram;
+		if (request.mode == PICK_QUERIES)
+		{
+			for (int n = 0; n < request.numQueries; ++n)
+			{
+				GLuint samples = 0;
+				glGetQueryObjectuiv(request.queries[n], GL_QUERY_RESULT, &samples);
+				if (samples > 0)
+					histogram[request.queryIDs[n]] += (int)samples;
+			}
+		}
+		else
+		{
+			int numPixels = request.width * request.height;
+			glState.bind_buffer(GL_PIXEL_PACK_BUFFER, request.pbo);
+			GLuint* ids = (GLuint*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, numPixels * sizeof(GLuint), GL_MAP_READ_BIT);
+			if (ids)
+			{
+				for (int p = 0; p < numPixels; ++p)
+					if (ids[p] != 0)
+						++histogram[(int)ids[p]];
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			}
+			glState.bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+
+		if (request.regionCallback)
+			request.regionCallback(histogram);
+		else if (request.callback)
+			request.callback(histogram.empty() ? 0 : histogram.begin()->first);
+	}
+}
+
+void delete_picking_resources()
+{
+	for (int i = 0; i < MAX_PICK_REQUESTS; ++i)
+	{
+		if (pick_requests[i].fence)
+			glDeleteSync(pick_requests[i].fence);
+		glDeleteBuffers(1, &pick_requests[i].pbo);
+		if (!pick_requests[i].queries.empty())
+			glDeleteQueries((GLsizei)pick_requests[i].queries.size(), &pick_requests[i].queries[0]);
+		pick_requests[i].fence = 0;
+		pick_requests[i].pbo = 0;
+		pick_requests[i].queries.clear();
+		pick_requests[i].queryIDs.clear();
+		pick_requests[i].queued = false;
+		pick_requests[i].pass = 0;
+	}
+
+	if (picking_query_fbo != 0)
+	{
+		glDeleteRenderbuffers(1, &picking_query_depth);
+		glDeleteFramebuffers(1, &picking_query_fbo);
+		picking_query_fbo = picking_query_depth = 0;
+		picking_query_width = picking_query_height = 0;
+	}
+
+	glDeleteRenderbuffers(1, &picking_depth);
+	glDeleteTextures(1, &picking_tex);
+	glDeleteFramebuffers(1, &picking_fbo);
+}
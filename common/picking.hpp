@@ -1,102 +1,110 @@
 #ifndef PICKING_H
 #define PICKING_H
 
+#include <map>
+#include <vector>
+
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <common/model.hpp>
+#include <common/gl_state.hpp>
 
 // Picking Pass Rendering
-GLuint picking_fbo;
-GLuint picking_tex;
-
-inline void picking_initialize(int frameBufferWidth, int frameBufferHeight)
-{
-	glGenFramebuffers(1, &picking_fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, picking_fbo);
-
-	glGenTextures(1, &picking_tex);
-	glBindTexture(GL_TEXTURE_2D, picking_tex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, frameBufferWidth, frameBufferHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-
-	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, picking_tex, 0);
-
-	glReadBuffer(GL_NONE);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-	{
-		std::cout << "ERROR: Framebuffer is not complete" << std::endl;
-		std::cin.get();
-		std::terminate();
-	}
-
-	// Unbind this framebuffer
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-inline void reallocate_picking_texture(int frameBufferWidth, int frameBufferHeight)
-{
-	glDeleteTextures(1, &picking_tex);
-	glBindFramebuffer(GL_FRAMEBUFFER, picking_fbo);
-
-	glGenTextures(1, &picking_tex);
-	glBindTexture(GL_TEXTURE_2D, picking_tex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, frameBufferWidth, frameBufferHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-
-	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, picking_tex, 0);
-
-	glReadBuffer(GL_NONE);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-	{
-		std::cout << "ERROR: Framebuffer is not complete" << std::endl;
-		std::cin.get();
-		std::terminate();
-	}
-
-	// Unbind this framebuffer
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-inline int pick(int xpos, int ypos, int frameBufferWidth, int frameBufferHeight)
-{
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, picking_fbo);
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-
-	unsigned char pixel[3];
-	glReadPixels(xpos, frameBufferHeight - ypos - 1, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, &pixel);
-
-	int r = (int)pixel[0];
-	int g = (int)pixel[1];
-	int b = (int)pixel[2];
-	int targetID = ((r << 16) & 0xFF0000) + ((g << 8) & 0x00FF00) + b & 0xFF;
-
-	std::cout << r << ", " << g << ", " << b << std::endl;
-	std::cout << targetID << std::endl;
-
-	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-
-	return targetID;
-}
-
-inline void delete_picking_resources()
-{
-	glDeleteTextures(1, &picking_tex);
-	glDeleteFramebuffers(1, &picking_fbo);
-}
+// Picking only renders when a click is pending, into a small integer ID target: the region
+// around the cursor is blown up to the whole target by pick_projection, so its pixels are
+// sampled at the same positions as the full resolution frame.
+#define PICKING_FBO_SIZE 64
+
+extern GLuint picking_fbo;
+extern GLuint picking_tex;
+extern GLuint picking_depth;
+
+// Marquee selection over regions larger than the picking target would have to skip pixels, so
+// those regions are rendered at full resolution into a depth only target instead and every
+// object gets a GL_SAMPLES_PASSED query: one integer per object is read back, not the pixels.
+extern GLuint picking_query_fbo;
+extern GLuint picking_query_depth;
+extern int picking_query_width, picking_query_height;
+
+// Asynchronous picking: the picked IDs are copied into a pixel buffer object and read
+// back once the fence behind the copy has passed, one or two frames later, so a click
+// never waits for the GPU to drain.
+typedef void (*pick_callback)(int targetID);
+// Object ID -> number of its visible pixels in the region, the background is left out
+typedef void (*pick_region_callback)(const std::map<int, int>& histogram);
+
+enum PICK_MODE {
+	PICK_HISTOGRAM, // read back the IDs of every pixel and count them on the CPU
+	PICK_QUERIES    // depth pass, then one occlusion query per object (see pick_draw)
+};
+
+struct PickRequest {
+	// Region in framebuffer pixels, origin at the bottom left
+	int x, y;
+	int width, height;
+	PICK_MODE mode;
+	int pass;               // PICK_QUERIES: 0 lays down depth, 1 runs the queries
+	bool queued;
+	GLuint pbo;
+	GLsync fence;
+	pick_callback callback;
+	pick_region_callback regionCallback;
+	// PICK_QUERIES: queries[i] counts the samples of the object with ID queryIDs[i]
+	std::vector<GLuint> queries;
+	std::vector<int> queryIDs;
+	int numQueries;
+};
+
+#define MAX_PICK_REQUESTS 4
+extern PickRequest pick_requests[MAX_PICK_REQUESTS];
+extern PickRequest* current_pick;
+
+void picking_initialize();
+
+// Projection that maps the given framebuffer region (origin at the bottom left) onto the whole viewport
+glm::mat4 pick_projection(const glm::mat4& projection, int x, int y, int width, int height, int frameBufferWidth, int frameBufferHeight);
+
+PickRequest* free_pick_request();
+
+// Asks for the object ID under the cursor (origin at the top left, clamped to the framebuffer);
+// callback gets it from poll_picks. Nothing is drawn or read here. Returns false when MAX_PICK_REQUESTS picks are already in flight.
+bool request_pick(int xpos, int ypos, int frameBufferWidth, int frameBufferHeight, pick_callback callback);
+
+// Asks for every object inside the rectangle between two cursor positions (origin at the top left).
+// Regions that fit the picking target are histogrammed, larger ones use occlusion queries.
+bool request_pick_region(int x0, int y0, int x1, int y1, int frameBufferWidth, int frameBufferHeight, pick_region_callback callback);
+
+// Grows the depth only target of PICK_QUERIES to at least width x height
+void picking_query_target(int width, int height);
+
+// Starts the picking pass of the next pending request. Returns false when there is none,
+// otherwise binds the picking target and sets projection to the one to draw the IDs with:
+//
+//	while (next_picking_pass(Projection, w, h, pickProjection)) {
+//		pick_draw(model, pickProjection); ...
+//		end_picking_pass(w, h);
+//	}
+//
+// PICK_QUERIES requests take two passes, the loop runs once for each.
+bool next_picking_pass(const glm::mat4& projection, int frameBufferWidth, int frameBufferHeight, glm::mat4& pickProjection);
+
+// Draws a model in the current picking pass, wrapped in its occlusion query when the pass needs one
+void pick_draw(Model& model, const glm::mat4& pickProjection);
+
+// pick_draw for count instances of model with the IDs model.objectID + instance. The query
+// pass needs one query per object, so it draws the instances one at a time.
+void pick_draw_instanced(Model& model, const glm::mat4& pickProjection, const glm::mat4* transforms, int count);
+
+// Queues the copy of the IDs of the current pass and restores the default framebuffer
+void end_picking_pass(int frameBufferWidth, int frameBufferHeight);
+
+// Call once per frame; runs the callbacks of the reads the GPU has finished, never blocks.
+// With wait it waits for every read instead, so picks land the frame after they were drawn
+// whatever the GPU's speed (input replays).
+void poll_picks(bool wait = false);
+
+void delete_picking_resources();
 
 #endif
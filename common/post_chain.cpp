@@ -0,0 +1,181 @@
+#include <GL/glew.h>
+
+#include <common/post_chain.hpp>
+#include <common/shader.hpp>
+#include <common/gl_state.hpp>
+#include <common/profiler.hpp>
+#include <common/gl_counters.hpp>
+
+PostChain::PostChain() : width(1), height(1), quadVertexArray(0), quadBuffer(0), allocations(0)
+{
+}
+
+void PostChain::initialize()
+{
+	static const GLfloat quad[] = {
+		-1.0f, -1.0f, 0.0f,
+		1.0f, -1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f,
+		1.0f, -1.0f, 0.0f,
+		1.0f,  1.0f, 0.0f,
+	};
+
+	glGenVertexArrays(1, &quadVertexArray);
+	glState.bind_vertex_array(quadVertexArray);
+	glGenBuffers(1, &quadBuffer);
+	glState.bind_buffer(GL_ARRAY_BUFFER, quadBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glState.vertex_attrib(0, quadBuffer, 3, 0, 0);
+}
+
+int PostChain::add(const PostEffect& effect)
+{
+	effects.push_back(effect);
+	return (int)effects.size() - 1;
+}
+
+void PostChain::resize(int width, int height)
+{
+	this->width = width > 0 ? width : 1;
+	this->height = height > 0 ? height : 1;
+}
+
+// A free target of that size, else a free one reallocated to it, else a new one
+int PostChain::acquire(int width, int height, GLenum filter)
+{
+	int found = -1;
+	for (size_t i = 0; i < pool.size() && found < 0; ++i)
+		if (!pool[i].inUse && pool[i].width == width && pool[i].height == height)
+			found = (int)i;
+	for (size_t i = 0; i < pool.size() && found < 0; ++i)
+		if (!pool[i].inUse)
+			found = (int)i;
+	if (found < 0)
+	{
+		Target target;
+		glGenFramebuffers(1, &target.framebuffer);
+		glGenTextures(1, &target.texture);
+		target.width = target.height = 0;
+		target.filter = 0;
+		pool.push_back(target);
+		found = (int)pool.size() - 1;
+
+		glState.bind_texture(4, GL_TEXTURE_2D, target.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	Target& target = pool[found];
+	target.inUse = true;
+	if (target.width != width || target.height != height)
+	{
+		glState.bind_texture(4, GL_TEXTURE_2D, target.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+		if (target.width == 0)
+		{
+			glState.bind_framebuffer(GL_FRAMEBUFFER, target.framebuffer);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target.texture, 0);
+		}
+		target.width = width;
+		target.height = height;
+		++allocations;
+	}
+	if (target.filter != filter)
+	{
+		glState.bind_texture(4, GL_TEXTURE_2D, target.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		target.filter = filter;
+	}
+	return found;
+}
+
+void PostChain::draw_quad()
+{
+	glState.bind_vertex_array(quadVertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+void PostChain::run(GLuint inputFramebuffer, GLuint inputTexture, int inputWidth, int inputHeight, GLuint outputFramebuffer)
+{
+	allocations = 0;
+	active.clear();
+	for (size_t i = 0; i < effects.size(); ++i)
+		if (effects[i].enabled && effects[i].program != 0)
+			active.push_back((int)i);
+
+	int input = -1;         // pool target, -1 for the scene
+	GLuint framebuffer = inputFramebuffer, texture = inputTexture;
+	int w = inputWidth, h = inputHeight;
+	GLenum filter = GL_NEAREST;
+
+	for (size_t k = 0; k < active.size(); ++k)
+	{
+		const PostEffect& effect = effects[active[k]];
+		ProfileScope cpuScope(effect.name);
+		GpuProfileScope gpuScope(effect.name);
+		int outputWidth = effect.width > 0 ? effect.width : (int)(width * effect.scale);
+		int outputHeight = effect.height > 0 ? effect.height : (int)(height * effect.scale);
+		outputWidth = outputWidth > 0 ? outputWidth : 1;
+		outputHeight = outputHeight > 0 ? outputHeight : 1;
+
+		int output = -1;
+		if (k + 1 == active.size() && outputWidth == width && outputHeight == height)
+			glState.bind_framebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+		else
+		{
+			output = acquire(outputWidth, outputHeight, effect.filter);
+			glState.bind_framebuffer(GL_FRAMEBUFFER, pool[output].framebuffer);
+		}
+		glViewport(0, 0, outputWidth, outputHeight);
+
+		glState.use_program(effect.program);
+		glState.bind_texture(4, GL_TEXTURE_2D, texture);
+		glUniform1i(GetUniformLocation(effect.program, "renderedTexture"), 4);
+		if (effect.setup)
+			effect.setup(effect.program);
+		draw_quad();
+
+		release(input);
+		input = output;
+		if (output >= 0)
+		{
+			framebuffer = pool[output].framebuffer;
+			texture = pool[output].texture;
+			w = outputWidth;
+			h = outputHeight;
+			filter = effect.filter;
+		}
+	}
+
+	// Nothing enabled, or the last pass was smaller than the output
+	if (input >= 0 || active.empty())
+	{
+		ProfileScope cpuScope("post blit");
+		GpuProfileScope gpuScope("post blit");
+		glState.bind_framebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glState.bind_framebuffer(GL_DRAW_FRAMEBUFFER, outputFramebuffer);
+		glBlitFramebuffer(0, 0, w, h, 0, 0, width, height, GL_COLOR_BUFFER_BIT, filter);
+		release(input);
+	}
+	glViewport(0, 0, width, height);
+}
+
+void PostChain::cleanup()
+{
+	for (size_t i = 0; i < pool.size(); ++i)
+	{
+		glDeleteFramebuffers(1, &pool[i].framebuffer);
+		glDeleteTextures(1, &pool[i].texture);
+	}
+	pool.clear();
+	if (quadVertexArray != 0)
+	{
+		glState.delete_buffer(quadBuffer);
+		glDeleteBuffers(1, &quadBuffer);
+		glState.delete_vertex_array(quadVertexArray);
+		glDeleteVertexArrays(1, &quadVertexArray);
+	}
+	quadVertexArray = quadBuffer = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef POST_CHAIN_HPP
+#define POST_CHAIN_HPP
+
+#include <vector>
+#include <GL/glew.h>
+
+// Fullscreen passes run in order over the rendered scene. Each pass reads the previous one's
+// output (the scene for the first) from texture unit 4 as "renderedTexture" and draws a quad
+// into a target from a pool; the last pass draws into the output framebuffer.
+//
+// Disabled effects are left out of the chain, not branched over in a shader. Targets are pooled
+// by size: a pass takes a free one and gives back its input, so a chain of any length uses two
+// targets per size (ping-pong), and a resize reallocates the pooled textures instead of creating
+// new ones. A pass with a smaller size (pixelation) renders into a downsampled target; when it
+// ends the chain it is blitted up to the output.
+//
+//	int blur = postChain.add(PostEffect("motion blur", blurProgram, blur_setup));
+//	postChain.resize(width, height);
+//	...
+//	postChain.set_enabled(blur, motionBlurOn);
+//	postChain.run(sceneFramebuffer, sceneTexture, width, height, 0);
+
+struct PostEffect {
+	const char* name;
+	GLuint program;
+	bool enabled;
+	// Output size: width x height when set, else scale times the chain's size
+	int width, height;
+	float scale;
+	// How the next pass samples this output, GL_NEAREST keeps the pixels of a downsampled pass
+	GLenum filter;
+	// Sets the program's own uniforms and textures (units 5 and up), the program is bound
+	void (*setup)(GLuint program);
+
+	PostEffect(const char* name, GLuint program, void (*setup)(GLuint program) = NULL)
+		: name(name), program(program), enabled(true), width(0), height(0), scale(1.0f), filter(GL_LINEAR), setup(setup) {}
+};
+
+class PostChain {
+	struct Target {
+		GLuint framebuffer, texture;
+		int width, height;
+		GLenum filter;
+		bool inUse;
+	};
+	std::vector<PostEffect> effects;
+	std::vector<Target> pool;
+	std::vector<int> active;
+	int width, height;
+	GLuint quadVertexArray, quadBuffer;
+
+	int acquire(int width, int height, GLenum filter);
+	void release(int target) { if (target >= 0) pool[target].inUse = false; }
+	void draw_quad(void);
+
+public:
+	// Targets (re)allocated by the last run(), a resize shows up here once
+	int allocations;
+
+	PostChain();
+
+	// The quad, call once with a current context
+	void initialize(void);
+	// Appends an effect, returns its index
+	int add(const PostEffect& effect);
+	PostEffect& effect(int i) { return effects[i]; }
+	void set_enabled(int i, bool enabled) { effects[i].enabled = enabled; }
+	int size(void) const { return (int)effects.size(); }
+	// Output size; the targets follow on the next run()
+	void resize(int width, int height);
+
+	// input is the scene's color texture and the framebuffer it is attached to (for the blit
+	// when no effect is enabled)
+	void run(GLuint inputFramebuffer, GLuint inputTexture, int inputWidth, int inputHeight, GLuint outputFramebuffer);
+	void cleanup(void);
+};
+
+#endif
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+#include <GL/glew.h>
+
+#include <common/profiler.hpp>
+#include <common/shader.hpp>
+#include <common/gl_state.hpp>
+
+Profiler profiler;
+
+// The overlay, in pixels: a frame's CPU and GPU bars side by side, the height is 33.3 ms
+static const float BAR_WIDTH = 2.0f;
+static const float GRAPH_HEIGHT = 100.0f;
+static const float GRAPH_MS = 1000.0f / 30.0f;
+static const float MARGIN = 8.0f;
+// Trace thread id of the GPU's events
+static const int GPU_THREAD = 1000;
+
+Profiler::Profiler()
+	: currentSlot(NULL), frameGpuQuery(-1), frame(0), frameStart(0.0), gpuOffset(0.0), dropped(0),
+	overlayProgram(0), overlayVertexArray(0), overlayBuffer(0), enabled(false), overlay(false)
+{
+	for (int i = 0; i < NUM_SLOTS; ++i)
+	{
+		slots[i].used = 0;
+		slots[i].frame = -1;
+		slots[i].pending = false;
+	}
+	for (int i = 0; i < HISTORY; ++i)
+	{
+		history[i].cpuMs = history[i].gpuMs = 0.0f;
+		history[i].frame = -1;
+	}
+}
+
+double Profiler::now()
+{
+	using namespace std::chrono;
+	return duration<double, std::micro>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::initialize()
+{
+	GLint64 gpuNs = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpuNs);
+	gpuOffset = now() - gpuNs / 1000.0;
+
+	overlayProgram = LoadShaders("../common/ProfilerVertexShader.glsl", "../common/ProfilerFragmentShader.glsl");
+	glGenVertexArrays(1, &overlayVertexArray);
+	glGenBuffers(1, &overlayBuffer);
+	enabled = true;
+}
+
+void Profiler::cleanup()
+{
+	for (int i = 0; i < NUM_SLOTS; ++i)
+	{
+		for (size_t q = 0; q < slots[i].queries.size(); ++q)
+		{
+			glDeleteQueries(1, &slots[i].queries[q].start);
+			glDeleteQueries(1, &slots[i].queries[q].end);
+		}
+		slots[i].queries.clear();
+		slots[i].pending = false;
+	}
+	if (overlayVertexArray != 0)
+	{
+		glState.delete_buffer(overlayBuffer);
+		glDeleteBuffers(1, &overlayBuffer);
+		glState.delete_vertex_array(overlayVertexArray);
+		glDeleteVertexArrays(1, &overlayVertexArray);
+	}
+	if (overlayProgram != 0)
+		ReleaseShaders(overlayProgram);
+	overlayProgram = overlayVertexArray = overlayBuffer = 0;
+	currentSlot = NULL;
+	// The threads' rings are kept, their threads still point at them
+	enabled = false;
+}
+
+// Made on the first scope a thread ends; only the registration takes the lock
+Profiler::ThreadRing* Profiler::thread_ring()
+{
+	static thread_local ThreadRing* ring = NULL;
+	if (ring == NULL)
+	{
+		ring = new ThreadRing();
+		ring->head = 0;
+		ring->tail = 0;
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		ring->thread = (int)rings.size();
+		rings.push_back(ring);
+	}
+	return ring;
+}
+
+void Profiler::end_cpu(const char* name, double start)
+{
+	ThreadRing* ring = thread_ring();
+	unsigned head = ring->head.load(std::memory_order_relaxed);
+	// Full until end_frame takes the events; the newest are dropped, not the ones being read
+	if (head - ring->tail.load(std::memory_order_acquire) >= RING_CAPACITY)
+	{
+		++dropped;
+		return;
+	}
+	Event& event = ring->events[head % RING_CAPACITY];
+	event.name = name;
+	event.start = start;
+	event.end = now();
+	event.thread = ring->thread;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+int Profiler::begin_gpu(const char* name)
+{
+	if (currentSlot == NULL)
+		return -1;
+	if (currentSlot->used == (int)currentSlot->queries.size())
+	{
+		GpuQuery query;
+		glGenQueries(1, &query.start);
+		glGenQueries(1, &query.end);
+		currentSlot->queries.push_back(query);
+	}
+	GpuQuery& query = currentSlot->queries[currentSlot->used];
+	query.name = name;
+	glQueryCounter(query.start, GL_TIMESTAMP);
+	return currentSlot->used++;
+}
+
+void Profiler::end_gpu(int query)
+{
+	if (currentSlot == NULL || query < 0 || query >= currentSlot->used)
+		return;
+	glQueryCounter(currentSlot->queries[query].end, GL_TIMESTAMP);
+}
+
+void Profiler::begin_frame()
+{
+	if (!enabled)
+		return;
+	frameStart = now();
+	Frame& record = history[frame % HISTORY];
+	record.events.clear();
+	record.cpuMs = record.gpuMs = 0.0f;
+	record.frame = frame;
+
+	// A slot whose results are still out after NUM_SLOTS frames: no GPU times for this frame
+	GpuSlot& slot = slots[frame % NUM_SLOTS];
+	currentSlot = slot.pending ? NULL : &slot;
+	if (currentSlot != NULL)
+	{
+		slot.used = 0;
+		slot.frame = frame;
+	}
+	frameGpuQuery = begin_gpu("Frame");
+}
+
+void Profiler::end_frame()
+{
+	if (!enabled)
+		return;
+	if (currentSlot != NULL)
+	{
+		end_gpu(frameGpuQuery);
+		currentSlot->pending = true;
+		currentSlot = NULL;
+	}
+
+	collect_cpu();
+	Frame& record = history[frame % HISTORY];
+	Event event;
+	event.name = "Frame";
+	event.start = frameStart;
+	event.end = now();
+	event.thread = thread_ring()->thread;
+	record.events.push_back(event);
+	record.cpuMs = (float)((event.end - event.start) / 1000.0);
+
+	collect_gpu();
+	++frame;
+
+	unsigned lost = dropped.exchange(0);
+	if (lost > 0)
+		printf("Profiler: %u events dropped, the rings are full\n", lost);
+}
+
+void Profiler::collect_cpu()
+{
+	Frame& record = history[frame % HISTORY];
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	for (size_t i = 0; i < rings.size(); ++i)
+	{
+		ThreadRing* ring = rings[i];
+		unsigned head = ring->head.load(std::memory_order_acquire);
+		unsigned tail = ring->tail.load(std::memory_order_relaxed);
+		for (; tail != head; ++tail)
+			record.events.push_back(ring->events[tail % RING_CAPACITY]);
+		ring->tail.store(head, std::memory_order_release);
+	}
+}
+
+void Profiler::collect_gpu()
+{
+	// Oldest first; the GPU finishes in order, so the first slot that is not done ends the reads
+	for (int i = 1; i <= NUM_SLOTS; ++i)
+	{
+		GpuSlot& slot = slots[(frame + i) % NUM_SLOTS];
+		if (!slot.pending)
+			continue;
+		if (slot.used > 0)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(slot.queries[slot.used - 1].end, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+		}
+
+		Frame& record = history[slot.frame % HISTORY];
+		for (int q = 0; q < slot.used && record.frame == slot.frame; ++q)
+		{
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(slot.queries[q].start, GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(slot.queries[q].end, GL_QUERY_RESULT, &end);
+			Event event;
+			event.name = slot.queries[q].name;
+			event.start = start / 1000.0 + gpuOffset;
+			event.end = end / 1000.0 + gpuOffset;
+			event.thread = -1;
+			record.events.push_back(event);
+			if (q == 0)
+				record.gpuMs = (float)((end - start) / 1.0e6);
+		}
+		slot.pending = false;
+	}
+}
+
+float Profiler::cpu_ms(int framesAgo) const
+{
+	int index = frame - 1 - framesAgo;
+	if (index < 0 || history[index % HISTORY].frame != index)
+		return 0.0f;
+	return history[index % HISTORY].cpuMs;
+}
+
+float Profiler::gpu_ms(int framesAgo) const
+{
+	int index = frame - 1 - framesAgo;
+	if (index < 0 || history[index % HISTORY].frame != index)
+		return 0.0f;
+	return history[index % HISTORY].gpuMs;
+}
+
+bool Profiler::write_trace(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+	{
+		printf("%s could not be opened for writing.\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", GPU_THREAD);
+	int count = 0;
+	for (int i = 0; i < HISTORY; ++i)
+	{
+		const Frame& record = history[(frame + i) % HISTORY];
+		if (record.frame < 0)
+			continue;
+		for (size_t e = 0; e < record.events.size(); ++e)
+		{
+			const Event& event = record.events[e];
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				event.name, event.thread < 0 ? GPU_THREAD : event.thread, event.start, event.end - event.start);
+			++count;
+		}
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("Profiler: %d events of the last %d frames written to %s\n", count, (int)HISTORY, path);
+	return true;
+}
+
+void Profiler::add_bar(float x0, float y0, float x1, float y1, float r, float g, float b)
+{
+	const float corners[6][2] = { { x0, y0 }, { x1, y0 }, { x0, y1 }, { x0, y1 }, { x1, y0 }, { x1, y1 } };
+	for (int i = 0; i < 6; ++i)
+	{
+		overlayVertices.push_back(corners[i][0]);
+		overlayVertices.push_back(corners[i][1]);
+		overlayVertices.push_back(r);
+		overlayVertices.push_back(g);
+		overlayVertices.push_back(b);
+	}
+}
+
+void Profiler::draw_overlay(int width, int height)
+{
+	if (!enabled || !overlay || overlayProgram == 0 || width <= 0 || height <= 0)
+		return;
+	ProfileScope scope("Profiler overlay");
+
+	// Pixels to clip space
+	float sx = 2.0f / width, sy = 2.0f / height;
+	float left = -1.0f + MARGIN * sx, bottom = -1.0f + MARGIN * sy;
+	float graphWidth = HISTORY * 2 * BAR_WIDTH * sx;
+	float msToY = GRAPH_HEIGHT * sy / GRAPH_MS;
+
+	overlayVertices.clear();
+	add_bar(left, bottom, left + graphWidth, bottom + GRAPH_HEIGHT * sy, 0.1f, 0.1f, 0.1f);
+	for (int i = 0; i < HISTORY; ++i)
+	{
+		// Oldest on the left
+		int framesAgo = HISTORY - 1 - i;
+		float x = left + i * 2 * BAR_WIDTH * sx;
+		float cpu = std::min(cpu_ms(framesAgo), GRAPH_MS) * msToY;
+		float gpu = std::min(gpu_ms(framesAgo), GRAPH_MS) * msToY;
+		if (cpu > 0.0f)
+			add_bar(x, bottom, x + BAR_WIDTH * sx, bottom + cpu, 0.3f, 0.8f, 0.3f);
+		if (gpu > 0.0f)
+			add_bar(x + BAR_WIDTH * sx, bottom, x + 2 * BAR_WIDTH * sx, bottom + gpu, 1.0f, 0.6f, 0.2f);
+	}
+	for (int line = 1; line <= 2; ++line)
+	{
+		float y = bottom + line * 0.5f * GRAPH_HEIGHT * sy;
+		add_bar(left, y, left + graphWidth, y + sy, 0.8f, 0.8f, 0.8f);
+	}
+
+	bool depthTest = glState.is_enabled(GL_DEPTH_TEST);
+	glState.use_program(overlayProgram);
+	glState.enable(GL_DEPTH_TEST, false);
+	glState.polygon_mode(GL_FILL);
+	glState.bind_vertex_array(overlayVertexArray);
+	glState.bind_buffer(GL_ARRAY_BUFFER, overlayBuffer);
+	glBufferData(GL_ARRAY_BUFFER, overlayVertices.size() * sizeof(float), &overlayVertices[0], GL_STREAM_DRAW);
+	glState.vertex_attrib(0, overlayBuffer, 2, 5 * sizeof(float), 0);
+	glState.vertex_attrib(1, overlayBuffer, 3, 5 * sizeof(float), 2 * sizeof(float));
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(overlayVertices.size() / 5));
+	glState.enable(GL_DEPTH_TEST, depthTest);
+}
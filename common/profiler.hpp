@@ -0,0 +1,137 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Where the time of a frame goes, on the CPU and on the GPU.
+//
+// CPU scopes record their start and end on the stack and publish one event when they end, into a
+// ring of the thread they run on. Only that thread writes its ring and end_frame() is the only
+// reader, so a scope costs two clock reads and a store, no lock. GPU scopes put a GL_TIMESTAMP
+// query before and after their commands; the results are read NUM_SLOTS frames later at the
+// latest and only once they are available, so the CPU never waits for the GPU. Timestamps, unlike
+// GL_TIME_ELAPSED queries, can nest and run inside DynamicResolution's frame query.
+//
+// The last HISTORY frames are kept: the overlay graphs their CPU and GPU times, and write_trace
+// exports their events as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+//	profiler.initialize();
+//	do {
+//		profiler.begin_frame();
+//		{ ProfileScope cpu("Shadows"); GpuProfileScope gpu("Shadows"); ... }
+//		profiler.draw_overlay(width, height);
+//		profiler.end_frame();
+//	} while (...);
+//	profiler.cleanup();
+//
+// Names are not copied, they have to outlive the profiler (string literals).
+class Profiler {
+public:
+	enum { HISTORY = 120, NUM_SLOTS = 4, RING_CAPACITY = 4096 };
+
+	struct Event {
+		const char* name;
+		double start, end;      // microseconds, CPU clock
+		int thread;             // -1 for the GPU
+	};
+
+private:
+	struct ThreadRing {
+		Event events[RING_CAPACITY];
+		std::atomic<unsigned> head;     // written by the thread
+		std::atomic<unsigned> tail;     // written by end_frame
+		int thread;
+	};
+	struct GpuQuery {
+		const char* name;
+		GLuint start, end;
+	};
+	struct GpuSlot {
+		std::vector<GpuQuery> queries;
+		int used;
+		int frame;
+		bool pending;
+	};
+	struct Frame {
+		std::vector<Event> events;
+		float cpuMs, gpuMs;
+		int frame;
+	};
+
+	std::mutex ringsMutex;
+	std::vector<ThreadRing*> rings;
+	GpuSlot slots[NUM_SLOTS];
+	GpuSlot* currentSlot;
+	int frameGpuQuery;
+	Frame history[HISTORY];
+	int frame;
+	double frameStart;
+	// CPU microseconds minus GPU microseconds, to put both on one time line
+	double gpuOffset;
+	std::atomic<unsigned> dropped;
+
+	GLuint overlayProgram, overlayVertexArray, overlayBuffer;
+	std::vector<float> overlayVertices;
+
+	ThreadRing* thread_ring(void);
+	void collect_cpu(void);
+	void collect_gpu(void);
+	void add_bar(float x0, float y0, float x1, float y1, float r, float g, float b);
+
+public:
+	bool enabled;
+	bool overlay;
+
+	Profiler();
+
+	// Queries and the overlay's program; before it only CPU scopes record
+	void initialize(void);
+	void cleanup(void);
+
+	void begin_frame(void);
+	void end_frame(void);
+
+	// Used by the scopes below
+	void end_cpu(const char* name, double start);
+	int begin_gpu(const char* name);
+	void end_gpu(int query);
+	static double now(void);
+
+	// Times of a past frame, 0 is the last one; the GPU's lags behind a few frames
+	float cpu_ms(int framesAgo) const;
+	float gpu_ms(int framesAgo) const;
+
+	// The last HISTORY frames as Chrome trace JSON, false when the file cannot be written
+	bool write_trace(const char* path);
+	// Bars of the last HISTORY frames in the lower left corner, CPU green and GPU orange, with
+	// lines at 16.7 and 33.3 ms. Draws into the bound framebuffer of width x height,
+	// without depth test, and leaves the depth test as it found it.
+	void draw_overlay(int width, int height);
+};
+
+extern Profiler profiler;
+
+// Times the enclosing block on the CPU
+class ProfileScope {
+	const char* name;
+	double start;
+
+public:
+	ProfileScope(const char* name) : name(profiler.enabled ? name : NULL), start(profiler.enabled ? Profiler::now() : 0.0) {}
+	~ProfileScope() { if (name) profiler.end_cpu(name, start); }
+};
+
+// Times the GL commands of the enclosing block on the GPU
+class GpuProfileScope {
+	int query;
+
+public:
+	GpuProfileScope(const char* name) : query(profiler.begin_gpu(name)) {}
+	~GpuProfileScope() { profiler.end_gpu(query); }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef RBT_HPP
+#define RBT_HPP
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RBT_SSE
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/*
+ * Rigid body transforms: a rotation followed by a translation, no scale.
+ * eyeRBT, skyRBT and the arcball frames (transFact(X) * linearFact(eyeRBT)) are all rigid,
+ * so their inverse is the transposed rotation and the rotated negative translation instead
+ * of a general 4x4 glm::inverse.
+ */
+
+struct RBT {
+	glm::quat rotation;
+	glm::vec3 translation;
+
+	RBT() : rotation(), translation(0.0f) {}
+	RBT(const glm::quat& r, const glm::vec3& t) : rotation(r), translation(t) {}
+	// m must be rigid; the rotation is taken from its upper 3x3
+	explicit RBT(const glm::mat4& m) : rotation(glm::normalize(glm::quat_cast(glm::mat3(m)))), translation(glm::vec3(m[3])) {}
+
+	RBT inverse(void) const
+	{
+		glm::quat r = glm::conjugate(rotation);
+		return RBT(r, -(r * translation));
+	}
+
+	RBT operator*(const RBT& b) const
+	{
+		return RBT(rotation * b.rotation, translation + rotation * b.translation);
+	}
+
+	glm::vec3 transform_point(const glm::vec3& p) const { return rotation * p + translation; }
+	glm::vec3 transform_vector(const glm::vec3& v) const { return rotation * v; }
+
+	glm::mat4 to_mat4(void) const
+	{
+		glm::mat4 m = glm::toMat4(rotation);
+		m[3] = glm::vec4(translation, 1.0f);
+		return m;
+	}
+};
+
+// Frame with the origin of o and the axes of a, the RBT version of transFact(o) * linearFact(a)
+inline RBT rbt_frame(const glm::mat4& o, const glm::mat4& a)
+{
+	return RBT(RBT(a).rotation, glm::vec3(o[3]));
+}
+
+// Applies m to o with respect to the frame a: a * m * inverse(a) * o, as a matrix for o
+inline glm::mat4 rbt_conjugate(const RBT& m, const RBT& a)
+{
+	return (a * m * a.inverse()).to_mat4();
+}
+
+// Closed form inverse of a rigid 4x4 matrix: [R t]^-1 = [R^T -R^T t]
+inline glm::mat4 rigid_inverse(const glm::mat4& m)
+{
+	glm::mat4 r;
+#ifdef RBT_SSE
+	__m128 c0 = _mm_loadu_ps(&m[0][0]);
+	__m128 c1 = _mm_loadu_ps(&m[1][0]);
+	__m128 c2 = _mm_loadu_ps(&m[2][0]);
+	__m128 c3 = _mm_setzero_ps();
+	// The columns of R^T, w stays 0 because the columns of R have w = 0
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+	__m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(m[3][0])), _mm_mul_ps(c1, _mm_set1_ps(m[3][1]))),
+		_mm_mul_ps(c2, _mm_set1_ps(m[3][2])));
+	t = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), t);
+
+	_mm_storeu_ps(&r[0][0], c0);
+	_mm_storeu_ps(&r[1][0], c1);
+	_mm_storeu_ps(&r[2][0], c2);
+	_mm_storeu_ps(&r[3][0], t);
+#else
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			r[i][j] = m[j][i];
+	for (int i = 0; i < 3; ++i)
+	{
+		r[i][3] = 0.0f;
+		r[3][i] = -(m[i][0] * m[3][0] + m[i][1] * m[3][1] + m[i][2] * m[3][2]);
+	}
+	r[3][3] = 1.0f;
+#endif
+	return r;
+}
+
+// Inverse of any affine matrix (rotation, scale, shear and translation, last row 0 0 0 1):
+// the 3x3 part by cofactors, no general 4x4 inverse. For frames that may carry a scale.
+inline glm::mat4 affine_inverse(const glm::mat4& m)
+{
+	glm::mat3 l = glm::mat3(m);
+	glm::mat3 c;
+	c[0][0] = l[1][1] * l[2][2] - l[2][1] * l[1][2];
+	c[0][1] = l[2][1] * l[0][2] - l[0][1] * l[2][2];
+	c[0][2] = l[0][1] * l[1][2] - l[1][1] * l[0][2];
+	c[1][0] = l[2][0] * l[1][2] - l[1][0] * l[2][2];
+	c[1][1] = l[0][0] * l[2][2] - l[2][0] * l[0][2];
+	c[1][2] = l[1][0] * l[0][2] - l[0][0] * l[1][2];
+	c[2][0] = l[1][0] * l[2][1] - l[2][0] * l[1][1];
+	c[2][1] = l[2][0] * l[0][1] - l[0][0] * l[2][1];
+	c[2][2] = l[0][0] * l[1][1] - l[1][0] * l[0][1];
+	float det = l[0][0] * c[0][0] + l[1][0] * c[0][1] + l[2][0] * c[0][2];
+	float s = 1.0f / det;
+
+	glm::mat4 r(1.0f);
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			r[i][j] = c[i][j] * s;
+	glm::vec3 t = -(glm::mat3(r) * glm::vec3(m[3]));
+	r[3] = glm::vec4(t, 1.0f);
+	return r;
+}
+
+// Between a (t = 0) and b (t = 1) for rotations with a uniform scale and a translation, as the
+// cube and deer transforms are: the rotations are blended as quaternions (normalized lerp, close
+// enough for the small steps between two simulation states), scale and translation linearly.
+inline glm::mat4 interpolate_transform(const glm::mat4& a, const glm::mat4& b, float t)
+{
+	float sa = glm::length(glm::vec3(a[0])), sb = glm::length(glm::vec3(b[0]));
+	glm::quat qa = glm::quat_cast(glm::mat3(glm::vec3(a[0]) / sa, glm::vec3(a[1]) / sa, glm::vec3(a[2]) / sa));
+	glm::quat qb = glm::quat_cast(glm::mat3(glm::vec3(b[0]) / sb, glm::vec3(b[1]) / sb, glm::vec3(b[2]) / sb));
+	// The shorter way around
+	if (glm::dot(qa, qb) < 0.0f)
+		qb = -qb;
+	glm::mat3 r = glm::mat3_cast(glm::normalize(qa * (1.0f - t) + qb * t));
+	float s = sa + (sb - sa) * t;
+
+	glm::mat4 m(1.0f);
+	for (int i = 0; i < 3; ++i)
+		m[i] = glm::vec4(r[i] * s, 0.0f);
+	m[3] = glm::mix(a[3], b[3], t);
+	return m;
+}
+
+#endif
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <string.h>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <common/render_queue.hpp>
+#include <common/gl_state.hpp>
+#include <common/rbt.hpp>
+
+static const unsigned long long DEPTH_MAX = 0xFFFFFF;
+
+RenderQueue::RenderQueue() : meshStore(NULL), programCallback(NULL), farPlane(100.0f), numDraws(0), programSwitches(0)
+{
+}
+
+void RenderQueue::clear()
+{
+	commands.clear();
+	instanceTransforms.clear();
+	instanceOpacities.clear();
+	instancePrevious.clear();
+}
+
+void RenderQueue::add(const RenderItem& item)
+{
+	Command command;
+	command.item = item;
+	command.firstInstance = (int)instanceTransforms.size();
+	command.depth = 0.0f;
+	command.textureSet = texture_set_rank(item);
+	command.storeMesh = (meshStore != NULL && item.setup == NULL) ? meshStore->find(item.model) : -1;
+	for (int i = 0; i < item.count; ++i)
+	{
+		instanceTransforms.push_back(item.transforms[i]);
+		instanceOpacities.push_back(item.opacities ? item.opacities[i] : 1.0f);
+		instancePrevious.push_back(item.previousTransforms ? item.previousTransforms[i] : item.transforms[i]);
+	}
+	if (item.count <= 0)
+		command.previousModel = item.previousTransforms ? item.previousTransforms[0] : *item.model->get_model();
+	// The copies are used from here on
+	command.item.transforms = NULL;
+	command.item.opacities = NULL;
+	command.item.previousTransforms = NULL;
+	commands.push_back(command);
+}
+
+int RenderQueue::program_rank(GLuint program)
+{
+	for (size_t i = 0; i < programs.size(); ++i)
+		if (programs[i] == program)
+			return (int)i;
+	programs.push_back(program);
+	return (int)programs.size() - 1;
+}
+
+int RenderQueue::texture_set_rank(const RenderItem& item)
+{
+	for (size_t s = 0; s < textureSetSizes.size(); ++s)
+	{
+		if (textureSetSizes[s] != item.numTextures)
+			continue;
+		const TextureBinding* set = &textureSets[s * MAX_ITEM_TEXTURES];
+		bool same = true;
+		for (int t = 0; t < item.numTextures && same; ++t)
+			same = set[t].unit == item.textures[t].unit && set[t].target == item.textures[t].target && set[t].texture == item.textures[t].texture;
+		if (same)
+			return (int)s;
+	}
+	textureSetSizes.push_back(item.numTextures);
+	for (int t = 0; t < MAX_ITEM_TEXTURES; ++t)
+		textureSets.push_back(item.textures[t]);
+	return (int)textureSetSizes.size() - 1;
+}
+
+int RenderQueue::mesh_rank(GLuint vertexArray)
+{
+	for (size_t i = 0; i < meshes.size(); ++i)
+		if (meshes[i] == vertexArray)
+			return (int)i;
+	meshes.push_back(vertexArray);
+	return (int)meshes.size() - 1;
+}
+
+// Front to back for opaque instances, back to front for translucent ones
+void RenderQueue::sort_instances(Command& command, const glm::mat4& view)
+{
+	int first = command.firstInstance, count = command.item.count;
+	bool backToFront = command.item.pass == PASS_TRANSLUCENT;
+
+	instanceDepths.resize(count);
+	instanceOrder.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		instanceDepths[i] = -(view * instanceTransforms[first + i][3]).z;
+		instanceOrder[i] = i;
+	}
+	const std::vector<float>& depths = instanceDepths;
+	if (backToFront)
+		std::sort(instanceOrder.begin(), instanceOrder.end(), [&depths](int a, int b) { return depths[a] > depths[b]; });
+	else
+		std::sort(instanceOrder.begin(), instanceOrder.end(), [&depths](int a, int b) { return depths[a] < depths[b]; });
+
+	// Permute in place through a copy of the range
+	transformScratch.assign(instanceTransforms.begin() + first, instanceTransforms.begin() + first + count);
+	opacityScratch.assign(instanceOpacities.begin() + first, instanceOpacities.begin() + first + count);
+	previousScratch.assign(instancePrevious.begin() + first, instancePrevious.begin() + first + count);
+	for (int i = 0; i < count; ++i)
+	{
+		instanceTransforms[first + i] = transformScratch[instanceOrder[i]];
+		instanceOpacities[first + i] = opacityScratch[instanceOrder[i]];
+		instancePrevious[first + i] = previousScratch[instanceOrder[i]];
+	}
+	command.depth = depths[instanceOrder[0]];
+}
+
+void RenderQueue::sort(const glm::mat4& eyeRBT)
+{
+	glm::mat4 view = affine_inverse(eyeRBT);
+	int n = (int)commands.size();
+	keys.resize(n);
+	order.resize(n);
+
+	for (int i = 0; i < n; ++i)
+	{
+		Command& command = commands[i];
+		const RenderItem& item = command.item;
+		if (item.count > 0)
+			sort_instances(command, view);
+		else
+			command.depth = -(view * (*item.model->get_model())[3]).z;
+
+		float d = glm::clamp(command.depth / farPlane, 0.0f, 1.0f);
+		unsigned long long depth = (unsigned long long)(d * (float)DEPTH_MAX);
+		unsigned long long program = (unsigned long long)(program_rank(item.program) & 0x3FF);
+		unsigned long long textures = (unsigned long long)(command.textureSet & 0xFF);
+		unsigned long long mesh = (unsigned long long)(mesh_rank(item.model->VertexArrayID) & 0xFFF);
+
+		unsigned long long key = (unsigned long long)item.pass << 62;
+		if (item.pass == PASS_TRANSLUCENT)
+			key |= ((DEPTH_MAX - depth) << 38) | (program << 28) | (textures << 20) | (mesh << 8);
+		else
+			key |= (program << 52) | (textures << 44) | (mesh << 32) | (depth << 8);
+		keys[i] = key;
+		order[i] = i;
+	}
+	radix_sort_keys(keys, order, keysScratch, orderScratch);
+}
+
+bool RenderQueue::batches_with(const Command& first, const Command& next) const
+{
+	return next.storeMesh >= 0 && next.item.program == first.item.program && next.textureSet == first.textureSet
+		&& next.item.depthWrite == first.item.depthWrite && next.item.pass == first.item.pass;
+}
+
+void RenderQueue::draw_batch(size_t i, size_t end)
+{
+	batchDraws.clear();
+	batchTransforms.clear();
+	batchOpacities.clear();
+	batchPrevious.clear();
+	for (size_t j = i; j < end; ++j)
+	{
+		const Command& command = commands[order[j]];
+		const RenderItem& item = command.item;
+		MeshDraw meshDraw = { command.storeMesh, (int)batchTransforms.size(), item.count > 0 ? item.count : 1 };
+		if (item.count > 0)
+		{
+			batchTransforms.insert(batchTransforms.end(), instanceTransforms.begin() + command.firstInstance,
+				instanceTransforms.begin() + command.firstInstance + item.count);
+			batchOpacities.insert(batchOpacities.end(), instanceOpacities.begin() + command.firstInstance,
+				instanceOpacities.begin() + command.firstInstance + item.count);
+			batchPrevious.insert(batchPrevious.end(), instancePrevious.begin() + command.firstInstance,
+				instancePrevious.begin() + command.firstInstance + item.count);
+		}
+		else
+		{
+			batchTransforms.push_back(*item.model->get_model());
+			batchOpacities.push_back(1.0f);
+			batchPrevious.push_back(command.previousModel);
+		}
+		batchDraws.push_back(meshDraw);
+	}
+	Model* model = commands[order[i]].item.model;
+	meshStore->draw(*model->get_projection(), *model->get_eye(), &batchDraws[0], (int)batchDraws.size(),
+		&batchTransforms[0], &batchOpacities[0], &batchPrevious[0], (int)batchTransforms.size());
+}
+
+void RenderQueue::draw()
+{
+	numDraws = 0;
+	programSwitches = 0;
+	GLuint program = 0;
+	size_t n = std::min(order.size(), commands.size());
+	for (size_t i = 0; i < n;)
+	{
+		const Command& command = commands[order[i]];
+		const RenderItem& item = command.item;
+
+		if (numDraws == 0 || item.program != program)
+		{
+			program = item.program;
+			glState.use_program(program);
+			if (programCallback)
+				programCallback(program);
+			++programSwitches;
+		}
+		for (int t = 0; t < item.numTextures; ++t)
+			glState.bind_texture(item.textures[t].unit, item.textures[t].target, item.textures[t].texture);
+		glState.depth_mask(item.depthWrite);
+
+		if (command.storeMesh >= 0)
+		{
+			size_t end = i + 1;
+			while (end < n && batches_with(command, commands[order[end]]))
+				++end;
+			draw_batch(i, end);
+			++numDraws;
+			i = end;
+			continue;
+		}
+
+		if (item.setup)
+			item.setup(true);
+		if (item.count > 0)
+			item.model->drawInstanced(&instanceTransforms[command.firstInstance], item.count, &instanceOpacities[command.firstInstance],
+				&instancePrevious[command.firstInstance]);
+		else
+			item.model->draw();
+		if (item.setup)
+			item.setup(false);
+		++numDraws;
+		++i;
+	}
+	glState.depth_mask(true);
+}
+
+void radix_sort_keys(std::vector<unsigned long long>& keys, std::vector<int>& values,
+	std::vector<unsigned long long>& keysScratch, std::vector<int>& valuesScratch)
+{
+	size_t n = keys.size();
+	keysScratch.resize(n);
+	valuesScratch.resize(n);
+	if (n < 2)
+		return;
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t counts[256];
+		memset(counts, 0, sizeof(counts));
+		for (size_t i = 0; i < n; ++i)
+			++counts[(keys[i] >> shift) & 0xFF];
+		// Every key has the same digit here, the order stays as it is
+		if (counts[(keys[0] >> shift) & 0xFF] == n)
+			continue;
+
+		size_t offset = 0;
+		for (int d = 0; d < 256; ++d)
+		{
+			size_t c = counts[d];
+			counts[d] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < n; ++i)
+		{
+			size_t to = counts[(keys[i] >> shift) & 0xFF]++;
+			keysScratch[to] = keys[i];
+			valuesScratch[to] = values[i];
+		}
+		keys.swap(keysScratch);
+		values.swap(valuesScratch);
+	}
+}
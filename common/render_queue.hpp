@@ -0,0 +1,148 @@
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <common/model.hpp>
+#include <common/mesh_store.hpp>
+
+// Draws recorded during a frame and submitted in state order instead of code order. Every
+// draw gets a 64 bit sort key:
+//
+//	opaque:      pass:2 | program:10 | texture set:8 | mesh:12 | depth:24 | 0:8
+//	translucent: pass:2 | far to near depth:24 | program:10 | texture set:8 | mesh:12 | 0:8
+//
+// so opaque draws are grouped by program and textures and go front to back within a group
+// (early z), and blended draws go back to front. The keys are radix sorted. The instances of
+// an instanced draw are sorted the same way.
+//
+//	renderQueue.clear();
+//	RenderItem cube; cube.model = &cubes[0]; cube.program = p; cube.add_texture(0, GL_TEXTURE_2D, tex);
+//	cube.transforms = rbts; cube.count = 9;
+//	renderQueue.add(cube); ...
+//	renderQueue.sort(eyeRBT);
+//	renderQueue.draw();
+//
+// With a MeshStore set, runs of sorted draws that share program, textures, depth writes and
+// pass, have no setup and whose models are in the store go out as one MeshStore::draw().
+
+enum RENDER_PASS {
+	PASS_OPAQUE,
+	PASS_SKY,               // after the opaque draws, usually without depth writes
+	PASS_TRANSLUCENT,       // back to front
+	PASS_OVERLAY
+};
+
+#define MAX_ITEM_TEXTURES 4
+
+struct TextureBinding {
+	GLuint unit;
+	GLenum target;
+	GLuint texture;
+};
+
+struct RenderItem {
+	Model* model;
+	GLuint program;
+	RENDER_PASS pass;
+	TextureBinding textures[MAX_ITEM_TEXTURES];
+	int numTextures;
+	bool depthWrite;
+	// count > 0: instanced with transforms (and opacities, NULL for all 1); else model->draw()
+	const glm::mat4* transforms;
+	const float* opacities;
+	int count;
+	// Last frame's transforms (count of them, one for a single model) for velocity; NULL when unchanged
+	const glm::mat4* previousTransforms;
+	// Called with true before and false after the draw, for uniforms only this draw uses
+	void (*setup)(bool begin);
+
+	RenderItem() : model(NULL), program(0), pass(PASS_OPAQUE), numTextures(0), depthWrite(true),
+		transforms(NULL), opacities(NULL), count(0), previousTransforms(NULL), setup(NULL) {}
+
+	void add_texture(GLuint unit, GLenum target, GLuint texture)
+	{
+		if (numTextures < MAX_ITEM_TEXTURES)
+		{
+			TextureBinding binding = { unit, target, texture };
+			textures[numTextures++] = binding;
+		}
+	}
+};
+
+class RenderQueue {
+	struct Command {
+		RenderItem item;
+		int firstInstance;      // into the instance vectors, sorted by sort()
+		glm::mat4 previousModel;        // of a single model
+		float depth;
+		int textureSet;
+		int storeMesh;          // -1 when the model is not in the mesh store
+	};
+	std::vector<Command> commands;
+	std::vector<glm::mat4> instanceTransforms;
+	std::vector<float> instanceOpacities;
+	std::vector<glm::mat4> instancePrevious;
+	std::vector<float> instanceDepths;
+	std::vector<int> instanceOrder;
+	std::vector<glm::mat4> transformScratch;
+	std::vector<float> opacityScratch;
+	std::vector<glm::mat4> previousScratch;
+
+	// Small numbers for the key fields, in order of first use
+	std::vector<GLuint> programs;
+	std::vector<TextureBinding> textureSets;    // MAX_ITEM_TEXTURES per set
+	std::vector<int> textureSetSizes;
+	std::vector<GLuint> meshes;
+
+	std::vector<unsigned long long> keys, keysScratch;
+	std::vector<int> order, orderScratch;
+
+	MeshStore* meshStore;
+	std::vector<MeshDraw> batchDraws;
+	std::vector<glm::mat4> batchTransforms;
+	std::vector<float> batchOpacities;
+	std::vector<glm::mat4> batchPrevious;
+
+	void (*programCallback)(GLuint program);
+	float farPlane;
+
+	int program_rank(GLuint program);
+	int texture_set_rank(const RenderItem& item);
+	int mesh_rank(GLuint vertexArray);
+	void sort_instances(Command& command, const glm::mat4& view);
+	void radix_sort(void);
+	bool batches_with(const Command& first, const Command& next) const;
+	// Draws the commands order[i] .. order[end - 1] with one MeshStore::draw()
+	void draw_batch(size_t i, size_t end);
+
+public:
+	// Draws submitted by the last draw()
+	int numDraws;
+	int programSwitches;
+
+	RenderQueue();
+
+	// Called by draw() whenever it binds another program, to set that program's uniforms
+	void set_program_callback(void (*callback)(GLuint program)) { programCallback = callback; }
+	// Depths beyond farPlane all get the largest key
+	void set_far_plane(float far) { farPlane = far; }
+	// Models added to store are batched by draw(), NULL draws every item by itself
+	void set_mesh_store(MeshStore* store) { meshStore = store; }
+
+	void clear(void);
+	// Copies the item and its instances; the model must stay alive until draw()
+	void add(const RenderItem& item);
+	void sort(const glm::mat4& eyeRBT);
+	void draw(void);
+	int size(void) const { return (int)commands.size(); }
+};
+
+// LSD radix sort of keys by 8 bit digits, carrying values along; skips the digits all keys share.
+// The scratch vectors are resized as needed.
+void radix_sort_keys(std::vector<unsigned long long>& keys, std::vector<int>& values,
+	std::vector<unsigned long long>& keysScratch, std::vector<int>& valuesScratch);
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include <common/ring_buffer.hpp>
+#include <common/gl_counters.hpp>
+
+RingBuffer* frameRing = NULL;
+
+RingBuffer::RingBuffer()
+	: frameSize(0), numFrames(0), frame(0), used(0), persistent(false), mapped(NULL), overflowReported(false), buffer(0)
+{
+	for (int i = 0; i < 4; ++i)
+		fences[i] = 0;
+}
+
+bool RingBuffer::initialize(GLsizeiptr frameSize, int numFrames)
+{
+	if (numFrames < 1 || numFrames > 4)
+	{
+		printf("RingBuffer: %d frames, 1 to 4 are supported\n", numFrames);
+		return false;
+	}
+	this->frameSize = frameSize;
+	this->numFrames = numFrames;
+	this->frame = 0;
+	this->used = 0;
+
+	// Bound to the copy target, which nothing else in the demos uses
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	GLsizeiptr total = frameSize * numFrames;
+	persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	if (persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+		if (mapped == NULL)
+		{
+			printf("RingBuffer: persistent mapping failed, using glBufferSubData\n");
+			persistent = false;
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		}
+	}
+	if (!persistent)
+		glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return true;
+}
+
+void RingBuffer::begin_frame()
+{
+	used = 0;
+	GLsync fence = fences[frame];
+	if (fence == 0)
+		return;
+
+	// Only waits when the CPU is numFrames frames ahead of the GPU
+	GLbitfield flags = 0;
+	GLuint64 timeout = 0;
+	for (;;)
+	{
+		GLenum result = glClientWaitSync(fence, flags, timeout);
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+			break;
+		flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		timeout = 1000000; // 1 ms
+	}
+	glDeleteSync(fence);
+	fences[frame] = 0;
+}
+
+GLintptr RingBuffer::upload(const void* data, GLsizeiptr size, GLsizeiptr alignment)
+{
+	// The position in the buffer is aligned, whatever the section size
+	GLintptr base = (GLintptr)frame * frameSize;
+	GLsizeiptr offset = (base + used + alignment - 1) / alignment * alignment - base;
+	if (buffer == 0 || offset + size > frameSize)
+	{
+		if (buffer != 0 && !overflowReported)
+		{
+			printf("RingBuffer: %ld bytes per frame are not enough\n", (long)frameSize);
+			overflowReported = true;
+		}
+		return -1;
+	}
+	used = offset + size;
+
+	GLintptr position = base + offset;
+	if (persistent)
+	{
+		memcpy(mapped + position, data, size);
+		// No GL call to count this one
+		glCounters.current.uploadBytes += size;
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, position, size, data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	return position;
+}
+
+void RingBuffer::end_frame()
+{
+	if (buffer == 0)
+		return;
+	fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame = (frame + 1) % numFrames;
+}
+
+void RingBuffer::cleanup()
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		if (fences[i] != 0)
+			glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+	if (buffer != 0)
+	{
+		if (persistent)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer);
+	}
+	if (frameRing == this)
+		frameRing = NULL;
+	buffer = 0;
+	mapped = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <GL/glew.h>
+
+// Buffer for data that changes every frame (instance transforms and the like). It holds
+// numFrames sections of frameSize bytes; each frame sub-allocates from its own section and
+// fences it at the end, so writing never waits for or reallocates storage the GPU still reads
+// unless the CPU gets numFrames frames ahead.
+//
+// With GL 4.4 / ARB_buffer_storage the buffer is persistently mapped and uploads are plain
+// copies. Without it uploads use glBufferSubData into the fenced section, still without
+// orphaning.
+//
+//	ring.initialize(1 << 20);
+//	do {
+//		ring.begin_frame();
+//		GLintptr offset = ring.upload(data, size, 16);   // -1 when the section is full
+//		glBindBuffer(GL_ARRAY_BUFFER, ring.buffer); ... offset ...
+//		ring.end_frame();
+//	} while (...);
+class RingBuffer {
+	GLsizeiptr frameSize;
+	int numFrames;
+	int frame;
+	GLsizeiptr used;        // bytes allocated in the current frame's section
+	bool persistent;
+	unsigned char* mapped;  // persistent only
+	GLsync fences[4];
+	bool overflowReported;
+
+public:
+	GLuint buffer;
+
+	RingBuffer();
+
+	// numFrames is at most 4
+	bool initialize(GLsizeiptr frameSize, int numFrames = 3);
+	// Waits until the GPU is done with the section this frame writes to
+	void begin_frame(void);
+	// Copies size bytes into the current section; returns the offset in buffer, a multiple of
+	// alignment (e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT for glBindBufferRange), -1 when full
+	GLintptr upload(const void* data, GLsizeiptr size, GLsizeiptr alignment = 16);
+	void end_frame(void);
+	void cleanup(void);
+
+	bool is_persistent(void) const { return persistent; }
+};
+
+// Ring the common/ code uploads its per frame data to (Model::drawInstanced), set by the demos
+// that drive one. NULL keeps the glBufferData uploads.
+extern RingBuffer* frameRing;
+
+#endif
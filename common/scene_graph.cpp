@@ -0,0 +1,78 @@
+#include <climits>
+
+#include <common/scene_graph.hpp>
+
+SceneGraph::SceneGraph()
+{
+	firstDirty = INT_MAX;
+	lastUpdated = 0;
+}
+
+int SceneGraph::add_node(int parent, const glm::mat4& local)
+{
+	int node = (int)parents.size();
+	parents.push_back(parent);
+	locals.push_back(local);
+	worlds.push_back(parent < 0 ? local : worlds[parent] * local);
+	dirty.push_back(0);
+	return node;
+}
+
+void SceneGraph::clear()
+{
+	parents.clear();
+	locals.clear();
+	worlds.clear();
+	dirty.clear();
+	firstDirty = INT_MAX;
+}
+
+void SceneGraph::set_local(int node, const glm::mat4& local)
+{
+	locals[node] = local;
+	if (!dirty[node])
+	{
+		dirty[node] = 1;
+		firstDirty = glm::min(firstDirty, node);
+	}
+}
+
+void SceneGraph::transform_world(int node, const glm::mat4& transform)
+{
+	glm::mat4 world = transform * this->world(node);
+	int p = parents[node];
+	set_local(node, p < 0 ? world : glm::inverse(worlds[p]) * world);
+}
+
+const glm::mat4& SceneGraph::world(int node)
+{
+	if (firstDirty < (int)parents.size())
+		update();
+	return worlds[node];
+}
+
+void SceneGraph::update()
+{
+	lastUpdated = 0;
+	int count = (int)parents.size();
+	if (firstDirty >= count)
+		return;
+
+	// A node is recomputed when it or its parent changed; the parent comes first, so the
+	// parent's flag is already final when the child is reached.
+	for (int i = firstDirty; i < count; ++i)
+	{
+		int p = parents[i];
+		if (p >= 0 && dirty[p] && !dirty[i])
+			dirty[i] = 2; // only the parent changed
+		if (!dirty[i])
+			continue;
+
+		worlds[i] = (p < 0) ? locals[i] : worlds[p] * locals[i];
+		++lastUpdated;
+	}
+
+	for (int i = firstDirty; i < count; ++i)
+		dirty[i] = 0;
+	firstDirty = INT_MAX;
+}
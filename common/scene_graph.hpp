@@ -0,0 +1,51 @@
+#ifndef SCENE_GRAPH_HPP
+#define SCENE_GRAPH_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Transform hierarchy. Nodes are stored flat in topological order (a parent always comes
+// before its children), with the local and world matrices in arrays of their own. Changing a
+// local transform only marks the node; update() then recomputes, in one forward pass, the
+// world matrices of the marked nodes and their descendants and nothing else, so static
+// objects cost nothing per frame.
+//
+// Models bind to a node's world matrix like to any other transform:
+//
+//	int node = scene.add_node(root, glm::translate(1.0f, 0.0f, 0.0f));
+//	model.set_model(scene.world_pointer(node));
+//
+// world_pointer() stays valid until the next add_node(), so bind after the graph is built.
+class SceneGraph {
+	std::vector<int> parents;           // -1 for roots
+	std::vector<glm::mat4> locals;      // relative to the parent
+	std::vector<glm::mat4> worlds;      // parent's world * local
+	std::vector<unsigned char> dirty;   // local changed since the last update()
+	int firstDirty;                     // nodes before this one are all clean
+	int lastUpdated;
+
+public:
+	SceneGraph();
+
+	// parent must already exist, which keeps the nodes in topological order
+	int add_node(int parent = -1, const glm::mat4& local = glm::mat4(1.0f));
+	void clear(void);
+	int size(void) const { return (int)parents.size(); }
+	int parent(int node) const { return parents[node]; }
+
+	const glm::mat4& local(int node) const { return locals[node]; }
+	void set_local(int node, const glm::mat4& local);
+	// Applies transform in world space: world becomes transform * world
+	void transform_world(int node, const glm::mat4& transform);
+
+	// Brings the world matrices up to date first if anything changed
+	const glm::mat4& world(int node);
+	glm::mat4* world_pointer(int node) { return &worlds[node]; }
+
+	// Recomputes the world matrices below changed nodes, call once per frame before drawing
+	void update(void);
+	// Number of world matrices the last update() recomputed
+	int updated(void) const { return lastUpdated; }
+};
+
+#endif
@@ -3,107 +3,919 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <unordered_map>
+#include <chrono>
 using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
 
 #include <GL/glew.h>
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+// Programs already built during this run, keyed by vertex path, fragment path and defines
+struct CachedProgram {
+	GLuint ProgramID;
+	int References;
+	std::string VertexPath;
+	std::string FragmentPath;
+	std::string Defines;
+	// Every file read to build the program, includes too
+	std::vector<std::string> Dependencies;
+};
+static std::unordered_map<std::string, CachedProgram> ProgramCache;
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// Linked program binaries are stored here between runs
+static std::string ShaderCacheDirectory = "shader_cache";
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
-		return 0;
+void SetShaderCacheDirectory(const char * path)
+{
+	ShaderCacheDirectory = path ? path : "";
+}
+
+// Progress and build times of every program, off unless SHADER_VERBOSE is set or SetShaderVerbose(true)
+static bool ShaderVerbose = getenv("SHADER_VERBOSE") != NULL;
+
+void SetShaderVerbose(bool verbose)
+{
+	ShaderVerbose = verbose;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool ReadShaderFile(const char * file_path, std::string& code)
+{
+	std::ifstream stream(file_path, std::ios::in | std::ios::binary);
+	if (!stream.is_open())
+		return false;
+
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	code = sstr.str();
+	return true;
+}
+
+// Replaces #include "file" lines with the file, resolved relative to the including file
+static bool PreprocessShader(const std::string& file_path, std::string& code, std::vector<std::string>& include_stack,
+	std::vector<std::string>& dependencies)
+{
+	if (std::find(include_stack.begin(), include_stack.end(), file_path) != include_stack.end())
+	{
+		printf("Recursive #include of %s\n", file_path.c_str());
+		return false;
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+	std::string source;
+	if (!ReadShaderFile(file_path.c_str(), source))
+		return false;
+	if (std::find(dependencies.begin(), dependencies.end(), file_path) == dependencies.end())
+		dependencies.push_back(file_path);
+
+	size_t slash = file_path.find_last_of("/\\");
+	std::string directory = (slash == std::string::npos) ? "" : file_path.substr(0, slash + 1);
+
+	include_stack.push_back(file_path);
+	std::istringstream lines(source);
+	std::string Line;
+	while (std::getline(lines, Line))
+	{
+		size_t first = Line.find_first_not_of(" \t");
+		if (first != std::string::npos && Line.compare(first, 8, "#include") == 0)
+		{
+			size_t open = Line.find('"', first + 8);
+			size_t close = (open == std::string::npos) ? open : Line.find('"', open + 1);
+			if (close == std::string::npos)
+			{
+				printf("%s: malformed line %s\n", file_path.c_str(), Line.c_str());
+				include_stack.pop_back();
+				return false;
+			}
+
+			std::string include_path = directory + Line.substr(open + 1, close - open - 1);
+			if (!PreprocessShader(include_path, code, include_stack, dependencies))
+			{
+				printf("Impossible to include %s from %s\n", include_path.c_str(), file_path.c_str());
+				include_stack.pop_back();
+				return false;
+			}
+			continue;
+		}
+		code += Line + "\n";
 	}
+	include_stack.pop_back();
+	return true;
+}
 
+static bool LoadShaderSource(const char * file_path, std::string& code, std::vector<std::string>& dependencies)
+{
+	std::vector<std::string> include_stack;
+	code.clear();
+	return PreprocessShader(file_path, code, include_stack, dependencies);
+}
+
+std::string ShaderDefines(const ShaderPermutation& permutation)
+{
+	std::ostringstream defines;
+	if (permutation.numDirLights >= 0 && permutation.numPointLights >= 0 && permutation.numSpotLights >= 0)
+	{
+		defines << "#define NUM_DIR_LIGHTS " << permutation.numDirLights << "\n";
+		defines << "#define NUM_POINT_LIGHTS " << permutation.numPointLights << "\n";
+		defines << "#define NUM_SPOT_LIGHTS " << permutation.numSpotLights << "\n";
+		if (permutation.lightBlock)
+		{
+			int count = permutation.numDirLights + permutation.numPointLights + permutation.numSpotLights;
+			defines << "#define LIGHT_BLOCK\n";
+			defines << "#define MAX_LIGHTS " << (count > 0 ? count : 1) << "\n";
+		}
+	}
+	if (permutation.shading == SHADING_TOON)
+		defines << "#define TOON_SHADING\n";
+	else if (permutation.shading == SHADING_FLAT)
+		defines << "#define FLAT_SHADING\n";
+	if (permutation.bump)
+		defines << "#define BUMP_MAPPING\n";
+	if (permutation.instanced)
+		defines << "#define INSTANCED\n";
+	if (permutation.velocity)
+		defines << "#define VELOCITY\n";
+	return defines.str();
+}
 
+// Insert the defines right after the #version line, which has to stay first
+static std::string InjectDefines(const std::string& code, const char * defines)
+{
+	if (defines == NULL || defines[0] == '\0')
+		return code;
 
+	size_t version = code.find("#version");
+	if (version == std::string::npos)
+		return std::string(defines) + "\n" + code;
+
+	size_t line_end = code.find('\n', version);
+	if (line_end == std::string::npos)
+		return code + "\n" + defines + "\n";
+
+	return code.substr(0, line_end + 1) + defines + "\n" + code.substr(line_end + 1);
+}
+
+// 64-bit FNV-1a
+static unsigned long long HashString(const std::string& text, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool ProgramBinaryFormatsSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		GLint formats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		supported = (formats > 0) ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+static bool ProgramBinariesSupported()
+{
+	return ProgramBinaryFormatsSupported() && !ShaderCacheDirectory.empty();
+}
+
+// Binaries are only valid for the driver that produced them, so the driver strings are part of the key
+static std::string ProgramBinaryPath(const std::string& vertex_code, const std::string& fragment_code)
+{
+	std::string driver = std::string((const char*)glGetString(GL_VENDOR)) + "\n"
+		+ (const char*)glGetString(GL_RENDERER) + "\n"
+		+ (const char*)glGetString(GL_VERSION);
+
+	unsigned long long hash = HashString(vertex_code);
+	hash = HashString(std::string(1, '\0') + fragment_code, hash);
+	hash = HashString(std::string(1, '\0') + driver, hash);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", hash);
+	return ShaderCacheDirectory + "/" + name;
+}
+
+static GLuint LoadProgramBinary(const std::string& binary_path)
+{
+	FILE * file = fopen(binary_path.c_str(), "rb");
+	if (!file)
+		return 0;
+
+	GLenum format = 0;
+	GLint length = 0;
+	std::vector<char> binary;
+	if (fread(&format, sizeof(format), 1, file) == 1 && fread(&length, sizeof(length), 1, file) == 1 && length > 0)
+	{
+		binary.resize(length);
+		if (fread(&binary[0], 1, length, file) != (size_t)length)
+			binary.clear();
+	}
+	fclose(file);
+
+	if (binary.empty())
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, format, &binary[0], length);
+
+	// A driver update invalidates old binaries; fall back to compiling from source
 	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE)
+	{
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
 
+static void SaveProgramBinary(GLuint ProgramID, const std::string& binary_path)
+{
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
 
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, NULL, &format, &binary[0]);
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+#ifdef _WIN32
+	_mkdir(ShaderCacheDirectory.c_str());
+#else
+	mkdir(ShaderCacheDirectory.c_str(), 0755);
+#endif
+	FILE * file = fopen(binary_path.c_str(), "wb");
+	if (!file)
+	{
+		printf("Impossible to write program binary %s\n", binary_path.c_str());
+		return;
+	}
+	fwrite(&format, sizeof(format), 1, file);
+	fwrite(&length, sizeof(length), 1, file);
+	fwrite(&binary[0], 1, length, file);
+	fclose(file);
+}
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+// A program whose compile and link have been issued but not checked yet
+struct PendingProgram {
+	GLuint ProgramID;
+	GLuint VertexShaderID;
+	GLuint FragmentShaderID;
+	std::string VertexPath;
+	std::string FragmentPath;
+	std::string BinaryPath;
+	bool Retrievable;       // linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	std::chrono::steady_clock::time_point Start;
+};
+static std::vector<PendingProgram> PendingPrograms;
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static bool ParallelCompileSupported()
+{
+	static int supported = -1;
+	if (supported < 0)
+	{
+		supported = 0;
+#ifdef GL_KHR_parallel_shader_compile
+		if (GLEW_KHR_parallel_shader_compile)
+		{
+			// Let the driver pick how many compiler threads to use
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+			supported = 1;
+		}
+#endif
 	}
+	return supported == 1;
+}
 
+// Issues the compiles and the link without asking for any status, so nothing waits on the driver here
+static PendingProgram SubmitProgram(const char * vertex_file_path, const std::string& VertexShaderCode,
+	const char * fragment_file_path, const std::string& FragmentShaderCode, const std::string& binary_path,
+	bool retrievable, std::chrono::steady_clock::time_point start)
+{
+	ParallelCompileSupported();
 
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
+	// Compile Vertex Shader
+	if (ShaderVerbose)
+		printf("Compiling shader : %s\n", vertex_file_path);
+	char const * VertexSourcePointer = VertexShaderCode.c_str();
+	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
+	glCompileShader(VertexShaderID);
 
 	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
+	if (ShaderVerbose)
+		printf("Compiling shader : %s\n", fragment_file_path);
 	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
 	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
 	glCompileShader(FragmentShaderID);
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
-	}
-
-
-
 	// Link the program
-	printf("Linking program\n");
+	if (ShaderVerbose)
+		printf("Linking program\n");
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (retrievable)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
+	PendingProgram pending;
+	pending.ProgramID = ProgramID;
+	pending.VertexShaderID = VertexShaderID;
+	pending.FragmentShaderID = FragmentShaderID;
+	pending.VertexPath = vertex_file_path;
+	pending.FragmentPath = fragment_file_path;
+	pending.BinaryPath = binary_path;
+	pending.Retrievable = retrievable;
+	pending.Start = start;
+	return pending;
+}
+
+// Waits for one submitted program, prints its logs and stores its binary
+static void FinishProgram(const PendingProgram& pending)
+{
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	// Check Vertex Shader
+	glGetShaderiv(pending.VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 0 ){
+		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
+		glGetShaderInfoLog(pending.VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
+		printf("%s: %s\n", pending.VertexPath.c_str(), &VertexShaderErrorMessage[0]);
+	}
+
+	// Check Fragment Shader
+	glGetShaderiv(pending.FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 0 ){
+		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
+		glGetShaderInfoLog(pending.FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
+		printf("%s: %s\n", pending.FragmentPath.c_str(), &FragmentShaderErrorMessage[0]);
+	}
+
 	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	glGetProgramiv(pending.ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(pending.ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if ( InfoLogLength > 0 ){
 		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		glGetProgramInfoLog(pending.ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	glDetachShader(pending.ProgramID, pending.VertexShaderID);
+	glDetachShader(pending.ProgramID, pending.FragmentShaderID);
+	glDeleteShader(pending.VertexShaderID);
+	glDeleteShader(pending.FragmentShaderID);
+
+	if (Result == GL_TRUE && !pending.BinaryPath.empty())
+		SaveProgramBinary(pending.ProgramID, pending.BinaryPath);
+
+	if (ShaderVerbose)
+		printf("Built program for %s, %s (%.2f ms)\n", pending.VertexPath.c_str(), pending.FragmentPath.c_str(), MillisecondsSince(pending.Start));
+}
+
+// Uniform name -> location of every active uniform, per program
+static std::unordered_map<GLuint, std::unordered_map<std::string, GLint> > UniformTables;
+
+static void BuildUniformTable(GLuint ProgramID)
+{
+	std::unordered_map<std::string, GLint>& table = UniformTables[ProgramID];
+	table.clear();
+
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(ProgramID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ProgramID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<char> name(max_length + 1);
+
+	for (GLint i = 0; i < count; ++i)
+	{
+		GLint size = 0;
+		GLenum type = 0;
+		GLsizei length = 0;
+		glGetActiveUniform(ProgramID, i, max_length + 1, &length, &size, &type, &name[0]);
+		std::string uniform(&name[0], length);
+		table[uniform] = glGetUniformLocation(ProgramID, uniform.c_str());
+
+		// Arrays are reported as "name[0]", also accept "name" and the other elements
+		if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0)
+		{
+			std::string base = uniform.substr(0, uniform.size() - 3);
+			table[base] = table[uniform];
+			for (GLint element = 1; element < size; ++element)
+			{
+				std::ostringstream oss;
+				oss << base << "[" << element << "]";
+				table[oss.str()] = glGetUniformLocation(ProgramID, oss.str().c_str());
+			}
+		}
+	}
+}
+
+// Attribute name -> location of every active vertex attribute, per program
+static std::unordered_map<GLuint, std::unordered_map<std::string, GLint> > AttribTables;
+
+static void BuildAttribTable(GLuint ProgramID)
+{
+	std::unordered_map<std::string, GLint>& table = AttribTables[ProgramID];
+	table.clear();
+
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(ProgramID, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(ProgramID, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+	std::vector<char> name(max_length + 1);
+
+	for (GLint i = 0; i < count; ++i)
+	{
+		GLint size = 0;
+		GLenum type = 0;
+		GLsizei length = 0;
+		glGetActiveAttrib(ProgramID, i, max_length + 1, &length, &size, &type, &name[0]);
+		std::string attrib(&name[0], length);
+		table[attrib] = glGetAttribLocation(ProgramID, attrib.c_str());
+	}
+}
+
+GLint GetAttribLocation(GLuint programID, const char * name)
+{
+	std::unordered_map<GLuint, std::unordered_map<std::string, GLint> >::iterator table = AttribTables.find(programID);
+	if (table == AttribTables.end())
+	{
+		BuildAttribTable(programID);
+		table = AttribTables.find(programID);
+	}
+
+	std::unordered_map<std::string, GLint>::iterator attrib = table->second.find(name);
+	return (attrib != table->second.end()) ? attrib->second : -1;
+}
+
+GLint GetUniformLocation(GLuint programID, const char * name)
+{
+	std::unordered_map<GLuint, std::unordered_map<std::string, GLint> >::iterator table = UniformTables.find(programID);
+	if (table == UniformTables.end())
+	{
+		BuildUniformTable(programID);
+		table = UniformTables.find(programID);
+	}
+
+	std::unordered_map<std::string, GLint>::iterator uniform = table->second.find(name);
+	return (uniform != table->second.end()) ? uniform->second : -1;
+}
+
+// Files of loaded programs are watched for changes once WatchShaders(true) is called
+static bool WatchEnabled = false;
+static std::unordered_map<std::string, time_t> WatchedFiles;
+static std::chrono::steady_clock::time_point LastPoll;
+#ifdef __linux__
+static int InotifyFD = -1;
+static std::unordered_map<int, std::string> WatchedDirectories;
+#endif
+
+static time_t FileModificationTime(const std::string& path)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return 0;
+	return info.st_mtime;
+}
+
+static void WatchFile(const std::string& path)
+{
+	if (WatchedFiles.count(path))
+		return;
+	WatchedFiles[path] = FileModificationTime(path);
+
+#ifdef __linux__
+	// Editors often save by renaming a new file over the old one, so watch the directory
+	if (InotifyFD < 0)
+		return;
+	size_t slash = path.find_last_of('/');
+	std::string directory = (slash == std::string::npos) ? "" : path.substr(0, slash + 1);
+	for (std::unordered_map<int, std::string>::iterator it = WatchedDirectories.begin(); it != WatchedDirectories.end(); ++it)
+		if (it->second == directory)
+			return;
+	int wd = inotify_add_watch(InotifyFD, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd >= 0)
+		WatchedDirectories[wd] = directory;
+	else
+		printf("Impossible to watch %s\n", directory.empty() ? "." : directory.c_str());
+#endif
+}
+
+static void WatchProgramFiles(const CachedProgram& program)
+{
+	for (size_t i = 0; i < program.Dependencies.size(); ++i)
+		WatchFile(program.Dependencies[i]);
+}
+
+void WatchShaders(bool enable)
+{
+	if (enable == WatchEnabled)
+		return;
+	WatchEnabled = enable;
+
+#ifdef __linux__
+	if (enable)
+	{
+		InotifyFD = inotify_init1(IN_NONBLOCK);
+		if (InotifyFD < 0)
+			printf("inotify is not available, polling the shader files instead\n");
+	}
+	else if (InotifyFD >= 0)
+	{
+		close(InotifyFD);
+		InotifyFD = -1;
+		WatchedDirectories.clear();
+	}
+#endif
+
+	WatchedFiles.clear();
+	if (enable)
+		for (std::unordered_map<std::string, CachedProgram>::iterator it = ProgramCache.begin(); it != ProgramCache.end(); ++it)
+			WatchProgramFiles(it->second);
+}
+
+static void CollectChangedFiles(std::vector<std::string>& changed)
+{
+#ifdef __linux__
+	if (InotifyFD >= 0)
+	{
+		char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t length;
+		while ((length = read(InotifyFD, buffer, sizeof(buffer))) > 0)
+		{
+			for (char * ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len)
+			{
+				const struct inotify_event * event = (const struct inotify_event *)ptr;
+				if (event->len == 0 || !WatchedDirectories.count(event->wd))
+					continue;
+				std::string path = WatchedDirectories[event->wd] + event->name;
+				if (WatchedFiles.count(path) && std::find(changed.begin(), changed.end(), path) == changed.end())
+					changed.push_back(path);
+			}
+		}
+		return;
+	}
+#endif
+
+	// No inotify: look at the modification times a few times per second
+	if (MillisecondsSince(LastPoll) < 250.0)
+		return;
+	LastPoll = std::chrono::steady_clock::now();
+	for (std::unordered_map<std::string, time_t>::iterator it = WatchedFiles.begin(); it != WatchedFiles.end(); ++it)
+	{
+		time_t modified = FileModificationTime(it->first);
+		if (modified != 0 && modified != it->second)
+		{
+			it->second = modified;
+			changed.push_back(it->first);
+		}
+	}
+}
+
+// A new version of a program that is compiled next to the one in use
+struct ReloadingProgram {
+	std::string Key;
+	GLuint TargetID;
+	PendingProgram Build;
+	std::vector<std::string> Dependencies;
+	bool Submitted;         // during this UpdateShaders call, its status is first asked for on the next one
+};
+static std::vector<ReloadingProgram> ReloadingPrograms;
+
+static void AbandonReload(const ReloadingProgram& reload)
+{
+	glDeleteShader(reload.Build.VertexShaderID);
+	glDeleteShader(reload.Build.FragmentShaderID);
+	glDeleteProgram(reload.Build.ProgramID);
+}
+
+static void CancelReload(GLuint programID)
+{
+	for (size_t i = 0; i < ReloadingPrograms.size(); ++i)
+	{
+		if (ReloadingPrograms[i].TargetID == programID)
+		{
+			AbandonReload(ReloadingPrograms[i]);
+			ReloadingPrograms.erase(ReloadingPrograms.begin() + i);
+			return;
+		}
+	}
+}
+
+static void StartReload(const std::string& key, const CachedProgram& program)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// The file may be caught half written, it is tried again on the next change
+	std::vector<std::string> dependencies;
+	std::string VertexShaderCode, FragmentShaderCode;
+	if (!LoadShaderSource(program.VertexPath.c_str(), VertexShaderCode, dependencies)
+		|| !LoadShaderSource(program.FragmentPath.c_str(), FragmentShaderCode, dependencies))
+	{
+		printf("Impossible to reload %s, %s\n", program.VertexPath.c_str(), program.FragmentPath.c_str());
+		return;
+	}
+	VertexShaderCode = InjectDefines(VertexShaderCode, program.Defines.c_str());
+	FragmentShaderCode = InjectDefines(FragmentShaderCode, program.Defines.c_str());
+
+	std::string binary_path;
+	if (ProgramBinariesSupported())
+		binary_path = ProgramBinaryPath(VertexShaderCode, FragmentShaderCode);
+
+	CancelReload(program.ProgramID);
+
+	ReloadingProgram reload;
+	reload.Key = key;
+	reload.TargetID = program.ProgramID;
+	// The binary is what moves the new code into the program in use, see SwapProgram
+	reload.Build = SubmitProgram(program.VertexPath.c_str(), VertexShaderCode, program.FragmentPath.c_str(), FragmentShaderCode,
+		binary_path, ProgramBinaryFormatsSupported(), start);
+	reload.Dependencies = dependencies;
+	reload.Submitted = true;
+	ReloadingPrograms.push_back(reload);
+}
+
+// Puts the new code into the program object the application already holds. Loading the binary
+// of the program that just linked costs no second link; only drivers without binary formats
+// link the shaders again, into the program in use.
+static bool SwapProgram(GLuint TargetID, const PendingProgram& built)
+{
+	GLint Result = GL_FALSE;
+	if (built.Retrievable)
+	{
+		GLint length = 0;
+		glGetProgramiv(built.ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length > 0)
+		{
+			std::vector<char> binary(length);
+			GLenum format = 0;
+			glGetProgramBinary(built.ProgramID, length, NULL, &format, &binary[0]);
+			glProgramBinary(TargetID, format, &binary[0], length);
+			glGetProgramiv(TargetID, GL_LINK_STATUS, &Result);
+			if (Result == GL_TRUE)
+				return true;
+		}
+	}
+
+	// The same shaders just linked fine on their own
+	glAttachShader(TargetID, built.VertexShaderID);
+	glAttachShader(TargetID, built.FragmentShaderID);
+	glLinkProgram(TargetID);
+	glDetachShader(TargetID, built.VertexShaderID);
+	glDetachShader(TargetID, built.FragmentShaderID);
+	glGetProgramiv(TargetID, GL_LINK_STATUS, &Result);
+	return Result == GL_TRUE;
+}
+
+bool UpdateShaders()
+{
+	if (!WatchEnabled)
+		return false;
+
+	std::vector<std::string> changed;
+	CollectChangedFiles(changed);
+	for (size_t i = 0; i < changed.size(); ++i)
+	{
+		for (std::unordered_map<std::string, CachedProgram>::iterator it = ProgramCache.begin(); it != ProgramCache.end(); ++it)
+		{
+			const std::vector<std::string>& dependencies = it->second.Dependencies;
+			if (std::find(dependencies.begin(), dependencies.end(), changed[i]) != dependencies.end())
+				StartReload(it->first, it->second);
+		}
+	}
+
+	bool swapped = false;
+	for (size_t i = 0; i < ReloadingPrograms.size(); )
+	{
+		ReloadingProgram& reload = ReloadingPrograms[i];
+
+		// Without GL_KHR_parallel_shader_compile the status query below waits for the link. Asking
+		// one frame after the submit gives drivers that compile on their own threads that frame;
+		// drivers that link inside glLinkProgram have already stalled the frame of the edit.
+		if (reload.Submitted)
+		{
+			reload.Submitted = false;
+			++i;
+			continue;
+		}
+
+		// Keep drawing with the old program until the driver is done
+		if (ParallelCompileSupported())
+		{
+			GLint done = GL_FALSE;
+			glGetProgramiv(reload.Build.ProgramID, GL_COMPLETION_STATUS_KHR, &done);
+			if (done != GL_TRUE)
+			{
+				++i;
+				continue;
+			}
+		}
+
+		GLint Result = GL_FALSE;
+		glGetProgramiv(reload.Build.ProgramID, GL_LINK_STATUS, &Result);
+		if (Result == GL_TRUE && SwapProgram(reload.TargetID, reload.Build))
+		{
+			UniformTables.erase(reload.TargetID);
+			AttribTables.erase(reload.TargetID);
+			std::unordered_map<std::string, CachedProgram>::iterator cached = ProgramCache.find(reload.Key);
+			if (cached != ProgramCache.end())
+			{
+				cached->second.Dependencies = reload.Dependencies;
+				WatchProgramFiles(cached->second);
+			}
+			printf("Reloaded %s, %s\n", reload.Build.VertexPath.c_str(), reload.Build.FragmentPath.c_str());
+			swapped = true;
+		}
+		else
+		{
+			printf("Reloading %s, %s failed, keeping the previous program\n", reload.Build.VertexPath.c_str(), reload.Build.FragmentPath.c_str());
+		}
+
+		// Prints the logs, stores the binary and deletes the shaders
+		FinishProgram(reload.Build);
+		glDeleteProgram(reload.Build.ProgramID);
+		ReloadingPrograms.erase(ReloadingPrograms.begin() + i);
+	}
+
+	return swapped;
+}
+
+GLuint SubmitShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines){
+
+	if (defines == NULL)
+		defines = "";
+
+	// The same pair is often loaded once per model, reuse the program we already have
+	std::string key = std::string(vertex_file_path) + "\n" + fragment_file_path + "\n" + defines;
+	std::unordered_map<std::string, CachedProgram>::iterator cached = ProgramCache.find(key);
+	if (cached != ProgramCache.end())
+	{
+		++cached->second.References;
+		return cached->second.ProgramID;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Read the Vertex Shader code from the file
+	std::vector<std::string> dependencies;
+	std::string VertexShaderCode;
+	if(!LoadShaderSource(vertex_file_path, VertexShaderCode, dependencies)){
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
+		getchar();
+		return 0;
+	}
+
+	// Read the Fragment Shader code from the file
+	std::string FragmentShaderCode;
+	if(!LoadShaderSource(fragment_file_path, FragmentShaderCode, dependencies)){
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", fragment_file_path);
+		getchar();
+		return 0;
+	}
+
+	VertexShaderCode = InjectDefines(VertexShaderCode, defines);
+	FragmentShaderCode = InjectDefines(FragmentShaderCode, defines);
+
+	// Try the binary linked by a previous run before compiling from source
+	GLuint ProgramID = 0;
+	std::string binary_path;
+	if (ProgramBinariesSupported())
+	{
+		binary_path = ProgramBinaryPath(VertexShaderCode, FragmentShaderCode);
+		ProgramID = LoadProgramBinary(binary_path);
+		if (ProgramID != 0 && ShaderVerbose)
+			printf("Loaded program binary for %s, %s (%.2f ms)\n", vertex_file_path, fragment_file_path, MillisecondsSince(start));
+	}
+
+	if (ProgramID == 0)
+	{
+		PendingPrograms.push_back(SubmitProgram(vertex_file_path, VertexShaderCode, fragment_file_path, FragmentShaderCode,
+			binary_path, !binary_path.empty(), start));
+		ProgramID = PendingPrograms.back().ProgramID;
+	}
+
+	CachedProgram entry;
+	entry.ProgramID = ProgramID;
+	entry.References = 1;
+	entry.VertexPath = vertex_file_path;
+	entry.FragmentPath = fragment_file_path;
+	entry.Defines = defines;
+	entry.Dependencies = dependencies;
+	ProgramCache[key] = entry;
+
+	if (WatchEnabled)
+		WatchProgramFiles(entry);
 
 	return ProgramID;
 }
 
+bool ShadersReady()
+{
+	// Without the extension any status query blocks, so report ready and let FinishShaders wait
+	if (!ParallelCompileSupported())
+		return true;
+
+	for (size_t i = 0; i < PendingPrograms.size(); ++i)
+	{
+		GLint done = GL_FALSE;
+		glGetProgramiv(PendingPrograms[i].ProgramID, GL_COMPLETION_STATUS_KHR, &done);
+		if (done != GL_TRUE)
+			return false;
+	}
+	return true;
+}
+
+void FinishShaders()
+{
+	for (size_t i = 0; i < PendingPrograms.size(); ++i)
+		FinishProgram(PendingPrograms[i]);
+	PendingPrograms.clear();
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines){
 
+	GLuint ProgramID = SubmitShaders(vertex_file_path, fragment_file_path, defines);
+
+	// Only wait for this program, others submitted earlier can keep compiling
+	for (size_t i = 0; i < PendingPrograms.size(); ++i)
+	{
+		if (PendingPrograms[i].ProgramID == ProgramID)
+		{
+			FinishProgram(PendingPrograms[i]);
+			PendingPrograms.erase(PendingPrograms.begin() + i);
+			break;
+		}
+	}
+
+	return ProgramID;
+}
+
+GLuint SubmitShaders(const char * vertex_file_path,const char * fragment_file_path, const ShaderPermutation& permutation){
+	return SubmitShaders(vertex_file_path, fragment_file_path, ShaderDefines(permutation).c_str());
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const ShaderPermutation& permutation){
+	return LoadShaders(vertex_file_path, fragment_file_path, ShaderDefines(permutation).c_str());
+}
+
+void ReleaseShaders(GLuint programID)
+{
+	for (std::unordered_map<std::string, CachedProgram>::iterator it = ProgramCache.begin(); it != ProgramCache.end(); ++it)
+	{
+		if (it->second.ProgramID == programID)
+		{
+			if (--it->second.References <= 0)
+			{
+				for (size_t i = 0; i < PendingPrograms.size(); ++i)
+				{
+					if (PendingPrograms[i].ProgramID == programID)
+					{
+						FinishProgram(PendingPrograms[i]);
+						PendingPrograms.erase(PendingPrograms.begin() + i);
+						break;
+					}
+				}
+				CancelReload(programID);
+				UniformTables.erase(programID);
+				AttribTables.erase(programID);
+				glDeleteProgram(programID);
+				ProgramCache.erase(it);
+			}
+			return;
+		}
+	}
+
+	// Not created through LoadShaders
+	glDeleteProgram(programID);
+}
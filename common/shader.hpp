@@ -1,6 +1,71 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+#include <string>
+
+enum SHADING_MODEL { SHADING_PHONG, SHADING_TOON, SHADING_FLAT };
+
+// Selects a specialized variant of a shader through defines, see common/lighting.glsl.
+// With all three light counts >= 0 the lights uniform array has to be ordered directional,
+// point, spot and every type gets its own loop; -1 keeps the generic numLights loop.
+struct ShaderPermutation {
+	int numDirLights;
+	int numPointLights;
+	int numSpotLights;
+	SHADING_MODEL shading;
+	bool bump;
+	bool instanced;         // ModelTransform per instance, see common/instancing.glsl
+	bool velocity;          // screen space motion into a second color output, see common/velocity.glsl
+	bool lightBlock;        // lights from a uniform block sized to the light counts, see common/lighting.glsl
+
+	ShaderPermutation() : numDirLights(-1), numPointLights(-1), numSpotLights(-1), shading(SHADING_PHONG), bump(false), instanced(false), velocity(false), lightBlock(false) {}
+};
+
+std::string ShaderDefines(const ShaderPermutation& permutation);
+
+// Loading the same files with the same defines again returns the program that is already built.
+// defines (e.g. "#define TOON_SHADING\n") are inserted right after the #version line.
+// Lines of the form #include "file" are replaced by that file, relative to the including one.
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines = "");
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const ShaderPermutation& permutation);
+
+// Batched build: SubmitShaders issues the compiles and the link without waiting for them, so several
+// programs (and mesh/texture loading) overlap when the driver supports GL_KHR_parallel_shader_compile.
+// The returned program must not be queried or used before FinishShaders, which checks every
+// submitted program and prints the logs. ShadersReady never blocks.
+GLuint SubmitShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines = "");
+GLuint SubmitShaders(const char * vertex_file_path,const char * fragment_file_path, const ShaderPermutation& permutation);
+bool ShadersReady();
+void FinishShaders();
+
+// Hot reload: once WatchShaders(true) is called, the files of every loaded program (includes too)
+// are watched. UpdateShaders() is meant to be called once per frame, between two frames. It starts
+// recompiling the programs whose files changed and, once one links, puts the new code into the
+// same program handle. A program that fails to compile or link is left as it was. Returns true when
+// a program was swapped, which means uniform locations and uniform values have to be set again.
+// The new program's link status is first asked for one frame after the edit. Without
+// GL_KHR_parallel_shader_compile that query, or glLinkProgram itself, waits for the link, so
+// on those drivers a reload still costs one long frame. The new code moves into the program in
+// use as a binary; drivers without program binary formats link it a second time for that.
+// Watching costs a file system poll per frame, the demos only turn it on with --watch-shaders.
+void WatchShaders(bool enable);
+bool UpdateShaders();
+
+// Location of a uniform from the program's reflection table, rebuilt after every reload.
+// Arrays can be looked up as "name", "name[0]" and "name[i]".
+GLint GetUniformLocation(GLuint programID, const char * name);
+// The same for vertex attributes, -1 when the program has no such active attribute
+GLint GetAttribLocation(GLuint programID, const char * name);
+
+// Drops one reference to a program returned by LoadShaders and deletes it when it is no longer used.
+void ReleaseShaders(GLuint programID);
+
+// Where linked program binaries are kept between runs, "" disables the disk cache.
+// Must be called before the first LoadShaders.
+void SetShaderCacheDirectory(const char * path);
+
+// Prints every compile, link and binary load with its time; errors are always printed.
+// Defaults to on when the SHADER_VERBOSE environment variable is set.
+void SetShaderVerbose(bool verbose);
 
 #endif
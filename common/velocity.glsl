@@ -0,0 +1,21 @@
+// Screen space motion of a fragment, pulled in by a fragment shader with
+// #include "../common/velocity.glsl" and written by calling write_velocity() in main.
+//
+// Only with VELOCITY (ShaderPermutation::velocity); the vertex side is in instancing.glsl.
+// The motion since the previous frame goes to color output 1 in texture coordinates, for a
+// velocity buffer used by the post pass. Alpha is 1, so blending leaves it as written.
+
+#ifdef VELOCITY
+smooth in vec4 currentClipPosition;
+smooth in vec4 previousClipPosition;
+
+layout(location = 1) out vec4 velocity;
+
+void write_velocity() {
+	vec2 current = currentClipPosition.xy / currentClipPosition.w;
+	vec2 previous = previousClipPosition.xy / previousClipPosition.w;
+	velocity = vec4((current - previous) * 0.5, 0.0, 1.0);
+}
+#else
+void write_velocity() {}
+#endif
@@ -22,6 +22,10 @@ using namespace glm;
 
 #include <common/shader.hpp>
 #include <common/model.hpp>
+#include <common/headless.hpp>
+
+// Offscreen runs without a display, for benchmarks
+Headless headless;
 
 float g_groundSize = 100.0f;
 float g_groundY = -2.5f;
@@ -278,8 +282,15 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 }
 
 
-int main(void)
+int main(int argc, char* argv[])
 {
+	// --headless renders a fixed number of frames offscreen and exits, see common/headless.hpp
+	headless.parse(argc, argv);
+	if (!headless.init_hints())
+	{
+		return -1;
+	}
+
 	// Initialise GLFW
 	if (!glfwInit())
 	{
@@ -291,6 +302,7 @@ int main(void)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	headless.window_hints();
 
 	// Open a window and create its OpenGL context
 	window = glfwCreateWindow((int)windowWidth, (int)windowHeight, "Lab 2", NULL, NULL);
@@ -305,6 +317,9 @@ int main(void)
 	if (glewInit() != GLEW_OK) {
 		return -1;
 	}
+	if (!headless.initialize((int)windowWidth, (int)windowHeight)) {
+		return -1;
+	}
 
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
@@ -331,7 +346,7 @@ int main(void)
 	// Initialize Ground Model
 	ground = Model();
 	init_ground(ground);
-	ground.initialize("VertexShader.glsl", "FragmentShader.glsl");
+	ground.initialize(DRAW_TYPE::ARRAY, "VertexShader.glsl", "FragmentShader.glsl");
 	ground.set_projection(&Projection);
 	ground.set_eye(&eyeRBT);
 	glm::mat4 groundRBT = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, g_groundY, 0.0f)) * glm::scale(glm::mat4(1.0f), glm::vec3(g_groundSize, 1.0f, g_groundSize));
@@ -340,7 +355,7 @@ int main(void)
 	// Initialize Two Cube Models
 	redCube = Model();
 	init_cube(redCube, glm::vec3(1.0f, 0.0f, 0.0f));
-	redCube.initialize("VertexShader.glsl", "FragmentShader.glsl");
+	redCube.initialize(DRAW_TYPE::ARRAY, "VertexShader.glsl", "FragmentShader.glsl");
 	redCube.set_projection(&Projection);
 	redCube.set_eye(&eyeRBT);
 	redCubeRBT = glm::translate(glm::mat4(1.0f), glm::vec3(-1.5f, 0.5f, 0.0f))
@@ -349,7 +364,7 @@ int main(void)
 
 	greenCube = Model();
 	init_cube(greenCube, glm::vec3(0.0f, 1.0f, 0.0f));
-	greenCube.initialize("VertexShader.glsl", "FragmentShader.glsl");
+	greenCube.initialize(DRAW_TYPE::ARRAY, "VertexShader.glsl", "FragmentShader.glsl");
 	greenCube.set_projection(&Projection);
 	greenCube.set_eye(&eyeRBT);
 	greenCubeRBT = glm::translate(glm::mat4(1.0f), glm::vec3(1.5f, 0.5f,
@@ -372,7 +387,12 @@ int main(void)
 	float prevTime = 0.0;
 	float currTime = 0.0;
 	float distance = 3.0f;
+	const glm::mat4 startSkyRBT = skyRBT;
 	do {
+		headless.begin_frame();
+		if (headless.enabled)
+			skyRBT = headless.camera(startSkyRBT);
+
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		currTime = glfwGetTime();
@@ -390,6 +410,7 @@ int main(void)
 		prevTime = currTime;
 		// Swap buffers (Double buffering)
 		glfwSwapBuffers(window);
+		headless.end_frame(window);
 		glfwPollEvents();
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
@@ -400,6 +421,8 @@ int main(void)
 	redCube.cleanup();
 	greenCube.cleanup();
 
+	headless.cleanup();
+
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
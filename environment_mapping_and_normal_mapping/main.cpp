@@ -23,12 +23,18 @@ GLFWwindow* window;
 
 #include <common/shader.hpp>
 #include <common/affine.hpp>
+#include <common/rbt.hpp>
 #include <common/geometry.hpp>
 #include <common/arcball.hpp>
 #include <common/texture.hpp>
+#include <common/headless.hpp>
+#include <common/gl_state.hpp>
 
 using namespace glm;
 
+// Offscreen runs without a display, for benchmarks
+Headless headless;
+
 float g_groundSize = 100.0f;
 float g_groundY = -2.5f;
 
@@ -102,12 +108,11 @@ void set_program(int p){
 }
 void init_shader(int idx, const char * vertexShader_path, const char * fragmentShader_path){
 	addPrograms[idx] = LoadShaders(vertexShader_path, fragmentShader_path);
-	glUseProgram(addPrograms[idx]);
+	glState.use_program(addPrograms[idx]);
 }
 void init_cubemap(const char * baseFileName,int size){	
-	glActiveTexture(GL_TEXTURE0+3);
 	glGenTextures(1, &cubeTexID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTexID);
+	glState.bind_texture(3, GL_TEXTURE_CUBE_MAP, cubeTexID);
 	const char * suffixes[] = { "posx", "negx", "posy", "negy", "posz", "negz" };
 	GLuint targets[] = {
 		GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
@@ -128,7 +133,7 @@ void init_cubemap(const char * baseFileName,int size){
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 3);
+	glState.bind_texture(3, GL_TEXTURE_CUBE_MAP, 3);
 }
 void init_texture(void){
 	//TODO: Initialize first texture
@@ -239,7 +244,7 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 		if (use_arcball())
 		{
 			// 1. Get eye coordinate of arcball and compute its screen coordinate
-			glm::vec4 arcball_eyecoord = glm::inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			glm::vec4 arcball_eyecoord = affine_inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 			glm::vec3 arcball_eyecoord3 = glm::vec3(arcball_eyecoord);
 			glm::vec2 arcballCenter = eye_to_screen(arcball_eyecoord3,
 				Projection,
@@ -274,8 +279,8 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 
 		// Apply transformation with auxiliary frame
 		setWrtFrame();
-		if (object_index == 0) { skyRBT = aFrame * m * glm::inverse(aFrame) * skyRBT; }
-		else { objectRBT[0] = aFrame * m * glm::inverse(aFrame) * objectRBT[0]; }
+		if (object_index == 0) { skyRBT = aFrame * m * affine_inverse(aFrame) * skyRBT; }
+		else { objectRBT[0] = aFrame * m * affine_inverse(aFrame) * objectRBT[0]; }
 
 		prev_x = (float)xpos; prev_y = (float)ypos;
 	}
@@ -343,8 +348,15 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 	}
 }
 
-int main(void)
+int main(int argc, char* argv[])
 {
+	// --headless renders a fixed number of frames offscreen and exits, see common/headless.hpp
+	headless.parse(argc, argv);
+	if (!headless.init_hints())
+	{
+		return -1;
+	}
+
 	// Initialise GLFW
 	if (!glfwInit())
 	{
@@ -356,6 +368,7 @@ int main(void)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	headless.window_hints();
 
 	// Open a window and create its OpenGL context
 	window = glfwCreateWindow((int)windowWidth, (int)windowHeight, "Lab 4 | Fredrik Berglund 20166029", NULL, NULL);
@@ -379,14 +392,17 @@ int main(void)
 	glfwSetKeyCallback(window, keyboard_callback);
 
 	glfwGetFramebufferSize(window, &frameBufferWidth, &frameBufferHeight);
+	if (!headless.initialize(frameBufferWidth, frameBufferHeight)) {
+		return -1;
+	}
 
 	// Clear with sky color	
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
 	// Enable depth test
-	glEnable(GL_DEPTH_TEST);
+	glState.enable(GL_DEPTH_TEST, true);
 	// Accept fragment if it closer to the camera than the former one
-	glDepthFunc(GL_LESS);
+	glState.depth_func(GL_LESS);
 
 
 	Projection = glm::perspective(fov, windowWidth / windowHeight, 0.1f, 100.0f);
@@ -445,19 +461,27 @@ int main(void)
 	
 	program_cnt = 0;
 	set_program(0);
+
+	// Textures were loaded without the state cache
+	glState.invalidate();
+
+	const glm::mat4 startSkyRBT = skyRBT;
 	do {
 		double cur_time = glfwGetTime();
 		// Clear the screen
-		if (cur_time - pre_time > 0.008){
+		if (headless.enabled || cur_time - pre_time > 0.008){
+			headless.begin_frame();
+			if (headless.enabled)
+				skyRBT = headless.camera(startSkyRBT);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			eyeRBT = (view_index == 0) ? skyRBT : objectRBT[0];
 			
 			glm::vec3 lightVec = glm::vec3(sin(angle), 0.0f, cos(angle));
-			glm::vec4 pLightPos = inverse(eyeRBT) * vec4(0.0f, 2.0f * cos(angle), 2.0f * sin(angle), 1.0f);
+			glm::vec4 pLightPos = affine_inverse(eyeRBT) * vec4(0.0f, 2.0f * cos(angle), 2.0f * sin(angle), 1.0f);
 			glm::vec4 sDest = vec4(2.0f * cos(angle), -2.0f, 2.0f * sin(angle), 1.0f);
 			glm::vec4 sLightPoss = vec4(0.0f, 4.0f, 0.0f, 1.0f);
-			glm::vec4 sLightPos = inverse(eyeRBT)  * vec4(0.0f, 4.0f, 0.0f, 1.0f);
-			glm::vec4 sLightDir = inverse(eyeRBT) * (sDest - sLightPoss);
+			glm::vec4 sLightPos = affine_inverse(eyeRBT)  * vec4(0.0f, 4.0f, 0.0f, 1.0f);
+			glm::vec4 sLightDir = affine_inverse(eyeRBT) * (sDest - sLightPoss);
 
 			if (animate)
 				angle += 0.02f;
@@ -467,35 +491,31 @@ int main(void)
 				isSky = glGetUniformLocation(addPrograms[2], "DrawSkyBox");
 				glUniform1i(isSky, 0);		
 				//TODO: pass the cubemap texture to shader
-				glActiveTexture(GL_TEXTURE0 + 3);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTexID);
+				glState.bind_texture(3, GL_TEXTURE_CUBE_MAP, cubeTexID);
 				glUniform1i(cubeTex, 3);
 			}
 			//TODO: pass the first texture value to shader			
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, texture[0]);
+			glState.bind_texture(0, GL_TEXTURE_2D, texture[0]);
 			glUniform1i(textureID[program_cnt][0], 0);
 
 			//draw first cube models
-			glUseProgram(cubes[0].GLSLProgramID);
+			glState.use_program(cubes[0].GLSLProgramID);
 			lightLocCube = glGetUniformLocation(cubes[0].GLSLProgramID, "uLight");
 			glUniform3f(lightLocCube, lightVec.x, lightVec.y, lightVec.z);			
 			cubes[0].draw();
 			
 			//TODO: pass bump(normalmap) texture value to shader
 			if (program_cnt == 1) {
-				glActiveTexture(GL_TEXTURE0 + 2);
-				glBindTexture(GL_TEXTURE_2D, bumpTex);
+				glState.bind_texture(2, GL_TEXTURE_2D, bumpTex);
 				glUniform1i(bumpTexID, 2);
 			}
 
 			//TODO: pass second texture value to shader						
-			glActiveTexture(GL_TEXTURE0 + 1);
-			glBindTexture(GL_TEXTURE_2D, texture[1]);
+			glState.bind_texture(1, GL_TEXTURE_2D, texture[1]);
 			glUniform1i(textureID[program_cnt][1], 1);
 
 			//draw second cube models
-			glUseProgram(cubes[1].GLSLProgramID);
+			glState.use_program(cubes[1].GLSLProgramID);
 			lightLocCube = glGetUniformLocation(cubes[1].GLSLProgramID, "uLight");
 			glUniform3f(lightLocCube, lightVec.x, lightVec.y, lightVec.z);
 			cubes[1].draw2(cubes[0]);
@@ -505,21 +525,20 @@ int main(void)
 				glUniform1i(isSky, 1);
 
 				//TODO: Pass the texture(cubemap value to shader) and eye position
-				glUseProgram(addPrograms[2]);
+				glState.use_program(addPrograms[2]);
 				isEye = glGetUniformLocation(addPrograms[2], "WorldCameraPosition");
 				glUniform3f(isEye, eyePosition.x, eyePosition.y, eyePosition.z);
 				
 				cubeTex = glGetUniformLocation(addPrograms[2], "cubemap");
-				glActiveTexture(GL_TEXTURE0 + 3);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTexID);
+				glState.bind_texture(3, GL_TEXTURE_CUBE_MAP, cubeTexID);
 				glUniform1i(cubeTex, 3);
 
-				glDepthMask(GL_FALSE);
+				glState.depth_mask(false);
 				skybox.draw();
-				glDepthMask(GL_TRUE);
+				glState.depth_mask(true);
 			}
 
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+			glState.polygon_mode(GL_LINE);
 			switch (object_index)
 			{
 			case 0:
@@ -533,15 +552,18 @@ int main(void)
 			}
 
 			ScreenToEyeScale = compute_screen_eye_scale(
-				(glm::inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z,
+				(affine_inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z,
 				fovy,
 				frameBufferHeight
 				);
 			arcBallScale = ScreenToEyeScale * arcBallScreenRadius;
 			arcballRBT = arcballRBT * glm::scale(worldRBT, glm::vec3(arcBallScale, arcBallScale, arcBallScale));
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+			glState.polygon_mode(GL_FILL);
 
 			glfwSwapBuffers(window);
+			headless.end_frame(window);
+			glState.end_frame();
+			glState.report("Environment mapping");
 			glfwPollEvents();
 			pre_time = cur_time;
 		}
@@ -552,6 +574,8 @@ int main(void)
 	// Clean up data structures and glsl objects	
 	for (int i = 0; i<2; i++) cubes[i].cleanup();
 
+	headless.cleanup();
+
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
@@ -10,8 +10,9 @@ layout(location = 4) in vec3 tangents;
 out vec3 fragmentPosition;
 out vec3 fragmentNormal;
 out vec2 UV;
+flat out float fragmentOpacity;
 
-uniform mat4 ModelTransform;
+#include "../common/instancing.glsl"
 uniform mat4 Eye;
 uniform mat4 Projection;
 
@@ -19,6 +20,11 @@ uniform sampler2D displacementSampler;
 
 void main() {
 	mat4 MVM = inverse(Eye) * ModelTransform;
+#ifdef INSTANCED
+	fragmentOpacity = instanceOpacity;
+#else
+	fragmentOpacity = 1.0;
+#endif
 
 	vec4 newVertexPos;
 	vec4 dv;
@@ -32,6 +38,9 @@ void main() {
 
 	fragmentPosition = (MVM * newVertexPos).xyz;
 	gl_Position = Projection * MVM * newVertexPos;
+#ifdef VELOCITY
+	write_clip_positions(Projection, newVertexPos);
+#endif
 
 	//transpose of inversed model view matrix
 	mat4 invm = inverse(MVM);
@@ -3,11 +3,13 @@
 in vec3 fragmentPosition;
 in vec3 fragmentNormal;
 in vec2 UV;
+flat in float fragmentOpacity; // per instance, 1 for single draws
 
 smooth in vec3 RefractDir;
 
 // Ouput data
-out vec4 color;
+layout(location = 0) out vec4 color;
+#include "../common/velocity.glsl"
 
 uniform vec3 uLight;
 uniform bool DrawSkyBox;
@@ -24,6 +26,7 @@ void main(){
 		color = vec4(texColor.rgb, 1.0);
 	} else {
 		vec4 Kd = texture(myTextureSampler, UV);
-		color = vec4(mix(Kd, texColor, 0.93).rgb, opacity);
+		color = vec4(mix(Kd, texColor, 0.93).rgb, opacity * fragmentOpacity);
 	}
+	write_velocity();
 }
\ No newline at end of file
@@ -10,8 +10,9 @@ out vec3 fragmentNormal;
 out vec2 UV;
 
 smooth out vec3 RefractDir;
+flat out float fragmentOpacity;
 
-uniform mat4 ModelTransform;
+#include "../common/instancing.glsl"
 uniform mat4 Eye;
 uniform mat4 Projection;
 uniform bool DrawSkyBox;
@@ -19,6 +20,11 @@ uniform vec3 WorldCameraPosition;
 
 void main() {
 	mat4 MVM = inverse(Eye) * ModelTransform;
+#ifdef INSTANCED
+	fragmentOpacity = instanceOpacity;
+#else
+	fragmentOpacity = 1.0;
+#endif
 
 	vec4 wPosition = MVM * vec4(vertexPosition_modelspace, 1);
 	fragmentPosition = wPosition.xyz;
@@ -31,6 +37,9 @@ void main() {
 	UV = vertexUV;	
 
 	gl_Position = Projection * wPosition;	
+#ifdef VELOCITY
+	write_clip_positions(Projection, vec4(vertexPosition_modelspace, 1));
+#endif
 
 
 	mat4 inverseProjection = inverse(Projection);
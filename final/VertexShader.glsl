@@ -9,8 +9,9 @@ layout(location = 3) in vec2 vertexUV;
 out vec3 fragmentPosition;
 out vec3 fragmentNormal;
 out vec2 UV;
+flat out float fragmentOpacity;
 
-uniform mat4 ModelTransform;
+#include "../common/instancing.glsl"
 uniform mat4 Eye;
 uniform mat4 Projection;
 
@@ -21,6 +22,9 @@ void main(){
 	vec4 wPosition = MVM * vec4(vertexPosition_modelspace, 1);
 	fragmentPosition = wPosition.xyz;
 	gl_Position = Projection * wPosition;
+#ifdef VELOCITY
+	write_clip_positions(Projection, vec4(vertexPosition_modelspace, 1));
+#endif
 	
 	//transpose of inversed model view matrix
 	mat4 invm = inverse(MVM);
@@ -29,4 +33,10 @@ void main(){
 	vec4 tnormal = vec4(vertexNormal_modelspace, 0.0);
 	fragmentNormal = vec3(NVM * tnormal);	
 	UV = vertexUV;
+
+#ifdef INSTANCED
+	fragmentOpacity = instanceOpacity;
+#else
+	fragmentOpacity = 1.0;
+#endif
 }
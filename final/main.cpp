@@ -5,6 +5,7 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <sstream>
 
@@ -24,12 +25,27 @@ GLFWwindow* window;
 
 #include <common/shader.hpp>
 #include <common/affine.hpp>
+#include <common/rbt.hpp>
 #include <common/geometry.hpp>
 #include <common/arcball.hpp>
 #include <common/texture.hpp>
+#include <common/culling.hpp>
+#include <common/ring_buffer.hpp>
+#include <common/gl_state.hpp>
+#include <common/mesh_store.hpp>
+#include <common/render_queue.hpp>
+#include <common/post_chain.hpp>
+#include <common/dynamic_resolution.hpp>
+#include <common/frame_scheduler.hpp>
+#include <common/headless.hpp>
+#include <common/profiler.hpp>
+#include <common/input_log.hpp>
 
 using namespace glm;
 
+// Offscreen runs without a display, for benchmarks
+Headless headless;
+
 int const LIGHT_COUNT = 4;
 
 float g_groundSize = 100.0f;
@@ -40,6 +56,16 @@ GLuint isSky, isEye;
 GLuint opacityLoc[4];
 
 GLuint addPrograms[4];
+// Post processing: upscaling, chroma keying, motion blur; see textureFragmentShader.glsl
+PostChain postChain;
+int upscaleEffect, chromaKeyEffect, motionBlurEffect;
+GLuint sharpenUpscaleProgram, nearestUpscaleProgram;
+// The scene is rendered to the lower left sceneWidth x sceneHeight of its framebuffer, at the
+// pixelation's size or scaled down to hold the frame time, and upscaled by the post chain
+DynamicResolution dynamicResolution;
+int sceneWidth = 1, sceneHeight = 1;
+// The size the scene targets are allocated at, at least the framebuffer's; see reserve_scene_targets
+int sceneTargetWidth = 0, sceneTargetHeight = 0;
 GLuint texture[9];
 GLuint textureID[4][9];
 GLuint bumps[3];
@@ -51,6 +77,7 @@ GLuint cubeTexID;
 // Texture rendering
 GLuint FramebufferName;
 GLuint renderedTexture;
+GLuint velocityTexture; // screen space motion since the last frame, blurred along by the post pass
 GLuint depthrenderbuffer;
 
 bool isChromaKey = true;
@@ -70,7 +97,7 @@ float fov = 45.0f;
 float fovy = fov;
 bool animate = true;
 bool motionBlurOn = true;
-int blurAmount = 3;
+int motionBlurSamples = 8;
 
 // Model properties
 glm::mat4 skyRBT;
@@ -79,8 +106,12 @@ const glm::mat4 worldRBT = glm::mat4(1.0f);
 glm::mat4 arcballRBT = glm::mat4(1.0f);
 glm::mat4 aFrame;
 //cubes
-glm::mat4 objectRBT[9], mbObjectRBT[9];
-Model cubes[9], mbCubes[9];
+glm::mat4 objectRBT[9];
+Model cubes[9];
+// Last frame's transforms, for the velocity buffer
+glm::mat4 previousObjectRBT[9], previousEyeRBT;
+// The transforms before the last simulation step, and the ones drawn between it and the current
+glm::mat4 stepRBT[9], renderRBT[9];
 mat4 curRBT[9];
 int program_cnt = 1;
 //cube animation
@@ -113,7 +144,24 @@ float prev_x = 0.0f; float prev_y = 0.0f;
 
 // Deer model
 Model deer;
+
+// Frustum culling: cubes 0..8, then the deer. The skybox is never culled.
+CullList cullList;
+// Per frame uploads, the instance transforms of the cubes
+RingBuffer dynamicRing;
+// This frame's draws, submitted in program/texture/depth order
+RenderQueue renderQueue;
+// The cube and deer meshes in shared buffers, so the queue multi-draws them
+MeshStore meshStore;
+int deerCull;
 mat4 deerRBT = glm::scale(0.1f, 0.1f, 0.1f)*glm::translate(-25.0f, 2.0f, -10.0f);
+mat4 previousDeerRBT = deerRBT;
+mat4 stepDeerRBT = deerRBT, renderDeerRBT = deerRBT;
+
+// Animation in fixed steps of simulated time, drawn interpolated between them
+FrameScheduler frameScheduler;
+float simAngle = 0.0f, previousAngle = 0.0f;
+double bumpTimer = 0.0;
 
 GLenum  cube[6] = { GL_TEXTURE_CUBE_MAP_POSITIVE_X,
 GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
@@ -152,9 +200,9 @@ void set_program(int p){
 	}
 	deer.GLSLProgramID = addPrograms[p];
 }
-void init_shader(int idx, const char * vertexShader_path, const char * fragmentShader_path){
-	addPrograms[idx] = LoadShaders(vertexShader_path, fragmentShader_path);
-	glUseProgram(addPrograms[idx]);
+void init_shader(int idx, const char * vertexShader_path, const char * fragmentShader_path, const ShaderPermutation& permutation){
+	// Only submitted here, FinishShaders() is called once the meshes and textures are loaded
+	addPrograms[idx] = SubmitShaders(vertexShader_path, fragmentShader_path, permutation);
 }
 void init_cubemap(const char * baseFileName, int size) {
 	glActiveTexture(GL_TEXTURE0 + 3);
@@ -185,22 +233,87 @@ void init_cubemap(const char * baseFileName, int size) {
 void init_texture(void){	
 	// Initialize textures
 	texture[0] = loadBMP_custom("cubemap.bmp");
-	for (int i = 0; i < 4; i++) textureID[i][0] = glGetUniformLocation(addPrograms[i], "myTextureSampler");
-
 	texture[1] = loadBMP_custom("deer.bmp");
-	for (int i = 0; i < 4; i++) textureID[i][1] = glGetUniformLocation(addPrograms[i], "myTextureSampler");
 
 	//TODO: Initialize bump texture
 	bumps[0] = loadBMP_custom("paper.bmp");
 	bumps[1] = loadBMP_custom("flower.bmp");
 	bumps[2] = loadBMP_custom("bump.bmp");
 	bumpTex = bumps[0];
-	bumpTexID = glGetUniformLocation(addPrograms[1], "myBumpSampler");
-	displacementTexID = glGetUniformLocation(addPrograms[2], "displacementSampler");
 
 	//TODO: Initialize Cubemap texture
 	init_cubemap("miramar/miramar", 2048);
 }
+void init_texture_uniforms(void){
+	// Needs linked programs, call after FinishShaders()
+	for (int i = 0; i < 4; i++) textureID[i][0] = GetUniformLocation(addPrograms[i], "myTextureSampler");
+	for (int i = 0; i < 4; i++) textureID[i][1] = GetUniformLocation(addPrograms[i], "myTextureSampler");
+	bumpTexID = GetUniformLocation(addPrograms[1], "myBumpSampler");
+	displacementTexID = GetUniformLocation(addPrograms[2], "displacementSampler");
+	isSky = GetUniformLocation(addPrograms[3], "DrawSkyBox");
+	isEye = GetUniformLocation(addPrograms[3], "WorldCameraPosition");
+	cubeTex = GetUniformLocation(addPrograms[3], "cubemap");
+}
+static void chroma_key_setup(GLuint program)
+{
+	glState.bind_texture(5, GL_TEXTURE_2D, texture[2]);
+	glUniform1i(GetUniformLocation(program, "replaceTexture"), 5);
+}
+
+static void motion_blur_setup(GLuint program)
+{
+	glState.bind_texture(6, GL_TEXTURE_2D, velocityTexture);
+	glUniform1i(GetUniformLocation(program, "velocityTexture"), 6);
+	glUniform2f(GetUniformLocation(program, "sceneScale"),
+		(float)sceneWidth / sceneTargetWidth, (float)sceneHeight / sceneTargetHeight);
+	glUniform1i(GetUniformLocation(program, "motionBlurSamples"), motionBlurSamples);
+}
+
+static void upscale_setup(GLuint program)
+{
+	glUniform2f(GetUniformLocation(program, "sourceScale"),
+		(float)sceneWidth / sceneTargetWidth, (float)sceneHeight / sceneTargetHeight);
+	glUniform1f(GetUniformLocation(program, "sharpness"), 0.5f);
+}
+
+// Pixelation renders the scene with one pixel per block and upscales it without filtering;
+// otherwise the scene is as large as the frame time allows and upscaled bilinear and sharpened
+static void update_scene_size(void)
+{
+	if (isPixelated) {
+		sceneWidth = min(max((int)(pixels / 10.0f), 1), frameBufferWidth);
+		sceneHeight = min(max((int)(pixels / 10.0f * frameBufferHeight / frameBufferWidth), 1), frameBufferHeight);
+	}
+	else {
+		sceneWidth = dynamicResolution.width(frameBufferWidth);
+		sceneHeight = dynamicResolution.height(frameBufferHeight);
+	}
+
+	// Chroma keying and motion blur sample the whole of their input: a scene smaller than its
+	// targets is copied out first, by the upscale pass at 1:1
+	bool scaled = sceneWidth != frameBufferWidth || sceneHeight != frameBufferHeight;
+	bool cropped = (sceneWidth != sceneTargetWidth || sceneHeight != sceneTargetHeight) && (isChromaKey || motionBlurOn);
+	PostEffect& upscale = postChain.effect(upscaleEffect);
+	upscale.program = isPixelated || !scaled ? nearestUpscaleProgram : sharpenUpscaleProgram;
+	upscale.enabled = scaled || cropped;
+}
+
+// The scene targets only grow, so resizing the window changes only the part of them the scene
+// is rendered to; reallocated when the framebuffer outgrows them, e.g. moved to a larger monitor
+static void reserve_scene_targets(int width, int height)
+{
+	if (width <= sceneTargetWidth && height <= sceneTargetHeight)
+		return;
+	sceneTargetWidth = max(width, sceneTargetWidth);
+	sceneTargetHeight = max(height, sceneTargetHeight);
+
+	glState.bind_texture(4, GL_TEXTURE_2D, renderedTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, sceneTargetWidth, sceneTargetHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glState.bind_texture(6, GL_TEXTURE_2D, velocityTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, sceneTargetWidth, sceneTargetHeight, 0, GL_RG, GL_FLOAT, 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, sceneTargetWidth, sceneTargetHeight);
+}
 static bool non_ego_cube_manipulation()
 {
 	return object_index != 0 && view_index != object_index;
@@ -238,19 +351,11 @@ static void window_size_callback(GLFWwindow* window, int width, int height)
 	// Update projection matrix
 	Projection = glm::perspective(fov, windowWidth / windowHeight, 0.1f, 100.0f);
 
-	// Update texture framebuffer
-	glBindTexture(GL_TEXTURE_2D, renderedTexture);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frameBufferWidth, frameBufferHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, frameBufferWidth, frameBufferHeight);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
+	// The scene is rendered to its lower left frameBufferWidth x frameBufferHeight at most
+	reserve_scene_targets(frameBufferWidth, frameBufferHeight);
 
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
+	// The post targets are reallocated by the next run
+	postChain.resize(frameBufferWidth, frameBufferHeight);
 }
 
 static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
@@ -310,7 +415,7 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 		if (use_arcball())
 		{
 			// 1. Get eye coordinate of arcball and compute its screen coordinate
-			glm::vec4 arcball_eyecoord = glm::inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			glm::vec4 arcball_eyecoord = affine_inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 			glm::vec2 arcballCenter = eye_to_screen(
 				glm::vec3(arcball_eyecoord),
 				Projection,
@@ -322,8 +427,8 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 			glm::vec2 p1 = glm::vec2(prev_x, prev_y) - arcballCenter;
 			glm::vec2 p2 = glm::vec2(xpos, ypos) - arcballCenter;
 
-			glm::vec3 v1 = glm::normalize(glm::vec3(p1.x, p1.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2) - pow(p1.x, 2) - pow(p1.y, 2)))));
-			glm::vec3 v2 = glm::normalize(glm::vec3(p2.x, p2.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2) - pow(p2.x, 2) - pow(p2.y, 2)))));
+			glm::vec3 v1 = glm::normalize(glm::vec3(p1.x, p1.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2.0f) - pow(p1.x, 2.0f) - pow(p1.y, 2.0f)))));
+			glm::vec3 v2 = glm::normalize(glm::vec3(p2.x, p2.y, sqrt(max(0.0f, pow(arcBallScreenRadius, 2.0f) - pow(p2.x, 2.0f) - pow(p2.y, 2.0f)))));
 
 			glm::quat w1, w2;
 			// 2. Compute arcball rotation (Chatper 8)
@@ -345,8 +450,11 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 
 		// Apply transformation with auxiliary frame
 		setWrtFrame();
-		if (object_index == 0) { skyRBT = aFrame * m * glm::inverse(aFrame) * skyRBT; }
-		else { objectRBT[0] = aFrame * m * glm::inverse(aFrame) * objectRBT[0]; }
+		if (object_index == 0) { skyRBT = aFrame * m * affine_inverse(aFrame) * skyRBT; }
+		else {
+			objectRBT[0] = aFrame * m * affine_inverse(aFrame) * objectRBT[0];
+			stepRBT[0] = aFrame * m * affine_inverse(aFrame) * stepRBT[0];
+		}
 
 		prev_x = (float)xpos; prev_y = (float)ypos;
 	}
@@ -391,6 +499,16 @@ void cycleSkyAMatrix()
 	}
 }
 
+// Swaps the places of two cubes, along with the transforms they are interpolated and blurred from
+void swap_cubes(int a, int b)
+{
+	mat4 temp = objectRBT[a];
+	objectRBT[a] = curRBT[a] = objectRBT[b];
+	objectRBT[b] = curRBT[b] = temp;
+	std::swap(stepRBT[a], stepRBT[b]);
+	std::swap(previousObjectRBT[a], previousObjectRBT[b]);
+}
+
 static void keyboard_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	glm::mat4 m;
@@ -400,10 +518,12 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 		{
 		case GLFW_KEY_H:
 			std::cout << "Help:\n\tO: Toggle animation.\n\tP: Change programs.\n\tQ, W, E: Rotate columns." <<
-				"\n\tA, S, D: Rotate rows.\n\tM: Toggle motion blur.\n\tK, L: Decrease/Increase motion blur." <<
+				"\n\tA, S, D: Rotate rows.\n\tM: Toggle motion blur.\n\tK, L: Decrease/Increase motion blur samples." <<
 				"\n\t1, 2, 3: Change bump/normal map (can only be seen in program 1 and 2)." <<
 				"\n\t-: Toggle directional light.\n\tTab: Toggle pixelation." <<
-				"\n\t<- & ->: Decrease or Increase pixelation.\n\tC: Toggle chroma keying." << std::endl;
+				"\n\t<- & ->: Decrease or Increase pixelation.\n\tC: Toggle chroma keying." <<
+				"\n\tR: Toggle dynamic resolution.\n\tF: Toggle frame time graph." <<
+				"\n\tT: Write the last 120 frames to final_trace.json (chrome://tracing)." << std::endl;
 			break;
 
 		case GLFW_KEY_O:
@@ -421,9 +541,7 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 				rot_first_col = true;
 				col_rot_cnt += 1;
 				rot_col = true;
-				mat4 temp = objectRBT[0];
-				objectRBT[0] = curRBT[0] = objectRBT[6];
-				objectRBT[6] = curRBT[6] = temp;
+				swap_cubes(0, 6);
 			}
 			break;
 		case GLFW_KEY_W:// Rotate second column
@@ -431,9 +549,7 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 				rot_second_col = true;
 				col_rot_cnt += 1;
 				rot_col = true;
-				mat4 temp = objectRBT[1];
-				objectRBT[1] = curRBT[1] = objectRBT[7];
-				objectRBT[7] = curRBT[7] = temp;
+				swap_cubes(1, 7);
 			}
 			break;
 		case GLFW_KEY_E:// Rotate third column
@@ -441,9 +557,7 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 				rot_third_col = true;
 				col_rot_cnt += 1;
 				rot_col = true;
-				mat4 temp = objectRBT[2];
-				objectRBT[2] = curRBT[2] = objectRBT[8];
-				objectRBT[8] = curRBT[8] = temp;
+				swap_cubes(2, 8);
 			}
 			break;
 		case GLFW_KEY_A:// Rotate first row
@@ -451,9 +565,7 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 				rot_first_row = true;
 				row_rot_cnt += 1;
 				rot_row = true;
-				mat4 temp = objectRBT[0];
-				objectRBT[0] = curRBT[0] = objectRBT[2];
-				objectRBT[2] = curRBT[2] = temp;
+				swap_cubes(0, 2);
 			}
 			break;
 
@@ -462,9 +574,7 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 				rot_second_row = true;
 				row_rot_cnt += 1;
 				rot_row = true;
-				mat4 temp = objectRBT[3];
-				objectRBT[3] = curRBT[3] = objectRBT[5];
-				objectRBT[5] = curRBT[5] = temp;
+				swap_cubes(3, 5);
 			}
 			break;
 		case GLFW_KEY_D:// Rotate third row
@@ -472,20 +582,25 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 				rot_third_row = true;
 				row_rot_cnt += 1;
 				rot_row = true;
-				mat4 temp = objectRBT[6];
-				objectRBT[6] = curRBT[6] = objectRBT[8];
-				objectRBT[8] = curRBT[8] = temp;
+				swap_cubes(6, 8);
 			}
 			break;
 
+		case GLFW_KEY_F: // Toggle the frame time graph
+			profiler.overlay = !profiler.overlay;
+			break;
+		case GLFW_KEY_T: // Write the last frames' profile
+			profiler.write_trace("final_trace.json");
+			break;
+
 		case GLFW_KEY_M: // Toggle motion blur
 			motionBlurOn = !motionBlurOn;
 			break;
-		case GLFW_KEY_K: // Decrease blur amount
-			blurAmount = max(blurAmount - 1, 1);
+		case GLFW_KEY_K: // Fewer motion blur samples
+			motionBlurSamples = max(motionBlurSamples / 2, 2);
 			break;
-		case GLFW_KEY_L: // Increase blur amount
-			blurAmount = min(blurAmount + 1, 3);
+		case GLFW_KEY_L: // More motion blur samples
+			motionBlurSamples = min(motionBlurSamples * 2, 32);
 			break;
 
 		case GLFW_KEY_1: // Change bump/normal map
@@ -519,6 +634,10 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 			pixels = max(pixels - 50, 50.0f);
 			break;
 
+		case GLFW_KEY_R: // Toggle dynamic resolution
+			dynamicResolution.enabled = !dynamicResolution.enabled;
+			break;
+
 		case GLFW_KEY_C: // Toggle chroma keying
 			isChromaKey = !isChromaKey;
 			if(isChromaKey)
@@ -566,10 +685,6 @@ void rotate_cubes(int c1, int c2, int c3, float& ani_angle, int& ani_count, bool
 		ani_angle = 0.0f;
 		ani_count = 0;
 	}
-
-	mbObjectRBT[c1] = glm::rotate(glm::mat4(1.0f), ani_angle * (-blurAmount), axis) * objectRBT[c1];
-	mbObjectRBT[c2] = glm::rotate(glm::mat4(1.0f), ani_angle * (-blurAmount), axis) * objectRBT[c2];
-	mbObjectRBT[c3] = glm::rotate(glm::mat4(1.0f), ani_angle * (-blurAmount), axis) * objectRBT[c3];
 }
 
 void cube_rotation() {
@@ -593,6 +708,30 @@ void cube_rotation() {
 	}
 }
 
+// One step of the animation: the cube rotations, the deer's turn, the lights and the bump maps
+void simulate_step(double seconds)
+{
+	for (int i = 0; i < 9; i++)
+		stepRBT[i] = objectRBT[i];
+	stepDeerRBT = deerRBT;
+	previousAngle = simAngle;
+	if (!animate)
+		return;
+
+	cube_rotation();
+	deerRBT *= glm::rotate(glm::mat4(1.0f), 0.3f, vec3(0.0f, 1.0f, 0.0f));
+	simAngle += 0.02f;
+
+	bumpTimer += seconds;
+	if (bumpTimer > 0.1) {
+		if (program_cnt == 2) {
+			curBump = (curBump + 1) % 3;
+			bumpTex = bumps[curBump];
+		}
+		bumpTimer = 0.0;
+	}
+}
+
 std::string lightUniformString(int index, std::string property)
 {
 	std::ostringstream oss;
@@ -605,12 +744,23 @@ void setLightUniformLocs(GLuint* uniformArray, GLuint progID)
 {
 	for (int i = 0; i < lights.size(); ++i)
 	{
-		uniformArray[i * 6] = glGetUniformLocation(progID, lightUniformString(i, "position").c_str());
-		uniformArray[i * 6 + 1] = glGetUniformLocation(progID, lightUniformString(i, "color").c_str());
-		uniformArray[i * 6 + 2] = glGetUniformLocation(progID, lightUniformString(i, "falloff").c_str());
-		uniformArray[i * 6 + 3] = glGetUniformLocation(progID, lightUniformString(i, "ambientCoefficient").c_str());
-		uniformArray[i * 6 + 4] = glGetUniformLocation(progID, lightUniformString(i, "coneAngle").c_str());
-		uniformArray[i * 6 + 5] = glGetUniformLocation(progID, lightUniformString(i, "coneDirection").c_str());
+		uniformArray[i * 6] = GetUniformLocation(progID, lightUniformString(i, "position").c_str());
+		uniformArray[i * 6 + 1] = GetUniformLocation(progID, lightUniformString(i, "color").c_str());
+		uniformArray[i * 6 + 2] = GetUniformLocation(progID, lightUniformString(i, "falloff").c_str());
+		uniformArray[i * 6 + 3] = GetUniformLocation(progID, lightUniformString(i, "ambientCoefficient").c_str());
+		uniformArray[i * 6 + 4] = GetUniformLocation(progID, lightUniformString(i, "coneAngle").c_str());
+		uniformArray[i * 6 + 5] = GetUniformLocation(progID, lightUniformString(i, "coneDirection").c_str());
+	}
+}
+
+void init_light_uniforms(void)
+{
+	// Setting lights & getting opacity uniform location
+	for (int i = 0; i < 4; ++i) {
+		numLightsLocs[i] = GetUniformLocation(addPrograms[i], "numLights");
+		setLightUniformLocs(lightLocsCube[i], addPrograms[i]);
+
+		opacityLoc[i] = GetUniformLocation(addPrograms[i], "opacity");
 	}
 }
 
@@ -627,8 +777,75 @@ void setLightUniforms(GLuint* uniformArray)
 	}
 }
 
-int main(void)
+// Render queue callback: the uniforms every draw with this program shares
+static void prepare_program(GLuint program)
+{
+	int p = 0;
+	while (p < 3 && addPrograms[p] != program)
+		++p;
+
+	// Every material texture is on unit 0, see material_item
+	glUniform1i(textureID[p][0], 0);
+	glUniform1f(opacityLoc[p], 1.0);
+	glUniform1i(numLightsLocs[p], (GLint)lights.size());
+	setLightUniforms(lightLocsCube[p]);
+	glUniformMatrix4fv(GetUniformLocation(program, "PreviousEye"), 1, GL_FALSE, &previousEyeRBT[0][0]);
+
+	if (p == 1)
+		glUniform1i(bumpTexID, 2);
+	else if (p == 2)
+		glUniform1i(displacementTexID, 2);
+	else if (p == 3) {
+		glUniform1i(isSky, 0);
+		glUniform1i(cubeTex, 3);
+		glUniform3f(isEye, eyePosition.x, eyePosition.y, eyePosition.z);
+	}
+}
+
+static void skybox_setup(bool begin)
+{
+	glUniform1i(isSky, begin ? 1 : 0);
+}
+
+// A draw with the active program and its textures: the model's texture, the bump map and the cube map
+static RenderItem material_item(Model* model, GLuint modelTexture)
 {
+	RenderItem item;
+	item.model = model;
+	item.program = addPrograms[program_cnt];
+	item.add_texture(0, GL_TEXTURE_2D, modelTexture);
+	if (program_cnt == 1 || program_cnt == 2)
+		item.add_texture(2, GL_TEXTURE_2D, bumpTex);
+	else if (program_cnt == 3)
+		item.add_texture(3, GL_TEXTURE_CUBE_MAP, cubeTexID);
+	return item;
+}
+
+int main(int argc, char* argv[])
+{
+	// --headless renders a fixed number of frames offscreen and exits, see common/headless.hpp
+	headless.parse(argc, argv);
+	if (!headless.init_hints())
+	{
+		return -1;
+	}
+	// --record and --replay log the input, see common/input_log.hpp
+	inputLog.parse(argc, argv);
+	// For benchmarks: --program N starts with program N (P), --motion-blur 0 or 1 (M).
+	// --watch-shaders recompiles edited .glsl files while running.
+	int startProgram = 0;
+	bool watchShaders = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--program") == 0 && hasValue)
+			startProgram = glm::clamp(atoi(argv[++i]), 0, 3);
+		else if (strcmp(argv[i], "--motion-blur") == 0 && hasValue)
+			motionBlurOn = atoi(argv[++i]) != 0;
+		else if (strcmp(argv[i], "--watch-shaders") == 0)
+			watchShaders = true;
+	}
+
 	// Initialise GLFW
 	if (!glfwInit())
 	{
@@ -640,6 +857,7 @@ int main(void)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	headless.window_hints();
 
 	// Open a window and create its OpenGL context
 	window = glfwCreateWindow((int)windowWidth, (int)windowHeight, "Homework 5 | Fredrik Berglund 20166029", NULL, NULL);
@@ -658,11 +876,15 @@ int main(void)
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 	glfwSetWindowSizeCallback(window, window_size_callback);
-	glfwSetMouseButtonCallback(window, mouse_button_callback);
-	glfwSetCursorPosCallback(window, cursor_pos_callback);
-	glfwSetKeyCallback(window, keyboard_callback);
+	if (!inputLog.initialize()) {
+		return -1;
+	}
+	inputLog.set_callbacks(window, keyboard_callback, mouse_button_callback, cursor_pos_callback);
 
 	glfwGetFramebufferSize(window, &frameBufferWidth, &frameBufferHeight);
+	if (!headless.initialize(frameBufferWidth, frameBufferHeight)) {
+		return -1;
+	}
 
 	frameRatio = frameBufferWidth / frameBufferHeight;
 
@@ -681,12 +903,31 @@ int main(void)
 	aFrame = linearFact(skyRBT);
 	// initial eye frame = sky frame;
 	eyeRBT = skyRBT;
+	previousEyeRBT = eyeRBT;
 	
 	//init shader
-	init_shader(0, "VertexShader.glsl", "FragmentShader.glsl");
-	init_shader(1, "BumpVertexShader.glsl", "BumpFragmentShader.glsl");
-	init_shader(2, "DisplacementVertexShader.glsl", "DisplacementFragmentShader.glsl");
-	init_shader(3, "RefractionVertexShader.glsl", "RefractionFragmentShader.glsl");
+	// Lights are ordered directional, point, point, spot (see the setup below)
+	// Every program can draw the cube grid instanced, single models pass ModelTransform the same way
+	ShaderPermutation lit;
+	lit.instanced = true;
+	lit.velocity = true;
+	lit.numDirLights = 1;
+	lit.numPointLights = 2;
+	lit.numSpotLights = 1;
+	ShaderPermutation bumped = lit;
+	bumped.bump = true;
+
+	init_shader(0, "VertexShader.glsl", "FragmentShader.glsl", lit);
+	init_shader(1, "VertexShader.glsl", "FragmentShader.glsl", bumped);
+	init_shader(2, "DisplacementVertexShader.glsl", "DisplacementFragmentShader.glsl", lit);
+	ShaderPermutation refraction;
+	refraction.instanced = true;
+	refraction.velocity = true;
+	init_shader(3, "RefractionVertexShader.glsl", "RefractionFragmentShader.glsl", refraction);
+	sharpenUpscaleProgram = SubmitShaders("passthroughVertexShader.glsl", "textureFragmentShader.glsl", "#define UPSCALE\n#define SHARPEN\n");
+	nearestUpscaleProgram = SubmitShaders("passthroughVertexShader.glsl", "textureFragmentShader.glsl", "#define UPSCALE\n");
+	GLuint chromaKeyProgram = SubmitShaders("passthroughVertexShader.glsl", "textureFragmentShader.glsl", "#define CHROMA_KEY\n");
+	GLuint motionBlurProgram = SubmitShaders("passthroughVertexShader.glsl", "textureFragmentShader.glsl", "#define MOTION_BLUR\n");
 
 	// Initialize model
 	deer = Model();
@@ -694,7 +935,7 @@ int main(void)
 	deer.initialize(DRAW_TYPE::ARRAY, addPrograms[0]);
 	deer.set_projection(&Projection);
 	deer.set_eye(&eyeRBT);
-	deer.set_model(&deerRBT);
+	deer.set_model(&renderDeerRBT);
 
 	//TODO: Initialize cube model by calling textured cube model
 	init_cubeRBT();	
@@ -704,7 +945,7 @@ int main(void)
 
 	cubes[0].set_projection(&Projection);
 	cubes[0].set_eye(&eyeRBT);
-	cubes[0].set_model(&objectRBT[0]);
+	cubes[0].set_model(&renderRBT[0]);
 
 	for (int i = 1; i < 9; i++) {
 		cubes[i] = Model();
@@ -712,19 +953,9 @@ int main(void)
 
 		cubes[i].set_projection(&Projection);
 		cubes[i].set_eye(&eyeRBT);
-		cubes[i].set_model(&objectRBT[i]);
+		cubes[i].set_model(&renderRBT[i]);
 	}
 
-	// Motion blur cubes
-	for (int i = 0; i < 9; i++) {
-		mbCubes[i] = Model();
-		mbCubes[i].initialize(DRAW_TYPE::ARRAY, cubes[0]);
-
-		mbCubes[i].set_projection(&Projection);
-		mbCubes[i].set_eye(&eyeRBT);
-		mbCubes[i].set_model(&mbObjectRBT[i]);
-	}
-	
 	skybox = Model();
 	init_skybox(skybox);
 	skybox.initialize(DRAW_TYPE::ARRAY, addPrograms[2]);
@@ -740,16 +971,34 @@ int main(void)
 	arcBall.set_eye(&eyeRBT);
 	arcBall.set_model(&arcballRBT);
 
+	for (int i = 0; i < 9; i++)
+		cullList.add(&cubes[i]);
+	deerCull = cullList.add(&deer);
+
+	meshStore.add(&cubes[0]);
+	meshStore.add(&deer);
+	meshStore.upload();
+
 	// init textures
 	init_texture();
+	texture[2] = loadBMP_custom("spaaace.bmp");
+
+	// The shaders have been compiling while the meshes and textures were loaded. The window keeps
+	// handling its events until they are linked, so FinishShaders only checks them
+	while (!ShadersReady())
+		glfwWaitEventsTimeout(0.001);
+	FinishShaders();
+	init_texture_uniforms();
 	
 	mat4 oO[9];
-	for(int i=0;i<9;i++) oO[i] = curRBT[i] = mbObjectRBT[i] = objectRBT[i];
-	float angle = 0.0f;
-	double pre_time = glfwGetTime();
-	double pre_time2 = pre_time;
-	program_cnt = 0;
-	set_program(0);
+	for(int i=0;i<9;i++) oO[i] = curRBT[i] = previousObjectRBT[i] = stepRBT[i] = renderRBT[i] = objectRBT[i];
+	// Steps of 8 ms, at the speeds the animation had when it ran once per 8 ms frame
+	frameScheduler.initialize(0.008, 0.008);
+	// Logged input is replayed frame by frame, so the frames have to be the same length
+	if (headless.enabled || inputLog.active())
+		frameScheduler.set_fixed_frame(headless.frame_seconds(), !headless.enabled);
+	program_cnt = startProgram;
+	set_program(program_cnt);
 
 	// Setup of lights
 	Light dirLight;
@@ -787,13 +1036,7 @@ int main(void)
 	if (lights.size() != LIGHT_COUNT)
 		std::cout << "Change LIGHT_COUNT." << std::endl;
 
-	// Setting lights & getting opacity uniform location
-	for (int i = 0; i < 4; ++i) {
-		numLightsLocs[i] = glGetUniformLocation(addPrograms[i], "numLights");
-		setLightUniformLocs(lightLocsCube[i], addPrograms[i]);
-
-		opacityLoc[i] = glGetUniformLocation(addPrograms[i], "opacity");
-	}
+	init_light_uniforms();
 
 	//http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-14-render-to-texture/
 	// The framebuffer, which regroups 0, 1, or more textures, and 0 or 1 depth buffer.
@@ -806,252 +1049,209 @@ int main(void)
 	// "Bind" the newly created texture : all future texture functions will modify this texture
 	glBindTexture(GL_TEXTURE_2D, renderedTexture);
 
-	// Give an empty image to OpenGL ( the last "0" )
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frameBufferWidth, frameBufferHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
-
-	// Poor filtering.
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	// Bilinear for the upscaling, pixelation fetches texels
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
 	// The depth buffer
 	glGenRenderbuffers(1, &depthrenderbuffer);
 	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, frameBufferWidth, frameBufferHeight);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
 
 	// Set "renderedTexture" as our colour attachement #0
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
 
+	// The velocity buffer, written by the velocity permutation of the programs
+	glGenTextures(1, &velocityTexture);
+	glBindTexture(GL_TEXTURE_2D, velocityTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, velocityTexture, 0);
+
+	// Give them empty images, at least as large as the monitor so that maximizing the window
+	// doesn't reallocate them either
+	int targetWidth = frameBufferWidth, targetHeight = frameBufferHeight;
+	GLFWmonitor* monitor = headless.enabled ? NULL : glfwGetPrimaryMonitor();
+	const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : NULL;
+	if (mode) {
+		targetWidth = max(targetWidth, mode->width);
+		targetHeight = max(targetHeight, mode->height);
+	}
+	reserve_scene_targets(targetWidth, targetHeight);
+
 	// Set the list of draw buffers.
-	GLenum DrawBuffers[1] = { GL_COLOR_ATTACHMENT0 };
-	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
+	GLenum DrawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, DrawBuffers); // "2" is the size of DrawBuffers
 
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		return false;
 
-	// The fullscreen quad's FBO
-	GLuint quad_VertexArrayID;
-	glGenVertexArrays(1, &quad_VertexArrayID);
-	glBindVertexArray(quad_VertexArrayID);
-
-	static const GLfloat g_quad_vertex_buffer_data[] = {
-		-1.0f, -1.0f, 0.0f,
-		1.0f, -1.0f, 0.0f,
-		-1.0f,  1.0f, 0.0f,
-		-1.0f,  1.0f, 0.0f,
-		1.0f, -1.0f, 0.0f,
-		1.0f,  1.0f, 0.0f,
-	};
+	// Upscaling first, so the chroma key replacement and the blur are at full resolution
+	postChain.initialize();
+	upscaleEffect = postChain.add(PostEffect("upscale", sharpenUpscaleProgram, upscale_setup));
+	chromaKeyEffect = postChain.add(PostEffect("chroma key", chromaKeyProgram, chroma_key_setup));
+	motionBlurEffect = postChain.add(PostEffect("motion blur", motionBlurProgram, motion_blur_setup));
+	postChain.resize(frameBufferWidth, frameBufferHeight);
 
-	GLuint quad_vertexbuffer;
-	glGenBuffers(1, &quad_vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_quad_vertex_buffer_data), g_quad_vertex_buffer_data, GL_STATIC_DRAW);
-
-	// Create and compile our GLSL program from the shaders
-	GLuint quad_programID = LoadShaders("passthroughVertexShader.glsl", "textureFragmentShader.glsl");
-
-	GLuint texID = glGetUniformLocation(quad_programID, "renderedTexture");
-	GLuint timeID = glGetUniformLocation(quad_programID, "time");
-	GLuint pixelsID = glGetUniformLocation(quad_programID, "pixels");
-	GLuint isPixelatedID = glGetUniformLocation(quad_programID, "isPixelated");
-	GLuint heightID = glGetUniformLocation(quad_programID, "frameHeight");
-	GLuint widthID = glGetUniformLocation(quad_programID, "frameWidth");
-	GLuint frameRatioID = glGetUniformLocation(quad_programID, "frameRatio");
-	texture[2] = loadBMP_custom("spaaace.bmp");
-	GLuint replaceTexID = glGetUniformLocation(quad_programID, "replaceTexture");
-	GLuint isChromaKeyID = glGetUniformLocation(quad_programID, "isChromaKey");
+	// The budget is the loop's 8 ms period
+	dynamicResolution.initialize(8.0f);
 
 	// Enable blending
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	do {
-		double cur_time = glfwGetTime();
-		if (cur_time - pre_time > 0.008) {
-			// Render to our framebuffer
-			glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-			glViewport(0, 0, frameBufferWidth, frameBufferHeight); // Render on the whole framebuffer
-
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear the screen
-			eyeRBT = (view_index == 0) ? skyRBT : objectRBT[0];
-
-			//cube rotation
-			if (animate) {
-				cube_rotation();
-				deerRBT *= glm::rotate(glm::mat4(1.0f), 0.3f, vec3(0.0f, 1.0f, 0.0f));
-			}
-
-			// Animate lights
-			lights[1].position.x = cos(angle / 2) * 2;
-			lights[1].position.y = cos(angle / 4) * 4 + 1.5f;
-			lights[1].position.z = sin(angle / 4) * 4 + 1.0f;
-
-			lights[2].position.x = cos(angle / 6) / 2;
-			lights[2].position.y = cos(angle / 7) / 4 - 1.5f;
-
-			lights[3].position.x = sin(angle / 6) * 1.5;
-			lights[3].coneDirection.x = sin(angle / 5) * 4;
-			lights[3].coneDirection.y = cos(angle / 3) / 2 + 0.5f;
-
-			if (animate)
-				angle += 0.02f;
-			if (angle == 360.0f) angle = 0.0f;
-
-			glUseProgram(addPrograms[program_cnt]);
-
-			if (program_cnt == 3) {
-				isSky = glGetUniformLocation(addPrograms[3], "DrawSkyBox");
-				glUniform1i(isSky, 0);
-				// Pass the cubemap texture to shader
-				glActiveTexture(GL_TEXTURE0 + 3);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTexID);
-				glUniform1i(cubeTex, 3);
-			}
-
-			// Pass the first texture value to shader
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, texture[0]);
-			glUniform1i(textureID[program_cnt][0], 0);
+	// Never while benchmarking
+	WatchShaders(watchShaders && !headless.enabled);
 
-			glUniform1i(numLightsLocs[program_cnt], (GLint)lights.size());
-			setLightUniforms(lightLocsCube[program_cnt]);
+	dynamicRing.initialize(64 * 1024);
+	frameRing = &dynamicRing;
+	renderQueue.set_program_callback(prepare_program);
+	renderQueue.set_mesh_store(&meshStore);
 
-			// Draw regular cubes
-			glUniform1f(opacityLoc[program_cnt], 1.0);
-			cubes[0].draw();
+	profiler.initialize();
 
-			for (int i = 1; i < 9; i++) {
-				cubes[i].draw2(cubes[0]);
-			}
-
-			// Draw motion blur cubes
-			if (motionBlurOn && !isChromaKey && program_cnt != 1 && program_cnt != 3) {
-				glUniform1f(opacityLoc[program_cnt], 0.5);
-				for (int i = 0; i < 9; ++i)
-					mbCubes[i].draw2(cubes[0]);
-				glUniform1f(opacityLoc[program_cnt], 1.0);
-			}
-
-			// Pass bump(normalmap) texture value to shader
-			if (program_cnt == 1) {
-				glActiveTexture(GL_TEXTURE0 + 2);
-				glBindTexture(GL_TEXTURE_2D, bumpTex);
-				glUniform1i(bumpTexID, 2);
-			}
-			else if (program_cnt == 2)
-			{
-				if (animate && cur_time - pre_time2 > 0.1) {
-					curBump = (curBump + 1) % 3;
-					bumpTex = bumps[curBump];
-					pre_time2 = cur_time;
-				}
-				glActiveTexture(GL_TEXTURE0 + 2);
-				glBindTexture(GL_TEXTURE_2D, bumpTex);
-				glUniform1i(displacementTexID, 2);
-			}
-
-			// Pass the second texture value to shader
-			glActiveTexture(GL_TEXTURE0 + 1);
-			glBindTexture(GL_TEXTURE_2D, texture[1]);
-			glUniform1i(textureID[program_cnt][1], 1);
-
-			deer.draw();
-
-			if (program_cnt == 3) {
-				isSky = glGetUniformLocation(addPrograms[3], "DrawSkyBox");
-				glUniform1i(isSky, 1);
+	// Textures and framebuffers were set up without the state cache
+	glState.invalidate();
 
-				glUseProgram(addPrograms[3]);
-				isEye = glGetUniformLocation(addPrograms[3], "WorldCameraPosition");
-				glUniform3f(isEye, eyePosition.x, eyePosition.y, eyePosition.z);
-
-				cubeTex = glGetUniformLocation(addPrograms[3], "cubemap");
-				glActiveTexture(GL_TEXTURE0 + 3);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTexID);
-				glUniform1i(cubeTex, 3);
-
-				glDepthMask(GL_FALSE);
-				skybox.draw();
-				glDepthMask(GL_TRUE);
+	const glm::mat4 startSkyRBT = skyRBT;
+	do {
+		if (headless.enabled)
+			skyRBT = headless.camera(startSkyRBT);
 
-				glUniform1i(isSky, 0);
-			}
+		// Fixed steps of the animation, then the frame between the last two of them
+		int steps = frameScheduler.begin_frame();
+		inputLog.begin_frame(window);
+		profiler.begin_frame();
+		{
+			ProfileScope scope("Simulation");
+			for (; steps > 0; --steps)
+				simulate_step(frameScheduler.step_seconds());
+		}
+		float alpha = frameScheduler.alpha();
+		for (int i = 0; i < 9; i++)
+			renderRBT[i] = interpolate_transform(stepRBT[i], objectRBT[i], alpha);
+		renderDeerRBT = interpolate_transform(stepDeerRBT, deerRBT, alpha);
+
+		if (UpdateShaders()) {
+			init_texture_uniforms();
+			init_light_uniforms();
+		}
 
-			// Arcball
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-			switch (object_index)
-			{
-			case 0:
-				arcballRBT = (sky_type == 0) ? worldRBT : skyRBT;
-				break;
-			case 1:
-				arcballRBT = objectRBT[0];
-				break;
-			default:
-				break;
+		// Render to our framebuffer
+		glState.bind_framebuffer(GL_FRAMEBUFFER, FramebufferName);
+		dynamicResolution.begin_frame();
+		update_scene_size();
+		glViewport(0, 0, sceneWidth, sceneHeight);
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear the screen
+		// Nothing moves where nothing is drawn, whatever the clear color
+		static const GLfloat noVelocity[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glClearBufferfv(GL_COLOR, 1, noVelocity);
+		eyeRBT = (view_index == 0) ? skyRBT : renderRBT[0];
+		dynamicRing.begin_frame();
+
+		// Animate lights
+		float angle = glm::mix(previousAngle, simAngle, alpha);
+		lights[1].position.x = cos(angle / 2) * 2;
+		lights[1].position.y = cos(angle / 4) * 4 + 1.5f;
+		lights[1].position.z = sin(angle / 4) * 4 + 1.0f;
+
+		lights[2].position.x = cos(angle / 6) / 2;
+		lights[2].position.y = cos(angle / 7) / 4 - 1.5f;
+
+		lights[3].position.x = sin(angle / 6) * 1.5;
+		lights[3].coneDirection.x = sin(angle / 5) * 4;
+		lights[3].coneDirection.y = cos(angle / 3) / 2 + 0.5f;
+
+		cullList.cull(Projection, eyeRBT);
+		cullList.report("Final");
+
+		// Record this frame's draws; the queue orders them by program, textures and depth
+		renderQueue.clear();
+
+		// Cubes, the visible ones in a single instanced draw
+		mat4 instanceRBT[9], previousInstanceRBT[9];
+		int numInstances = 0;
+		for (int i = 0; i < 9; i++) {
+			if (cullList.visible(i)) {
+				previousInstanceRBT[numInstances] = previousObjectRBT[i];
+				instanceRBT[numInstances++] = renderRBT[i];
 			}
-		
-			ScreenToEyeScale = compute_screen_eye_scale(
-				(glm::inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z,
-				fovy,
-				frameBufferHeight
-				);
-			arcBallScale = ScreenToEyeScale * arcBallScreenRadius;
-			arcballRBT = arcballRBT * glm::scale(worldRBT, glm::vec3(arcBallScale, arcBallScale, arcBallScale));
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-			// Render to the screen
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
-			glViewport(0, 0, frameBufferWidth, frameBufferHeight); // Render on the whole framebuffer
-
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-			// Use simple vertex and texture shader
-			glUseProgram(quad_programID);
+		}
+		if (numInstances > 0) {
+			RenderItem cubeItem = material_item(&cubes[0], texture[0]);
+			cubeItem.transforms = instanceRBT;
+			cubeItem.previousTransforms = previousInstanceRBT;
+			cubeItem.count = numInstances;
+			renderQueue.add(cubeItem);
+		}
 
-			// Bind our texture in Texture Unit 4
-			glActiveTexture(GL_TEXTURE0 + 4);
-			glBindTexture(GL_TEXTURE_2D, renderedTexture);
-			// Set our "renderedTexture" sampler to user Texture Unit 4
-			glUniform1i(texID, 4);
+		if (cullList.visible(deerCull)) {
+			RenderItem deerItem = material_item(&deer, texture[1]);
+			deerItem.previousTransforms = &previousDeerRBT;
+			renderQueue.add(deerItem);
+		}
 
-			// Set other uniforms for shader
-			if(isPixelated)
-				glUniform1i(isPixelatedID, 1);
-			else
-				glUniform1i(isPixelatedID, 0);
-			glUniform1f(pixelsID, pixels);
-			glUniform1f(heightID, (float)frameBufferHeight);
-			glUniform1f(widthID, (float)frameBufferWidth);
-			glUniform1f(frameRatioID, frameRatio);
-
-			glUniform1i(isChromaKeyID, isChromaKey);
-			glActiveTexture(GL_TEXTURE0 + 5);
-			glBindTexture(GL_TEXTURE_2D, texture[2]);
-			glUniform1i(replaceTexID, 5);
-
-			// 1st attribute buffer : vertices
-			glEnableVertexAttribArray(0);
-			glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
-			glVertexAttribPointer(
-				0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
-				3,                  // size
-				GL_FLOAT,           // type
-				GL_FALSE,           // normalized?
-				0,                  // stride
-				(void*)0            // array buffer offset
-			);
+		if (program_cnt == 3) {
+			RenderItem skyItem;
+			skyItem.model = &skybox;
+			skyItem.program = addPrograms[3];
+			skyItem.pass = PASS_SKY;
+			skyItem.depthWrite = false;
+			skyItem.add_texture(3, GL_TEXTURE_CUBE_MAP, cubeTexID);
+			skyItem.setup = skybox_setup;
+			renderQueue.add(skyItem);
+		}
 
-			// Draw the triangles!
-			glDrawArrays(GL_TRIANGLES, 0, 6); // 2*3 indices starting at 0 -> 2 triangles
+		{
+			ProfileScope scope("Render queue");
+			renderQueue.sort(eyeRBT);
+			renderQueue.draw();
+		}
 
-			glDisableVertexAttribArray(0);
+		for (int i = 0; i < 9; i++)
+			previousObjectRBT[i] = renderRBT[i];
+		previousDeerRBT = renderDeerRBT;
+		previousEyeRBT = eyeRBT;
 
-			glfwSwapBuffers(window);
-			glfwPollEvents();
-			pre_time = cur_time;
+		// Arcball
+		glState.polygon_mode(GL_LINE);
+		switch (object_index)
+		{
+		case 0:
+			arcballRBT = (sky_type == 0) ? worldRBT : skyRBT;
+			break;
+		case 1:
+			arcballRBT = renderRBT[0];
+			break;
+		default:
+			break;
 		}
+	
+		ScreenToEyeScale = compute_screen_eye_scale(
+			(affine_inverse(eyeRBT) * arcballRBT * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)).z,
+			fovy,
+			frameBufferHeight
+			);
+		arcBallScale = ScreenToEyeScale * arcBallScreenRadius;
+		arcballRBT = arcballRBT * glm::scale(worldRBT, glm::vec3(arcBallScale, arcBallScale, arcBallScale));
+		glState.polygon_mode(GL_FILL);
+
+		// Post process into the window, disabled effects are left out
+		postChain.set_enabled(chromaKeyEffect, isChromaKey);
+		postChain.set_enabled(motionBlurEffect, motionBlurOn);
+		postChain.run(FramebufferName, renderedTexture, sceneWidth, sceneHeight, headless.framebuffer());
+		dynamicResolution.end_frame();
+		profiler.draw_overlay(frameBufferWidth, frameBufferHeight);
+		profiler.end_frame();
+
+		dynamicRing.end_frame();
+		glState.end_frame();
+		glState.report("Final");
+		glfwSwapBuffers(window);
+		headless.end_frame(window);
+		inputLog.end_frame();
+		frameScheduler.report("Final");
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
 		glfwWindowShouldClose(window) == 0);
@@ -1059,9 +1259,16 @@ int main(void)
 	// Clean up data structures and glsl objects	
 	for (int i = 0; i < 9; i++) {
 		cubes[i].cleanup();
-		mbCubes[i].cleanup();
 		deer.cleanup();
 	}
+	meshStore.cleanup();
+	postChain.cleanup();
+	dynamicResolution.cleanup();
+	dynamicRing.cleanup();
+	profiler.cleanup();
+
+	headless.cleanup();
+	inputLog.cleanup();
 
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
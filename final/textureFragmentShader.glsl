@@ -2,18 +2,25 @@
 
 #version 330 core
 
+// One pass of the post chain (common/post_chain.hpp), the effect picked by a define:
+// UPSCALE (with SHARPEN: bilinear and sharpened, else nearest for pixelation), CHROMA_KEY or
+// MOTION_BLUR; without one the pass copies.
+
 in vec2 UV;
 
 out vec4 color;
 
-uniform sampler2D renderedTexture;
+uniform sampler2D renderedTexture; // the previous pass, or the scene
+
+#ifdef UPSCALE
+uniform vec2 sourceScale; // the part of renderedTexture the scene was rendered to
+#ifdef SHARPEN
+uniform float sharpness;
+#endif
+#endif
+
+#ifdef CHROMA_KEY
 uniform sampler2D replaceTexture;
-uniform bool isChromaKey;
-uniform bool isPixelated;
-uniform float pixels;
-uniform float frameHeight;
-uniform float frameWidth;
-uniform float frameRatio;
 
 // Chroma keying: https://www.shadertoy.com/view/4dX3WN
 vec3 rgb2hsv(vec3 rgb) {
@@ -50,23 +57,55 @@ float chromaKey(vec3 color) {
 	float dist = length(weights * (target - hsv));
 	return 1. - clamp(3. * dist - 1.5, 0., 1.);
 }
+#endif
 
-void main() {
-	vec2 Coord = UV;
+#ifdef MOTION_BLUR
+// Motion blur along the velocity buffer, the same number of taps for every pixel
+uniform sampler2D velocityTexture;
+uniform vec2 sceneScale; // the part of velocityTexture the scene was rendered to
+uniform int motionBlurSamples;
+const float maxBlur = 0.05; // longest blur, in texture coordinates; cuts off jumps of the camera
+#endif
 
-	if(isPixelated) {
-		float ratio = frameWidth/frameHeight;
-		float dx = 10.0 * (1.0 / pixels);
-		float dy = 10.0 * ratio * (1.0 / pixels);
-		Coord = vec2(dx * floor(UV.x / dx), dy * floor(UV.y / dy));
-	}
+void main() {
+#ifdef UPSCALE
+	vec2 sourceUV = UV * sourceScale;
+#ifdef SHARPEN
+	// Bilinear, then an unsharp mask over the four neighbours; the taps stay inside the scene
+	vec2 texel = 1.0 / vec2(textureSize( renderedTexture, 0 ));
+	vec2 lo = 0.5 * texel, hi = sourceScale - 0.5 * texel;
+	color = texture( renderedTexture, sourceUV );
+	vec4 around = texture( renderedTexture, clamp(sourceUV + vec2(texel.x, 0.0), lo, hi) )
+		+ texture( renderedTexture, clamp(sourceUV - vec2(texel.x, 0.0), lo, hi) )
+		+ texture( renderedTexture, clamp(sourceUV + vec2(0.0, texel.y), lo, hi) )
+		+ texture( renderedTexture, clamp(sourceUV - vec2(0.0, texel.y), lo, hi) );
+	color = clamp(color + sharpness * (color - 0.25 * around), 0.0, 1.0);
+#else
+	color = texelFetch( renderedTexture, ivec2(sourceUV * vec2(textureSize( renderedTexture, 0 ))), 0 );
+#endif
+#else
+	color = texture( renderedTexture, UV );
+#endif
 
-	color = texture( renderedTexture, Coord );
+#ifdef CHROMA_KEY
+	vec4 replaceColor = texture( replaceTexture, UV );
+	float incrustation = chromaKey(color.rgb);
 
-	if(isChromaKey) {
-		vec4 replaceColor = texture( replaceTexture, UV );
-		float incrustation = chromaKey(color.rgb);
+	color = mix(color, replaceColor, incrustation);
+#endif
 
-		color = mix(color, replaceColor, incrustation);
+#ifdef MOTION_BLUR
+	// Taps spread over the motion of the last frame, centered on the pixel
+	vec2 velocity = texture( velocityTexture, UV * sceneScale ).rg;
+	float speed = length(velocity);
+	if(speed > 0.0) {
+		velocity *= min(speed, maxBlur) / speed;
+		vec4 sum = vec4(0.0);
+		for(int i = 0; i < motionBlurSamples; ++i) {
+			float t = float(i) / float(max(motionBlurSamples - 1, 1)) - 0.5;
+			sum += texture( renderedTexture, UV + velocity * t );
+		}
+		color = sum / float(motionBlurSamples);
 	}
-}
\ No newline at end of file
+#endif
+}
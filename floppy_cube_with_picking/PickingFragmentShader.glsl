@@ -1,10 +1,10 @@
 #version 330 core
 
 // Ouput data
-out vec3 color;
+layout(location = 0) out uint pickedID;
 
-uniform vec3 objectID;
+flat in uint fragmentObjectID;
 
 void main(){
-	color = objectID;
+	pickedID = fragmentObjectID;
 }
\ No newline at end of file
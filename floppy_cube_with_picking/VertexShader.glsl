@@ -9,7 +9,7 @@ layout(location = 2) in vec3 vertexColor;
 out vec3 fragmentPosition;
 out vec3 fragmentNormal;
 out vec3 fragmentColor;
-uniform mat4 ModelTransform;
+#include "../common/instancing.glsl"
 uniform mat4 Eye;
 uniform mat4 Projection;
 
@@ -5,6 +5,7 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
 // Include GLEW
@@ -26,6 +27,18 @@ using namespace glm;
 #include <common/geometry.hpp>
 #include <common/arcball.hpp>
 #include <common/picking.hpp>
+#include <common/bvh.hpp>
+#include <common/culling.hpp>
+#include <common/scene_graph.hpp>
+#include <common/rbt.hpp>
+#include <common/ring_buffer.hpp>
+#include <common/gl_state.hpp>
+#include <common/headless.hpp>
+#include <common/profiler.hpp>
+#include <common/input_log.hpp>
+
+// Offscreen runs without a display, for benchmarks
+Headless headless;
 
 const int NUM_CUBES = 9;
 const int MAX_PARENTS = 2;
@@ -233,12 +246,21 @@ glm::vec3 axisVec; // The axis to rotate around
 int rot_mid = -1; // Number of the cube we rotate around (ID - 1)
 
 bool picking = true;
+bool ray_picking = false; // pick with a ray against the BVH instead of the picking pass
+
+// Shift + left drag selects every cube inside the rectangle
+bool marquee = false;
+double marquee_x, marquee_y;
+
+// All nine cubes share one mesh
+MeshBVH cubeBVH;
+SceneBVH sceneBVH;
 
 float g_groundSize = 100.0f;
 float g_groundY = -2.5f;
 
 GLint lightLocGround, lightLocArc;
-GLint lightLoc[NUM_CUBES];
+GLint lightLocCubes;
 
 // View properties
 glm::mat4 Projection;
@@ -251,10 +273,16 @@ float fovy = fov;
 
 // Model properties
 Model ground;
-Model rubikModels[NUM_CUBES];
+// All cubes, drawn and picked instanced with the transforms of cubeNodes
+Model rubikModel;
 Model pickedModel;
 
+// Frustum culling, the cubes are entries 0 .. NUM_CUBES-1
+CullList cullList;
+int pickedCull, groundCull, arcBallCull;
+
 glm::mat4 skyRBT;
+// Initial placement of the cubes, relative to the floppy cube's node
 glm::mat4 rubikRBT[NUM_CUBES] = {
 	glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 1.2f, -1.0f)),
 	glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.2f, -1.0f)),
@@ -267,6 +295,19 @@ glm::mat4 rubikRBT[NUM_CUBES] = {
 	glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, -0.8f, -1.0f))
 };
 glm::mat4 eyeRBT;
+
+// The floppy cube is a node with the nine cubes as its children: rotating the whole cube
+// changes one transform, turning a face the three of that face.
+SceneGraph scene;
+// Per frame uploads, the instance transforms of the cubes for drawing and picking
+RingBuffer dynamicRing;
+int floppyNode;
+int cubeNodes[NUM_CUBES];
+
+inline const glm::mat4& cubeRBT(int i)
+{
+	return scene.world(cubeNodes[i]);
+}
 glm::mat4 worldRBT = glm::mat4(1.0f);
 glm::mat4 aFrame;
 glm::mat4 pickedRBT = glm::mat4(1.0f);
@@ -304,9 +345,9 @@ void update_axisVec()
 	{
 		glm::vec4 a;
 		if (rot_mid == 1 || rot_mid == 3)
-			a = rubikRBT[rot_mid][3] - rubikRBT[4][3];
+			a = cubeRBT(rot_mid)[3] - cubeRBT(4)[3];
 		else
-			a = rubikRBT[4][3] - rubikRBT[rot_mid][3];
+			a = cubeRBT(4)[3] - cubeRBT(rot_mid)[3];
 
 		axisVec = glm::vec3(a[0], a[1], a[2]);
 	}
@@ -319,13 +360,13 @@ void update_axisVec()
 		{
 			c1 = 0;
 			c2 = 2;
-			a = rubikRBT[(rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+			a = cubeRBT((rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 		}
 		else if (rotatingCubes[1] == 3 || rotatingCubes[1] == 5)
 		{
 			c1 = 1;
 			c2 = 3;
-			a = rubikRBT[(rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+			a = cubeRBT((rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 		}
 
 		axisVec = glm::vec3(a[0], a[1], a[2]);
@@ -357,9 +398,6 @@ static void window_size_callback(GLFWwindow* window, int width, int height)
 	glfwGetFramebufferSize(window, &frameBufferWidth, &frameBufferHeight);
 	glViewport(0, 0, (GLsizei) frameBufferWidth, (GLsizei) frameBufferHeight);
 
-	// re-allocate textures with respect to new framebuffer width and height
-	reallocate_picking_texture(frameBufferWidth, frameBufferHeight);
-
 	// Update projection matrix
 	Projection = glm::perspective(fov, ((float) frameBufferWidth / (float) frameBufferHeight), 0.1f, 100.0f);
 
@@ -397,9 +435,9 @@ void checkSelection()
 
 			glm::vec4 a;
 			if (rot_mid == 1 || rot_mid == 3)
-				a = rubikRBT[rot_mid][3] - rubikRBT[4][3];
+				a = cubeRBT(rot_mid)[3] - cubeRBT(4)[3];
 			else
-				a = rubikRBT[4][3] - rubikRBT[rot_mid][3];
+				a = cubeRBT(4)[3] - cubeRBT(rot_mid)[3];
 
 			axisVec = glm::vec3(a[0], a[1], a[2]);
 
@@ -414,13 +452,13 @@ void checkSelection()
 			{
 				c1 = 0;
 				c2 = 2;
-				a = rubikRBT[(rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+				a = cubeRBT((rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 			}
 			else if (picked_nums[0] == 3 || picked_nums[0] == 5)
 			{
 				c1 = 1;
 				c2 = 3;
-				a = rubikRBT[(rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+				a = cubeRBT((rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 			}
 
 			// Check if parent and children have same rotation
@@ -451,9 +489,9 @@ void checkSelection()
 
 			glm::vec4 a;
 			if (rot_mid == 1 || rot_mid == 3)
-				a = rubikRBT[rot_mid][3] - rubikRBT[4][3];
+				a = cubeRBT(rot_mid)[3] - cubeRBT(4)[3];
 			else
-				a = rubikRBT[4][3] - rubikRBT[rot_mid][3];
+				a = cubeRBT(4)[3] - cubeRBT(rot_mid)[3];
 
 			axisVec = glm::vec3(a[0], a[1], a[2]);
 
@@ -468,13 +506,13 @@ void checkSelection()
 			{
 				c1 = 0;
 				c2 = 2;
-				a = rubikRBT[(rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+				a = cubeRBT((rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 			}
 			else if (picked_nums[1] == 3 || picked_nums[1] == 5)
 			{
 				c1 = 1;
 				c2 = 3;
-				a = rubikRBT[(rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+				a = cubeRBT((rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 			}
 
 			// Check if parent and children have same rotation
@@ -539,9 +577,9 @@ void checkSelection()
 
 						glm::vec4 a;
 						if (rot_mid == 1 || rot_mid == 3)
-							a = rubikRBT[rot_mid][3] - rubikRBT[4][3];
+							a = cubeRBT(rot_mid)[3] - cubeRBT(4)[3];
 						else
-							a = rubikRBT[4][3] - rubikRBT[rot_mid][3];
+							a = cubeRBT(4)[3] - cubeRBT(rot_mid)[3];
 
 						axisVec = glm::vec3(a[0], a[1], a[2]);
 
@@ -557,13 +595,13 @@ void checkSelection()
 						{
 							c1 = 0;
 							c2 = 2;
-							a = rubikRBT[(rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+							a = cubeRBT((rubiksCubes[rot_mid].child(c2 + 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 						}
 						else if (picked_nums[1] == 3 || picked_nums[1] == 5)
 						{
 							c1 = 1;
 							c2 = 3;
-							a = rubikRBT[(rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1][3] - rubikRBT[rot_mid][3];
+							a = cubeRBT((rubiksCubes[rot_mid].child(c1 - 1))->getID() - 1)[3] - cubeRBT(rot_mid)[3];
 						}
 
 						// Check if parent and children have same rotation
@@ -602,35 +640,35 @@ void alignCubes()
 
 				if (angle != 0)
 				{
-					glm::mat4 A = transFact(rubikRBT[i]) * linearFact(eyeRBT);
+					RBT A = rbt_frame(cubeRBT(i), eyeRBT);
 
 					glm::quat my_quat = glm::angleAxis((float)angle, axisVec);
 					if (glm::isnan(my_quat.x) || glm::isnan(my_quat.y) || glm::isnan(my_quat.z))
 						return;
-					glm::mat4 Q = glm::toMat4(my_quat);
+					glm::mat4 M = rbt_conjugate(RBT(my_quat, glm::vec3(0.0f)), A);
 
 					// Rotate other cubes
 					rubiksCubes[i].rotate(angle);
 					rubiksCubes[c_id1].rotation(rubiksCubes[i].rotation());
 					rubiksCubes[c_id2].rotation(rubiksCubes[i].rotation());
 
-					rubikRBT[i] = A * Q * glm::inverse(A) * rubikRBT[i];
-					rubikRBT[c_id1] = A * Q * glm::inverse(A) * rubikRBT[c_id1];
-					rubikRBT[c_id2] = A * Q * glm::inverse(A) * rubikRBT[c_id2];
+					scene.transform_world(cubeNodes[i], M);
+					scene.transform_world(cubeNodes[c_id1], M);
+					scene.transform_world(cubeNodes[c_id2], M);
 				}
 			}
 		}
 	}
 	else
 	{
-		glm::mat4 A = transFact(rubikRBT[rot_mid]) * linearFact(eyeRBT);
+		RBT A = rbt_frame(cubeRBT(rot_mid), eyeRBT);
 
 		double angle = rubiksCubes[rot_mid].getAlignAngle();
 
 		glm::quat my_quat = glm::angleAxis((float)angle, axisVec);
 		if (glm::isnan(my_quat.x) || glm::isnan(my_quat.y) || glm::isnan(my_quat.z))
 			return;
-		glm::mat4 Q = glm::toMat4(my_quat);
+		glm::mat4 M = rbt_conjugate(RBT(my_quat, glm::vec3(0.0f)), A);
 
 		rubiksCubes[rot_mid].rotate(angle);
 		rubiksCubes[rotatingCubes[1]].rotation(rubiksCubes[rotatingCubes[0]].rotation());
@@ -639,42 +677,104 @@ void alignCubes()
 		// Apply rotation to all cubes
 		for (int i = 0; i < 3; ++i)
 		{
-			rubikRBT[rotatingCubes[i]] = A * Q * glm::inverse(A) * rubikRBT[rotatingCubes[i]];
+			scene.transform_world(cubeNodes[rotatingCubes[i]], M);
 		}
 	}
 }
 
+// Called from poll_picks() once the picked ID has been read back
+static void on_pick(int target)
+{
+	if (!picking)
+		return;
+
+	if (target > 0)
+	{
+		if (picked_nums[(pick_num + 1) % 2] == target - 1)
+			return;
+		picked_nums[pick_num] = target - 1;
+
+		picked_cube_num = picked_nums[pick_num];
+
+		pick_num = (pick_num + 1) % 2;
+	}
+	else
+		return;
+
+	if (pick_num == 0)
+	{
+		checkSelection();
+
+		picked_nums[0] = picked_nums[1];
+		pick_num = 1;
+	}
+}
+
+// --pick-every-frame picks under a point sweeping across the window every frame, for benchmarks;
+// the result is only kept
+bool pickEveryFrame = false;
+int hoveredCube = -1;
+static void on_hover_pick(int target)
+{
+	hoveredCube = target - 1;
+}
+
+// Called from poll_picks() with the cubes inside the marquee rectangle
+static void on_pick_region(const std::map<int, int>& histogram)
+{
+	if (!picking)
+		return;
+
+	std::cout << "Marquee selected " << histogram.size() << " cube(s):";
+	for (std::map<int, int>::const_iterator it = histogram.begin(); it != histogram.end(); ++it)
+		std::cout << " " << it->first - 1 << " (" << it->second << " px)";
+	std::cout << std::endl;
+
+	// Two cubes are a complete selection, as if they had been clicked one after the other
+	if (histogram.size() == 2)
+	{
+		picked_nums[0] = picked_nums[1] = -1;
+		pick_num = 0;
+		for (std::map<int, int>::const_iterator it = histogram.begin(); it != histogram.end(); ++it)
+			on_pick(it->first);
+	}
+}
+
 // TODO: Fill up GLFW mouse button callback function
 static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE && marquee)
+	{
+		marquee = false;
+		double xpos, ypos;
+		inputLog.get_cursor_pos(window, &xpos, &ypos);
+		request_pick_region((int)marquee_x, (int)marquee_y, (int)xpos, (int)ypos, frameBufferWidth, frameBufferHeight, on_pick_region);
+	}
+
 	if(button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
 	{
 		if (picking)
 		{
 			double xpos, ypos;
-			glfwGetCursorPos(window, &xpos, &ypos);
-			int target = pick((int)xpos, (int)ypos, frameBufferWidth, frameBufferHeight);
-
-			if (target > 0)
+			inputLog.get_cursor_pos(window, &xpos, &ypos);
+			if (mods & GLFW_MOD_SHIFT)
 			{
-				if (picked_nums[(pick_num + 1) % 2] == target - 1)
-					return;
-				picked_nums[pick_num] = target - 1;
-
-				picked_cube_num = picked_nums[pick_num];
-
-				pick_num = (pick_num + 1) % 2;
+				marquee = true;
+				marquee_x = xpos;
+				marquee_y = ypos;
 			}
-			else
-				return;
-
-			if (pick_num == 0)
+			else if (ray_picking)
 			{
-				checkSelection();
-
-				picked_nums[0] = picked_nums[1];
-				pick_num = 1;
+				// No GPU round trip, the result is known right away
+				glm::vec3 origin, direction;
+				screen_ray(xpos, ypos, frameBufferWidth, frameBufferHeight, Projection, eyeRBT, origin, direction);
+				scene.update();
+				sceneBVH.update();
+				RayHit hit;
+				on_pick(sceneBVH.intersect(origin, direction, hit) ? hit.objectID : 0);
 			}
+			else
+				request_pick((int)xpos, (int)ypos, frameBufferWidth, frameBufferHeight, on_pick);
 		}
 		else
 			l_mouse_down = true;
@@ -699,21 +799,16 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 	const double new_x = xpos;
 	const double new_y = ypos;
 
-	glm::mat4 Q = glm::mat4(1.0f);
-	glm::mat4 T;
-	glm::mat4 L;
 	glm::quat my_quat;
 
+	// Frame to transform in: the origin of the pivot, the axes of the eye
+	RBT A;
 	if (r_mouse_down)
-		T = transFact(rubikRBT[4]);
+		A = rbt_frame(cubeRBT(4), eyeRBT);
 	else if (m_mouse_down)
-		T = transFact(eyeRBT);
+		A = RBT(eyeRBT);
 	else
-		T = transFact(arcballRBT);
-
-	L = linearFact(eyeRBT);
-	
-	glm::mat4 A = T * L;
+		A = rbt_frame(arcballRBT, eyeRBT);
 
 	double delta_x = (new_x - mouse_x);
 	double delta_y = (new_y - mouse_y);
@@ -722,13 +817,13 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 	{
 		float x1 = (float)mouse_x - arc_screen_coords[0];
 		float y1 = (float)-mouse_y + arc_screen_coords[1];
-		float z1 = sqrt(max(0.0f, (pow(arcBallScreenRadius, 2) - pow(x1, 2) - pow(y1, 2))));
+		float z1 = sqrt(max(0.0f, (pow(arcBallScreenRadius, 2.0f) - pow(x1, 2.0f) - pow(y1, 2.0f))));
 		startVec = glm::normalize(glm::vec3(x1, y1, z1));
 
 		float x2 = (float)xpos - arc_screen_coords[0];
 		float y2 = (float)-ypos + arc_screen_coords[1];
 
-		float z2 = sqrt(max(0.0f, (pow(arcBallScreenRadius, 2) - pow(x2, 2) - pow(y2, 2))));
+		float z2 = sqrt(max(0.0f, (pow(arcBallScreenRadius, 2.0f) - pow(x2, 2.0f) - pow(y2, 2.0f))));
 		endVec = glm::normalize(glm::vec3(x2, y2, z2));
 
 		glm::vec3 k = glm::cross(startVec, endVec);
@@ -750,7 +845,7 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 		my_quat = glm::angleAxis((float)angle, k);
 		if (glm::isnan(my_quat.x) || glm::isnan(my_quat.y) || glm::isnan(my_quat.z))
 			return;
-		Q = glm::toMat4(my_quat);
+		glm::mat4 M = rbt_conjugate(RBT(my_quat, glm::vec3(0.0f)), A);
 
 		if (rot_mid == 4)
 		{
@@ -771,20 +866,20 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 		for (int i = 0; i < 3; ++i)
 		{
 			//rubiksCubes[rotatingCubes[i]].rotate(angle, now);
-			rubikRBT[rotatingCubes[i]] = A * Q * glm::inverse(A) * rubikRBT[rotatingCubes[i]];
+			scene.transform_world(cubeNodes[rotatingCubes[i]], M);
 		}
 	}
 	else if (r_mouse_down)
 	{
 		float x1 = (float)mouse_x - arc_screen_coords[0];
 		float y1 = (float)-mouse_y + arc_screen_coords[1];
-		float z1 = sqrt(max( 0.0f, (pow(arcBallScreenRadius, 2) - pow(x1, 2) - pow(y1, 2)) ));
+		float z1 = sqrt(max( 0.0f, (pow(arcBallScreenRadius, 2.0f) - pow(x1, 2.0f) - pow(y1, 2.0f)) ));
 		startVec = glm::normalize(glm::vec3(x1, y1, z1));
 
 		float x2 = (float)xpos - arc_screen_coords[0];
 		float y2 = (float)-ypos + arc_screen_coords[1];
 
-		float z2 = sqrt(max(0.0f, (pow(arcBallScreenRadius, 2) - pow(x2, 2) - pow(y2, 2))));
+		float z2 = sqrt(max(0.0f, (pow(arcBallScreenRadius, 2.0f) - pow(x2, 2.0f) - pow(y2, 2.0f))));
 		endVec = glm::normalize(glm::vec3(x2, y2, z2));
 
 		glm::vec3 k = glm::normalize(glm::cross(startVec, endVec));
@@ -793,21 +888,16 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 		my_quat = glm::angleAxis(angle, k);
 		if (glm::isnan(my_quat.x) || glm::isnan(my_quat.y) || glm::isnan(my_quat.z))
 			return;
-		Q = glm::toMat4(my_quat);
-
-		// Apply rotation to all cubes
-		for (int i = 0; i < NUM_CUBES; ++i)
-		{
-			rubikRBT[i] = A * Q * glm::inverse(A) * rubikRBT[i];
-		}
+		// Rotating the parent rotates all cubes
+		scene.transform_world(floppyNode, rbt_conjugate(RBT(my_quat, glm::vec3(0.0f)), A));
 
 		// Update the axis vector we rotate around
 		update_axisVec();
 	}
 	else if (m_mouse_down)
 	{
-		Q = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -delta_y * 0.015));
-		eyeRBT = A * Q * glm::inverse(A) * eyeRBT;
+		RBT Q(glm::quat(), glm::vec3(0.0f, 0.0f, -delta_y * 0.015));
+		eyeRBT = rbt_conjugate(Q, A) * eyeRBT;
 	}
 
 	mouse_x = new_x;
@@ -825,7 +915,11 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 			std::cout << "keymaps:" << std::endl;
 			std::cout << "h\t\t\t Help command" << std::endl;
 			std::cout << "p\t\t\t Enable/Disable picking" << std::endl;
+			std::cout << "r\t\t\t Toggle ray (BVH) / picking pass selection" << std::endl;
+			std::cout << "f\t\t\t Toggle frame time graph" << std::endl;
+			std::cout << "t\t\t\t Write the last 120 frames to floppy_trace.json (chrome://tracing)" << std::endl;
 			std::cout << "left mouse btn\t\t Pick cubes when picking, else rotate selected group" << std::endl;
+			std::cout << "shift + left drag\t Pick the cubes inside a rectangle" << std::endl;
 			std::cout << "right mouse btn\t\t Rotate whole floppy cube" << std::endl;
 			std::cout << "middle mouse btn\t Move floppy cube toward/away from camera" << std::endl;
 			break;
@@ -839,14 +933,36 @@ static void keyboard_callback(GLFWwindow* window, int key, int scancode, int act
 
 			alignCubes();
 			break;
+		case GLFW_KEY_R:
+			ray_picking = !ray_picking;
+			std::cout << (ray_picking ? "Picking with rays" : "Picking with the picking pass") << std::endl;
+			break;
+		case GLFW_KEY_F:
+			profiler.overlay = !profiler.overlay;
+			break;
+		case GLFW_KEY_T:
+			profiler.write_trace("floppy_trace.json");
+			break;
 		default:
 			break;
 		}
 	}
 }
 
-int main(void)
+int main(int argc, char* argv[])
 {
+	// --headless renders a fixed number of frames offscreen and exits, see common/headless.hpp
+	headless.parse(argc, argv);
+	if (!headless.init_hints())
+	{
+		return -1;
+	}
+	// --record and --replay log the input, see common/input_log.hpp
+	inputLog.parse(argc, argv);
+	for (int i = 1; i < argc; ++i)
+		if (strcmp(argv[i], "--pick-every-frame") == 0)
+			pickEveryFrame = true;
+
 	// Initialise GLFW
 	if (!glfwInit())
 	{
@@ -858,6 +974,7 @@ int main(void)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	headless.window_hints();
 
 	// Open a window and create its OpenGL context
 	window = glfwCreateWindow((int)windowWidth, (int)windowHeight, "Homework 3: 20166029 - Fredrik Berglund", NULL, NULL);
@@ -876,11 +993,15 @@ int main(void)
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 	glfwSetWindowSizeCallback(window, window_size_callback);
-	glfwSetMouseButtonCallback(window, mouse_button_callback);
-	glfwSetCursorPosCallback(window, cursor_pos_callback);
-	glfwSetKeyCallback(window, keyboard_callback);
+	if (!inputLog.initialize()) {
+		return -1;
+	}
+	inputLog.set_callbacks(window, keyboard_callback, mouse_button_callback, cursor_pos_callback);
 
 	glfwGetFramebufferSize(window, &frameBufferWidth, &frameBufferHeight);
+	if (!headless.initialize(frameBufferWidth, frameBufferHeight)) {
+		return -1;
+	}
 	// Update arcBallScreenRadius with framebuffer size
 	arcBallScreenRadius = 0.25f * min((float) frameBufferWidth, (float) frameBufferHeight); // for the initial assignment
 
@@ -897,7 +1018,7 @@ int main(void)
 	glCullFace(GL_BACK);
 
 	// Initialize framebuffer object and picking textures
-	picking_initialize(frameBufferWidth, frameBufferHeight);
+	picking_initialize();
 
 	Projection = glm::perspective(fov, ((float) frameBufferWidth / (float) frameBufferHeight), 0.1f, 100.0f);
 	skyRBT = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, 0.25, 4.0));
@@ -931,18 +1052,26 @@ int main(void)
 		glm::vec3(0 / 255.f, 0 / 255.f, 0 / 255.f),
 	};
 
+	floppyNode = scene.add_node();
 	for (int i = 0; i < NUM_CUBES; ++i)
-	{
-		rubikModels[i] = Model();
-		init_rubic(rubikModels[i], colors);
-		rubikModels[i].initialize(DRAW_TYPE::ARRAY, "VertexShader.glsl", "ReflectiveFragmentShader.glsl");
-		rubikModels[i].initialize_picking("PickingVertexShader.glsl", "PickingFragmentShader.glsl");
-		rubikModels[i].set_projection(&Projection);
-		rubikModels[i].set_eye(&eyeRBT);
-		rubikModels[i].set_model(&rubikRBT[i]);
-
-		rubikModels[i].objectID = i+1;
-	}
+		cubeNodes[i] = scene.add_node(floppyNode, rubikRBT[i]);
+
+	// The cubes are drawn and picked with one instanced draw of rubikModel, see the render loop.
+	// Cube i is object ID i+1; culling and the BVH take its transform from cubeNodes[i].
+	ShaderPermutation instanced;
+	instanced.instanced = true;
+	rubikModel = Model();
+	init_rubic(rubikModel, colors);
+	rubikModel.initialize(DRAW_TYPE::ARRAY, LoadShaders("VertexShader.glsl", "ReflectiveFragmentShader.glsl", instanced));
+	rubikModel.initialize_picking("PickingVertexShader.glsl", "PickingFragmentShader.glsl", instanced);
+	rubikModel.set_projection(&Projection);
+	rubikModel.set_eye(&eyeRBT);
+	rubikModel.set_model(scene.world_pointer(cubeNodes[0]));
+	rubikModel.objectID = 1;
+
+	cubeBVH.build(rubikModel.get_vertices(), rubikModel.get_indices());
+	for (int i = 0; i < NUM_CUBES; ++i)
+		sceneBVH.add_instance(&cubeBVH, scene.world_pointer(cubeNodes[i]), i + 1);
 
 	pickedModel = Model();
 	init_rubic(pickedModel, colors2);
@@ -963,14 +1092,17 @@ int main(void)
 
 	// Setting Light Vectors
 	glm::vec3 lightVec = glm::vec3(0.0f, 1.0f, 0.0f);
+	for (int i = 0; i < NUM_CUBES; ++i)
+		cullList.add(&rubikModel, scene.world_pointer(cubeNodes[i]));
+	pickedCull = cullList.add(&pickedModel);
+	groundCull = cullList.add(&ground);
+	arcBallCull = cullList.add(&arcBall);
+
 	lightLocGround = glGetUniformLocation(ground.GLSLProgramID, "uLight");
 	glUniform3f(lightLocGround, lightVec.x, lightVec.y, lightVec.z);
 
-	for (int i = 0; i < NUM_CUBES; ++i)
-	{
-		lightLoc[i] = glGetUniformLocation(rubikModels[i].GLSLProgramID, "uLight");
-		glUniform3f(lightLoc[i], lightVec.x, lightVec.y, lightVec.z);
-	}
+	lightLocCubes = glGetUniformLocation(rubikModel.GLSLProgramID, "uLight");
+	glUniform3f(lightLocCubes, lightVec.x, lightVec.y, lightVec.z);
 
 	lightLocArc = glGetUniformLocation(arcBall.GLSLProgramID, "uLight");
 	glUniform3f(lightLocArc, lightVec.x, lightVec.y, lightVec.z);
@@ -997,35 +1129,59 @@ int main(void)
 	rubiksCubes[8].setParents(&rubiksCubes[5], &rubiksCubes[7]);
 	rubiksCubes[6].setParents(&rubiksCubes[7], &rubiksCubes[3]);
 
-	do {
-		// first pass: picking shader
-		// binding framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, picking_fbo);
-		// Background: RGB = 0x000000 => objectID: 0
-		glClearColor((GLclampf) 0.0f, (GLclampf) 0.0f, (GLclampf) 0.0f, (GLclampf) 0.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	dynamicRing.initialize(64 * 1024);
+	frameRing = &dynamicRing;
 
-		// drawing objects in framebuffer (picking process)
-		for (int i = 0; i < NUM_CUBES; ++i)
+	// Textures and framebuffers were set up without the state cache
+	glState.invalidate();
+
+	profiler.initialize();
+
+	const glm::mat4 startEyeRBT = eyeRBT;
+	int frame = 0;
+	do {
+		inputLog.begin_frame(window);
+		profiler.begin_frame();
+		dynamicRing.begin_frame();
+		if (headless.enabled)
+			eyeRBT = headless.camera(startEyeRBT);
+
+		// Finish the clicks whose picking reads have completed; logged input waits for them so
+		// a replayed click lands in the same frame as the recorded one
+		poll_picks(inputLog.active());
+		if (pickEveryFrame && frameBufferWidth > 0)
+			request_pick((frame * 7) % frameBufferWidth, frameBufferHeight / 2, frameBufferWidth, frameBufferHeight, on_hover_pick);
+		++frame;
+
+		// World transforms of the cubes the mouse moved since the last frame
+		scene.update();
+
+		// first pass: picking shader, only when a click is waiting for it
+		glm::mat4 pickProjection;
+		while (next_picking_pass(Projection, frameBufferWidth, frameBufferHeight, pickProjection))
 		{
-			rubikModels[i].drawPicking();
+			ProfileScope cpuScope("Picking pass");
+			GpuProfileScope gpuScope("Picking pass");
+			// drawing objects in framebuffer (picking process), gl_InstanceID + 1 is the object ID.
+			// The cube nodes were added one after another, so their world transforms are contiguous.
+			pick_draw_instanced(rubikModel, pickProjection, scene.world_pointer(cubeNodes[0]), NUM_CUBES);
+			end_picking_pass(frameBufferWidth, frameBufferHeight);
 		}
 
-		// second pass: your drawing
-		// unbinding framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		// second pass: your drawing, to the window or the headless framebuffer
+		glState.bind_framebuffer(GL_FRAMEBUFFER, headless.framebuffer());
 		glClearColor((GLclampf)(128. / 255.), (GLclampf)(200. / 255.), (GLclampf)(255. / 255.), (GLclampf)0.);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		if (r_mouse_down)
-			arcballRBT = rubikRBT[4];
+			arcballRBT = cubeRBT(4);
 		else if (rot_mid != -1 && !picking)
 		{
-			arcballRBT = rubikRBT[rot_mid];
+			arcballRBT = cubeRBT(rot_mid);
 		}
 		else
 			arcballRBT = eyeRBT;
-		glm::mat4 arcEye = glm::inverse(eyeRBT) * arcballRBT; // arcBall in eye-coordinates
+		glm::mat4 arcEye = rigid_inverse(eyeRBT) * arcballRBT; // arcBall in eye-coordinates
 
 		// Only change scale when not transforming
 		if (!l_mouse_down && !m_mouse_down)
@@ -1040,25 +1196,45 @@ int main(void)
 		arc_screen_coords = eye_to_screen(arc_coords, Projection, frameBufferWidth, frameBufferHeight);
 		arc_screen_coords.y = -(arc_screen_coords.y - frameBufferHeight);
 
-		// Draw rubik models
+		if (picked_cube_num >= 0)
+			pickedRBT = cubeRBT(picked_cube_num);
+		cullList.cull(Projection, eyeRBT);
+		cullList.report("Floppy cube");
+
+		// Draw rubik models, the visible ones in a single instanced draw
+		glm::mat4 instanceRBT[NUM_CUBES];
+		int numInstances = 0;
 		for (int i = 0; i < NUM_CUBES; ++i)
 		{
+			if(!cullList.visible(i))
+				continue;
 			if(!picking || r_mouse_down || i != picked_cube_num || picked_nums[0] == -1)
-				rubikModels[i].draw();
+				instanceRBT[numInstances++] = cubeRBT(i);
 		}
+		glState.use_program(rubikModel.GLSLProgramID);
+		rubikModel.drawInstanced(instanceRBT, numInstances);
 
-		pickedRBT = rubikRBT[picked_cube_num];
-		if(!r_mouse_down && picking && picked_nums[0] != -1)
+		if(!r_mouse_down && picking && picked_nums[0] != -1 && cullList.visible(pickedCull))
 			pickedModel.draw();
-		ground.draw();
+		if (cullList.visible(groundCull))
+			ground.draw();
 
 		// TODO: Draw wireframe of arcball with dynamic radius
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // draw wireframe
-		arcBall.draw();
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); // draw filled models again
+		glState.polygon_mode(GL_LINE); // draw wireframe
+		if (cullList.visible(arcBallCull))
+			arcBall.draw();
+		glState.polygon_mode(GL_FILL); // draw filled models again
+
+		profiler.draw_overlay(frameBufferWidth, frameBufferHeight);
+		profiler.end_frame();
 
 		// Swap buffers (Double buffering)
+		dynamicRing.end_frame();
+		glState.end_frame();
+		glState.report("Floppy cube");
 		glfwSwapBuffers(window);
+		headless.end_frame(window);
+		inputLog.end_frame();
 		glfwPollEvents();
 	} // Check if the ESC key was pressed or the window was closed
 	while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
@@ -1066,13 +1242,17 @@ int main(void)
 
 	// Clean up data structures and glsl objects
 	ground.cleanup();
-	for (int i = 0; i < NUM_CUBES; ++i)
-		rubikModels[i].cleanup();
+	rubikModel.cleanup();
 	arcBall.cleanup();
+	dynamicRing.cleanup();
+	profiler.cleanup();
 
 	// Cleanup textures
 	delete_picking_resources();
 
+	headless.cleanup();
+	inputLog.cleanup();
+
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 